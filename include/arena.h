@@ -0,0 +1,46 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "blk.h"
+#include "config.h"
+
+namespace sbfs {
+/*
+ * One contiguous anonymous mapping of blocks, e.g. all slots of the block cache.
+ * Pages are committed on first touch, so a cache that is never filled doesn't take its full size of memory.
+ * With "hugetlb", it's backed by reserved huge pages (vm.nr_hugepages), if there are not enough of them,
+ * or without "hugetlb", it's aligned to kHugePageSize and advised to use transparent huge pages.
+ * Being one page aligned range, it can be registered to io_uring as a few large fixed buffers,
+ * and used for O_DIRECT requests as is.
+ */
+class BlockArena {
+public:
+    BlockArena() = default;
+    BlockArena(const BlockArena &) = delete;
+    BlockArena &operator=(const BlockArena &) = delete;
+    ~BlockArena();
+    /* map "count" blocks, returns kFail if even plain pages can't be mapped. */
+    int init(uint64_t count, bool hugetlb);
+    Block *base() const {
+        return base_;
+    }
+    uint64_t count() const {
+        return count_;
+    }
+    /* give the memory of blocks [first, first + count) back to the system, they read as zeros when touched again. */
+    void release(uint64_t first, uint64_t count);
+    /* backed by hugetlb pages. */
+    bool hugetlb() const {
+        return hugetlb_;
+    }
+
+private:
+    Block *base_ = nullptr;
+    uint64_t count_ = 0;
+    void *map_ = nullptr; /* the mapping, base_ is aligned in it */
+    size_t map_size_ = 0;
+    bool hugetlb_ = false;
+};
+}  // namespace sbfs
+
+#endif  // ARENA_H_
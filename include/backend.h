@@ -0,0 +1,83 @@
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <sys/uio.h>
+
+#include "blk.h"
+#include "config.h"
+
+namespace sbfs {
+enum BackendType : uint32_t {
+    kFileBackend, /* O_DIRECT file, pread / pwrite */
+    kMmapBackend, /* file mapped into memory, goes through the kernel page cache */
+    kRamBackend,  /* anonymous memory, nothing survives unmount */
+};
+
+/*
+ * Storage under BlockDevice (the simulated "disk").
+ * All requests are synchronous and block aligned, a block is addressed by block_id * kBlockSize.
+ */
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+    /* Create a backend of "size" bytes at path (ignored by RAM disk), returns nullptr on failure. */
+    static StorageBackend *create(BackendType type, const char *path, uint64_t size);
+    /* Parse "file", "mmap" or "ram", returns kFail for other names. */
+    static int parse_type(const char *name, BackendType *type);
+
+    virtual int read(blk_id_t block_id, Block *buf) = 0;
+    virtual int write(blk_id_t block_id, const Block *buf) = 0;
+    /* Vectored read / write of "cnt" blocks starting at block_id. */
+    virtual int readv(blk_id_t block_id, const iovec *iov, int cnt) = 0;
+    virtual int writev(blk_id_t block_id, const iovec *iov, int cnt) = 0;
+    /* Make all written blocks durable. */
+    virtual int flush() = 0;
+    /* File descriptor that io_uring requests can be queued to, -1 if there is none. */
+    virtual int fd() const {
+        return -1;
+    }
+};
+
+/* The default backend, an O_DIRECT file bypassing the page cache. */
+class FileBackend : public StorageBackend {
+public:
+    FileBackend(int fd) : fd_(fd) {}
+    ~FileBackend() override;
+
+    int read(blk_id_t block_id, Block *buf) override;
+    int write(blk_id_t block_id, const Block *buf) override;
+    int readv(blk_id_t block_id, const iovec *iov, int cnt) override;
+    int writev(blk_id_t block_id, const iovec *iov, int cnt) override;
+    int flush() override;
+    int fd() const override {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+/*
+ * A memory region used as disk, requests are memcpy.
+ * With a file (mmap backend) it is a shared mapping and flush is msync,
+ * without (RAM disk) it is anonymous memory and flush does nothing.
+ */
+class MemoryBackend : public StorageBackend {
+public:
+    MemoryBackend(int fd, uint8_t *base, uint64_t size) : fd_(fd), base_(base), size_(size) {}
+    ~MemoryBackend() override;
+
+    int read(blk_id_t block_id, Block *buf) override;
+    int write(blk_id_t block_id, const Block *buf) override;
+    int readv(blk_id_t block_id, const iovec *iov, int cnt) override;
+    int writev(blk_id_t block_id, const iovec *iov, int cnt) override;
+    int flush() override;
+
+private:
+    int fd_; /* -1 for RAM disk */
+    uint8_t *base_;
+    uint64_t size_;
+};
+}  // namespace sbfs
+
+#endif  // BACKEND_H_
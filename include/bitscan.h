@@ -0,0 +1,28 @@
+#ifndef BITSCAN_H_
+#define BITSCAN_H_
+
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Word scans of bitmaps (see Bitmap), with AVX-512 and AVX2 kernels picked at startup by what the CPU
+ * supports, and a scalar one otherwise (and on other architectures than x86-64). A kernel compares 8 (or 4)
+ * words per instruction, so a whole bitmap block (512 words) takes a few dozen instructions.
+ */
+enum BitscanKernel : uint32_t {
+    kScalarScan,
+    kAVX2Scan,
+    kAVX512Scan,
+};
+
+/* index of the first word of words[0, n) that isn't "value", n if none. */
+size_t find_word_not(const uint64_t *words, size_t n, uint64_t value);
+
+/* the kernel find_word_not uses, and its name. */
+BitscanKernel bitscan_kernel();
+const char *bitscan_kernel_name(BitscanKernel kernel);
+/* use "kernel" from now on (for benchmarks), returns kFail if the CPU doesn't support it. */
+int set_bitscan_kernel(BitscanKernel kernel);
+}  // namespace sbfs
+
+#endif  // BITSCAN_H_
@@ -4,6 +4,9 @@
 #include "config.h"
 
 namespace sbfs {
+/* owner of a cached block that no inode claims, see BlockStatus::owner. */
+constexpr uint32_t kNoOwner = UINT32_MAX;
+
 struct alignas(kBlockSize) Block {
     uint8_t data[kBlockSize];
     /* TODO: maybe some helper functions */
@@ -18,6 +21,10 @@ struct BlockStatus {
     int prev;
     int next;
     int id;
+    uint64_t dirty_time; /* when it became dirty, see now_ms() */
+    uint32_t owner;      /* inode that dirtied it, kNoOwner if none */
+    uint32_t pin;        /* number of BlockRef holding it, pinned slots are not evicted */
+    uint8_t queue;       /* list of the cache shard it is on, see LRUCacheManager */
     // int file_id;?
     bool is_dirty() const {
         return status & 1;
@@ -25,8 +32,19 @@ struct BlockStatus {
     void rev_dirty() {
         status ^= 1;
     }
+    /* put in the cache by readahead, and not referenced since. */
+    bool is_prefetched() const {
+        return status & 2;
+    }
+    void set_prefetched(bool prefetched) {
+        status = prefetched ? status | 2 : status & ~2;
+    }
     void init() {
         status = 0;
+        dirty_time = 0;
+        owner = kNoOwner;
+        pin = 0;
+        queue = 0;
         prev = next = -1;
         id = -1;
     }
@@ -3,28 +3,47 @@
 
 #include "blk.h"
 #include "config.h"
+#include "lru_cache.h"
 
 namespace sbfs {
 class BlockDevice;
 
 class BlockCacheManager {
 public:
-    BlockCacheManager(uint64_t cache_size, BlockDevice *parent);
+    BlockCacheManager(uint64_t cache_size, BlockDevice *parent, CachePolicy policy = k2QPolicy, bool hugetlb = false,
+                      uint64_t max_cache_size = 0);
     ~BlockCacheManager();
     /*
      * insert or update a block to cache, if full, evict and write back (another) one.
      * return 0 if success, kFail if failed.
      * if update, set "dirty" (Inconsistent to )
      */
-    int upsert(blk_id_t block_id, const Block *block);
+    int upsert(blk_id_t block_id, const Block *block, bool is_update = false, uint32_t owner = kNoOwner);
     /* get a block from cache. returns kFail if failed. */
     int get(blk_id_t block_id, Block *block);
+    int peek(blk_id_t block_id, Block *block);
+    int peek(blk_id_t block_id, uint8_t *buf, uint32_t offset, uint32_t len);
+    /* nothing is cached, so these are no-ops (update and partial upsert fail, the caller writes to disk). */
+    int fill(blk_id_t block_id, const Block *block, bool prefetched = false);
+    int update(blk_id_t block_id, const Block *block, uint32_t owner = kNoOwner);
+    int upsert(blk_id_t block_id, const uint8_t *buf, uint32_t offset, uint32_t len, uint32_t owner = kNoOwner);
+    bool contains(blk_id_t block_id) const;
+    Block *pin(blk_id_t block_id);
+    void unpin(blk_id_t block_id, bool dirty, uint32_t owner = kNoOwner);
+    int take_dirty(const std::vector<blk_id_t> &block_ids, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    int take_dirty(uint32_t owner, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    int take_all_dirty(std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    int pick_writeback(uint64_t now_ms, size_t max_blocks, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    int redirty(const std::vector<std::pair<blk_id_t, const Block *>> &blocks);
+    uint64_t dirty_blocks() const;
+    bool over_dirty_ratio() const;
+    /* nothing to resize, the size is 0 blocks. */
+    int resize(uint64_t cache_size);
+    uint64_t size() const;
     /* remove a block from cache, if dirty, write back. */
     int remove(blk_id_t block_id);
     /* write back block. */
     int sync(blk_id_t block_id);
-    /* sync all blocks. */
-    int sync_all();
 
 private:
     /*
@@ -1,32 +1,141 @@
 #ifndef BLK_DEV_H_
 #define BLK_DEV_H_
 
+#include "backend.h"
 #include "blk_cache.h"
 #include "config.h"
+#include "io_engine.h"
+#include "journal.h"
 #include "lru_cache.h"
+#include "pressure.h"
+#include "stats.h"
 
 namespace sbfs {
+class BlockRef;
+
+/* Options of BlockDevice, chosen at mount time. */
+struct DeviceOptions {
+    /* what the disk is, see BackendType. */
+    BackendType backend = kFileBackend;
+    /* use io_uring engine instead of pread / pwrite (needs IO_URING). */
+    bool io_uring = false;
+    /* max in flight requests of io_uring. */
+    uint32_t queue_depth = kIOQueueDepth;
+    /* replacement policy of the block cache, see CachePolicy. */
+    CachePolicy cache_policy = k2QPolicy;
+    /* put the block cache on hugetlb pages (falls back to transparent huge pages), see BlockArena. */
+    bool cache_hugetlb = false;
+    /* block cache size in bytes, it can be changed online by resize_cache up to cache_max_size (if larger). */
+    uint64_t cache_size = kBlockCacheSize;
+    uint64_t cache_max_size = 0;
+    /* shrink the block cache under memory pressure, see start_pressure_monitor. */
+    bool pressure_monitor = true;
+    /* file reads / writes of at least this many bytes bypass the block cache (0 for never), see read_direct. */
+    uint64_t direct_io_threshold = kDirectIOThreshold;
+    /* delayed allocation of buffered file writes (used by the file system), see DelayedAlloc. */
+    bool delalloc = true;
+    /* new files and directories map their data with extent trees (used by the file system), see ExtentHeader. */
+    bool extents = true;
+};
+
 class BlockDevice {
 public:
-    /* Path is the simulated "disk file" path, size is its size. */
-    BlockDevice(const char *path, uint64_t size);
+    /* Path is the simulated "disk file" path (unused by RAM disk), size is its size. */
+    BlockDevice(const char *path, uint64_t size, const DeviceOptions &options = DeviceOptions());
     ~BlockDevice();
     /*
      * Read block_id to buf,
-     * First find the block in BlockCacheManager,
+     * First find the block in BlockCacheManager (a hit doesn't take the device lock),
      * if missed, read from disk, and put it in BlockCacheManager.
      */
     int read(blk_id_t block_id, Block *buf);
     /*
      * Write buf to block_id
      * (only write to the cache is OK)
+     * the block belongs to the owner of the running OwnerScope, if any, and is metadata of it, see fsync.
      */
     int write(blk_id_t block_id, const Block *buf);
+    /*
+     * Read a batch of (block_id, buf) pairs,
+     * all of them are looked up in the cache first,
+     * then the missed ones are read with one preadv per run of contiguous block ids.
+     */
+    int read_blocks(const std::vector<std::pair<blk_id_t, Block *>> &blocks);
+    /*
+     * Write a batch of (block_id, buf) pairs,
+     * all of them go to the cache dirty (missed ones without being read), to be written back later.
+     * Blocks the cache can't take (or all of them without a cache) are written to disk
+     * with one pwritev per run of contiguous block ids.
+     */
+    int write_blocks(const std::vector<std::pair<blk_id_t, const Block *>> &blocks);
+    /*
+     * Read "len" bytes to "buf" from the blocks "block_ids", starting at "offset" (< kBlockSize) of the first one.
+     * Cached blocks are copied straight to "buf", the missed ones are read like read_blocks.
+     */
+    int read_range(const std::vector<blk_id_t> &block_ids, uint32_t offset, uint8_t *buf, uint32_t len);
+    /*
+     * Write "len" bytes of "buf" to the blocks "block_ids", starting at "offset" (< kBlockSize) of the first one.
+     * "buf" is copied straight into the cache, where the blocks are dirty (a missed one is read first unless
+     * it's written whole). In a transaction, or for blocks the cache can't take, it's like write_blocks.
+     */
+    int write_range(const std::vector<blk_id_t> &block_ids, uint32_t offset, const uint8_t *buf, uint32_t len);
+    /*
+     * Like read_blocks / write_blocks, but bypassing the cache (direct I/O of large transfers),
+     * bufs must be kBlockSize aligned. Dirty cached blocks are written back before they are read,
+     * cached copies of written blocks are dropped. In a transaction they are read_blocks / write_blocks.
+     */
+    int read_direct(const std::vector<std::pair<blk_id_t, Block *>> &blocks);
+    int write_direct(const std::vector<std::pair<blk_id_t, const Block *>> &blocks);
+    /* transfers of at least this many bytes should use read_direct / write_direct, 0 if none. */
+    uint64_t direct_io_threshold() const {
+        return direct_io_threshold_;
+    }
+    /*
+     * Pin block_id and let "ref" point to it, so that it can be read and modified in place without a copy.
+     * Modifications must be followed by ref->mark_dirty(). In a transaction "ref" points to the copy of the
+     * transaction, and without cache (or if the cache is all pinned) to a private copy written back on release.
+     * The device is locked until "ref" is released, release it before fsync.
+     */
+    int pin(blk_id_t block_id, BlockRef *ref);
+    /*
+     * Read uncached ones of "block_ids" into the cache in background (readahead),
+     * with io_uring they are submitted, otherwise they are queued to the readahead thread (started on first use),
+     * up to kReadaheadQueue batches. Either way the cache is filled by the next read after they complete.
+     */
+    int prefetch(const std::vector<blk_id_t> &block_ids);
     /*
      * transactionally write "bufs" block to block "block_ids", all modifications should be to disk.
      * guarantee this write operation is atomic, disk shouldn't have any middle states.
+     * (committed to the journal if there is one, then put to cache.)
+     * fails without writing anything if the log write fails or it is larger than Journal::max_tx_blocks.
      */
     int write_tx(const std::vector<blk_id_t> &block_ids, const std::vector<const Block *> &bufs);
+    /*
+     * Open a transaction, until the matching commit_tx, all writes are buffered,
+     * then commit_tx writes them with one write_tx. Nested transactions join the outer one.
+     * abort_tx drops the buffered writes instead and runs the on_abort actions (undoing in-memory state changed
+     * with them, e.g. bitmap bits) in reverse order, an aborted nested transaction aborts the outer one,
+     * whose commit_tx then fails. commit_tx runs them too if the commit fails.
+     */
+    void begin_tx();
+    int commit_tx();
+    void abort_tx();
+    /* run "undo" if the running transaction is aborted, nothing if there is none. */
+    void on_abort(std::function<void()> undo);
+    /*
+     * whether a transaction is open by this thread, others (e.g. fsync, which runs outside of the vfs lock)
+     * neither see its uncommitted blocks nor join it.
+     */
+    bool in_tx() const {
+        return tx_depth_ > 0 && tx_thread_ == std::this_thread::get_id();
+    }
+    /*
+     * Use [start_block, start_block + num_blocks) as journal,
+     * format an empty one if "format", else replay it.
+     */
+    int init_journal(blk_id_t start_block, uint32_t num_blocks, bool format);
+    /* flush the write cache of the disk file. */
+    int flush();
     /*
      * sync block_id to disk
      * that is, if block_id exists in cache,
@@ -34,21 +143,241 @@ public:
      */
     int sync(blk_id_t block_id);
 
+    /* write back all dirty blocks in ascending block order, one pwritev per contiguous run. */
     int sync_all();
+    /*
+     * Set the inode that blocks written from now on belong to (kNoOwner for none), returns the previous one.
+     * Writers hold the vfs lock, so one owner at a time is enough. See OwnerScope.
+     */
+    uint32_t set_owner(uint32_t owner);
+    /*
+     * Start the background flusher, it writes back dirty blocks that are expired or over the dirty ratio.
+     * Call it in the process that serves requests (i.e. after FUSE daemonizes), threads don't survive fork.
+     * "hook" is called first on each wake up, without the device lock, e.g. to flush delayed allocations.
+     */
+    void start_writeback(std::function<void()> hook = nullptr);
+    /* Stop the background flusher and wait for it. */
+    void stop_writeback();
+    /*
+     * Set the block cache size (in bytes), shrinking writes back and releases slots. It's also the size
+     * the cache grows back to after memory pressure. Returns kFail if some slots can't be released yet.
+     */
+    int resize_cache(uint64_t size);
+    /* current block cache size in bytes. */
+    uint64_t cache_size() const;
+    /* Stats::report() and gauges of the cache, it's also logged every kStatsDumpIntervalMs by the flusher. */
+    std::string stats() const;
+    /*
+     * If enabled in DeviceOptions, watch memory pressure: the cache shrinks by kCacheShrinkPercent on each event
+     * (down to kCacheMinSize), and grows back by kCacheGrowPercent of its size each kPressureCalmMs without one.
+     * Like start_writeback, call it in the process that serves requests.
+     */
+    void start_pressure_monitor();
+    void stop_pressure_monitor();
+    /*
+     * Make blocks durable: dirty blocks of inode "owner" are written back in place, "meta_ids" are committed
+     * to the journal, with the blocks written by write() or a pin for "owner" since its last fsync (index and
+     * bitmap blocks, data goes through write_range), so the inode never points at blocks free on disk even
+     * if another owner dirtied the shared bitmap block last. Callers arriving within a short window, or while
+     * a group is being flushed, are committed as one group which shares one batched writeback and one flush,
+     * and each caller returns when its group completes.
+     */
+    int fsync(uint32_t owner, const std::vector<blk_id_t> &meta_ids);
 
     int write_to_disk(blk_id_t block_id, const Block *buf) const;
     int read_from_disk(blk_id_t block_id, Block *buf) const;
 
+    /*
+     * Asynchronous disk access, bypassing the cache.
+     * cb is called once the request completes, buf must stay valid until then.
+     * Without io_uring, they complete (and call cb) before returning.
+     */
+    int read_async(blk_id_t block_id, Block *buf, io_callback_t cb);
+    int write_async(blk_id_t block_id, const Block *buf, io_callback_t cb);
+    /* reap completed asynchronous requests, wait until all of them complete if wait is true. */
+    int poll(bool wait = false);
+
 private:
+    friend class Journal;
+    friend class BlockRef;
+    /* sort "blocks" by block id, and do one readv / writev for each contiguous run. */
+    int read_runs(std::vector<std::pair<blk_id_t, Block *>> &blocks) const;
+    int write_runs(std::vector<std::pair<blk_id_t, const Block *>> &blocks) const;
+    /*
+     * if block_id is being prefetched by io_uring, wait for it, then install the completed prefetches,
+     * so that it's read from the cache. One queued to the readahead thread is not waited for,
+     * the caller reads it itself.
+     */
+    void wait_prefetch(blk_id_t block_id);
+    /* fill the cache with prefetched_, only where no I/O is in flight and no cache slot is being worked on. */
+    void install_prefetched();
+    /* release a pinned block, called by BlockRef. */
+    void unpin(BlockRef *ref);
+    /* drop the writes of the outermost transaction and run its undo actions, the device lock is held. */
+    void rollback_tx();
+    /* block_id is written for the running owner outside of a transaction, fsync of it commits the block. */
+    void add_meta(blk_id_t block_id);
+
+    /* a caller of fsync waiting for its group. */
+    struct SyncRequest {
+        uint32_t owner;
+        const std::vector<blk_id_t> *meta_ids;
+        int result;
+        bool done;
+        bool leader; /* this caller should commit the next group */
+    };
+    int commit_group(const std::vector<SyncRequest *> &group);
+    /* body of the flusher thread. */
+    void writeback_loop();
+    /* body of the readahead thread, it reads batches queued by prefetch without the device lock. */
+    void readahead_loop();
+    void stop_readahead();
+    /* callback of the pressure monitor. */
+    void on_pressure(bool pressure);
+    /* resize the cache, the device lock is held. */
+    int resize_cache_locked(uint64_t size);
+
 #ifdef BLOCK_CACHE
     LRUCacheManager blk_cache_mgr_;
 #else
     BlockCacheManager blk_cache_mgr_;
 #endif
-    int fd_;
+    StorageBackend *backend_;
+    IOEngine *engine_;
+    Journal *journal_;
     uint32_t num_data_blocks_;
-    uint32_t num_log_blocks_; /* TODO: reserve log blocks */
+    uint32_t num_log_blocks_;
+    /* atomic, readers check it without the device lock. */
+    std::atomic<int> tx_depth_;
+    std::atomic<std::thread::id> tx_thread_; /* the thread of the running transaction, see in_tx */
+    uint32_t owner_; /* owner of written blocks, see set_owner */
+    /* metadata blocks written for each owner since its last fsync, see add_meta */
+    std::unordered_map<uint32_t, std::set<blk_id_t>> owner_meta_;
+    std::map<blk_id_t, Block> tx_blocks_; /* blocks written in the running transaction */
+    std::vector<std::function<void()>> tx_undo_; /* see on_abort */
+    bool tx_aborted_;                             /* a nested transaction was aborted */
+    /*
+     * blocks with a prefetch in flight, written blocks are erased,
+     * so that a completion never fills the cache with a stale block.
+     */
+    mutable std::unordered_set<blk_id_t> prefetching_;
+    /*
+     * completed prefetches, not filled at completion, which runs inside any I/O wait, e.g. of an eviction
+     * writing its victim back, where a fill could take the very slot being evicted.
+     * They stay in prefetching_ until installed by a top-level read (see install_prefetched).
+     */
+    std::vector<std::pair<blk_id_t, std::shared_ptr<const Block>>> prefetched_;
+    /* device lock, fsync callers run outside of the vfs lock. */
+    mutable std::recursive_mutex mtx_;
+
+    /* group commit */
+    std::mutex gc_mtx_;
+    std::condition_variable gc_cv_;
+    std::vector<SyncRequest *> gc_queue_; /* callers of the next group */
+    bool gc_flushing_;                    /* a leader is committing a group */
+    size_t gc_last_group_;                /* size of last group, only wait for others if it is > 1 */
+
+    /* background writeback */
+    std::thread wb_thread_;
+    std::function<void()> wb_hook_;
+    std::mutex wb_mtx_;
+    std::condition_variable wb_cv_;
+    bool wb_stop_;
+
+    /* readahead without an async io engine, see prefetch */
+    std::thread ra_thread_;
+    std::mutex ra_mtx_;
+    std::condition_variable ra_cv_;
+    std::deque<std::vector<blk_id_t>> ra_queue_;
+    bool ra_stop_;
+
+    /* memory pressure */
+    PressureMonitor pressure_;
+    bool pressure_monitor_;  /* enabled by options */
+    uint64_t cache_target_;  /* cache size set at mount or by resize_cache */
+
+    uint64_t direct_io_threshold_;
+};
+
+/*
+ * Transaction of a scope, e.g. { Transaction tx(dev); ...; CHECK_RET(...); ...; return tx.commit(); }
+ * it's aborted if the scope is left without commit(), e.g. by an error return.
+ */
+class Transaction {
+public:
+    explicit Transaction(BlockDevice *dev) : dev_(dev), done_(false) {
+        dev_->begin_tx();
+    }
+    ~Transaction() {
+        if (!done_) {
+            dev_->abort_tx();
+        }
+    }
+    int commit() {
+        done_ = true;
+        return dev_->commit_tx();
+    }
+
+private:
+    BlockDevice *dev_;
+    bool done_;
+};
+
+/*
+ * A pinned block, see BlockDevice::pin, e.g.
+ * { BlockRef ref; dev->pin(id, &ref); modify ref.data() ...; ref.mark_dirty(); }
+ * it's released when it goes out of scope (or by release()).
+ */
+class BlockRef {
+public:
+    BlockRef() = default;
+    BlockRef(const BlockRef &) = delete;
+    BlockRef &operator=(const BlockRef &) = delete;
+    ~BlockRef() {
+        release();
+    }
+    uint8_t *data() const {
+        return blk_->data;
+    }
+    template <typename T>
+    T *as(uint32_t offset = 0) const {
+        return (T *)(blk_->data + offset);
+    }
+    blk_id_t id() const {
+        return block_id_;
+    }
+    /* the block is modified, write it back later. */
+    void mark_dirty() {
+        dirty_ = true;
+    }
+    void release() {
+        if (dev_ != nullptr) {
+            dev_->unpin(this);
+        }
+    }
+
+private:
+    friend class BlockDevice;
+    BlockDevice *dev_ = nullptr;
+    blk_id_t block_id_ = 0;
+    Block *blk_ = nullptr;
+    bool dirty_ = false;
+    bool cached_ = false;         /* pinned in the cache, else a copy */
+    std::unique_ptr<Block> copy_; /* private copy if the cache can't pin it */
+};
+
+/* Blocks written in a scope belong to inode "owner", so that fsync of the inode finds them. */
+class OwnerScope {
+public:
+    OwnerScope(BlockDevice *dev, uint32_t owner) : dev_(dev), prev_(dev->set_owner(owner)) {}
+    ~OwnerScope() {
+        dev_->set_owner(prev_);
+    }
+
+private:
+    BlockDevice *dev_;
+    uint32_t prev_;
 };
 };  // namespace sbfs
 
-#endif  // BLK_DEV_H_
\ No newline at end of file
+#endif  // BLK_DEV_H_
@@ -0,0 +1,111 @@
+#ifndef BLOCK_INDEX_H_
+#define BLOCK_INDEX_H_
+
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Map of block id to a non-negative int (e.g. cache slot), for a bounded number of ids.
+ * Open addressing with Robin Hood linear probing in one preallocated array,
+ * at most half full, so it never grows, rehashes or allocates after init,
+ * and a lookup is a few adjacent 8-byte entries (a miss stops early, at the first entry closer to its home).
+ * Erase shifts the following entries back, no tombstones.
+ */
+class BlockIndex {
+public:
+    /* prepare for at most max_entries ids, drops all. */
+    void init(uint64_t max_entries) {
+        uint32_t bits = 1;
+        while ((1ull << bits) < max_entries * 2) {
+            ++bits;
+        }
+        shift_ = 64 - bits;
+        mask_ = (1u << bits) - 1;
+        size_ = 0;
+        table_.assign(mask_ + 1, Entry{ 0, -1 });
+    }
+    /* value of id, -1 if not found. */
+    int find(blk_id_t id) const {
+        uint32_t i = home(id);
+        for (uint32_t d = 0;; ++d, i = (i + 1) & mask_) {
+            const Entry &e = table_[i];
+            if (e.value == -1 || distance(i, e.id) < d) {
+                return -1;
+            }
+            if (e.id == id) {
+                return e.value;
+            }
+        }
+    }
+    /* set value of id, inserted if not found. */
+    void insert(blk_id_t id, int value) {
+        rt_assert(size_ < (mask_ + 1) / 2, "block index full");
+        Entry cur{ id, value };
+        uint32_t i = home(id);
+        for (uint32_t d = 0;; ++d, i = (i + 1) & mask_) {
+            Entry &e = table_[i];
+            if (e.value == -1) {
+                e = cur;
+                ++size_;
+                return;
+            }
+            if (e.id == cur.id) {
+                /* only the new id can be found, a displaced one is already unique. */
+                e.value = cur.value;
+                return;
+            }
+            /* the one closer to its home gives way, so probe lengths stay even. */
+            uint32_t ed = distance(i, e.id);
+            if (ed < d) {
+                std::swap(cur, e);
+                d = ed;
+            }
+        }
+    }
+    /* drop id, returns kFail if not found. */
+    int erase(blk_id_t id) {
+        uint32_t i = home(id);
+        for (uint32_t d = 0;; ++d, i = (i + 1) & mask_) {
+            const Entry &e = table_[i];
+            if (e.value == -1 || distance(i, e.id) < d) {
+                return kFail;
+            }
+            if (e.id == id) {
+                break;
+            }
+        }
+        /* shift the followers that are away from their home back by one. */
+        for (uint32_t j = (i + 1) & mask_; table_[j].value != -1 && distance(j, table_[j].id) > 0;
+             i = j, j = (j + 1) & mask_) {
+            table_[i] = table_[j];
+        }
+        table_[i].value = -1;
+        --size_;
+        return kSuccess;
+    }
+    uint64_t size() const {
+        return size_;
+    }
+
+private:
+    struct Entry {
+        blk_id_t id;
+        int value; /* -1 if empty */
+    };
+    uint32_t home(blk_id_t id) const {
+        /* fibonacci hashing, the high bits, independent of the low ones that chose the cache shard. */
+        return (uint32_t)(((uint64_t)id * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+    /* how far the entry of id at i is from its home. */
+    uint32_t distance(uint32_t i, blk_id_t id) const {
+        return (i - home(id)) & mask_;
+    }
+
+    std::vector<Entry> table_;
+    uint32_t shift_ = 63;
+    uint32_t mask_ = 0;
+    uint64_t size_ = 0;
+};
+}  // namespace sbfs
+
+#endif  // BLOCK_INDEX_H_
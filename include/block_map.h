@@ -0,0 +1,53 @@
+#ifndef BLOCK_MAP_H_
+#define BLOCK_MAP_H_
+
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Logical -> physical block mapping of open files, so that their reads and writes don't walk the indirect
+ * blocks (or the extent tree) of the inode for each block. It's kept as runs of contiguous blocks, filled
+ * lazily: a lookup that misses maps the whole index block (or extent leaf) it needs at once, see
+ * DiskInode::map_blocks. A file is cached from its first open to its last close (FDManager), runs past
+ * its end are dropped when it's truncated (blocks of a growing file keep their place).
+ * Callers hold the vfs lock.
+ */
+class BlockMap {
+public:
+    /* logical blocks [lblk, lblk + len) of a file are ABSOLUTE blocks [pblk, pblk + len). */
+    struct Run {
+        uint32_t lblk;
+        blk_id_t pblk;
+        uint32_t len;
+    };
+    /* runs of a file, sorted by lblk, no overlap. */
+    class File {
+    public:
+        /* the run with logical block lid, false if not cached. */
+        bool find(uint32_t lid, Run *run) const;
+        /* cache "run", the runs it overlaps are replaced, all are dropped past kBlockMapRuns. */
+        void insert(const Run &run);
+        /* drop logical blocks from lid on. */
+        void truncate(uint32_t lid);
+
+    private:
+        std::vector<Run> runs_;
+    };
+    /* a file is opened / closed, its runs are dropped at its last close. */
+    void open(uint32_t inode_id);
+    void close(uint32_t inode_id);
+    /* runs of inode_id, nullptr if it's not open. */
+    File *get(uint32_t inode_id);
+    /* drop logical blocks of inode_id from lid on, e.g. it's truncated (0 if removed). */
+    void truncate(uint32_t inode_id, uint32_t lid);
+
+private:
+    struct Entry {
+        uint32_t refs; /* open count */
+        File file;
+    };
+    std::unordered_map<uint32_t, Entry> files_; /* inode id -> its runs */
+};
+}  // namespace sbfs
+
+#endif  // BLOCK_MAP_H_
@@ -32,11 +32,42 @@ inline constexpr uint64_t GB(uint64_t x) {
     } while (0)
 #endif
 
-constexpr uint64_t kBlockSize = 4096;          // block is 4kb
-constexpr uint64_t kBlockCacheSize = MB(768);  // block cache
+constexpr uint64_t kBlockSize = 4096;            // block is 4kb
+constexpr uint64_t kBlockCacheSize = MB(768);    // default block cache size, see --cache_size
+constexpr uint64_t kCacheMinSize = MB(16);       // memory pressure never shrinks the block cache below this
+constexpr uint32_t kCacheShrinkPercent = 25;     // % of the block cache released on each memory pressure event
+constexpr uint32_t kCacheGrowPercent = 10;       // % of the mount size the cache grows back by after pressure calms
+constexpr uint64_t kPressureStallMs = 100;       // memory stall in a kPressureWindowMs window that is pressure (PSI)
+constexpr uint64_t kPressureWindowMs = 2000;     // PSI window, unprivileged triggers need a multiple of 2s
+constexpr uint64_t kPressureCalmMs = 10000;      // no pressure for this long, the cache grows back a step
+constexpr uint64_t kHugePageSize = MB(2);        // the block cache arena is aligned to it, see BlockArena
+constexpr uint32_t kCacheShards = 16;            // block cache shards, each with its own lock and LRU list
+constexpr uint32_t kCache2QInPercent = 25;       // 2Q: % of a shard for blocks seen once (A1in)
+constexpr uint32_t kCache2QOutPercent = 50;      // 2Q: ids remembered after eviction from A1in, % of shard slots
+constexpr uint32_t kIOQueueDepth = 64;           // default io_uring queue depth
+constexpr uint64_t kGroupCommitWindowUs = 200;   // how long a group commit leader waits for other fsync callers
+constexpr uint32_t kReadaheadMinBlocks = 8;      // initial readahead window of a sequential stream, 32KB
+constexpr uint32_t kReadaheadMaxBlocks = 256;    // max readahead window, 1MB
+constexpr uint32_t kReadaheadStreams = 1024;     // max files tracked by readahead
+constexpr size_t kReadaheadQueue = 4;            // readahead batches queued to the readahead thread, more are dropped
+constexpr uint64_t kDirtyExpireMs = 30000;       // dirty blocks older than this are written back in background
+constexpr uint64_t kDirtyBackgroundRatio = 10;   // % of cache dirty to start background writeback of LRU blocks
+constexpr uint64_t kWritebackIntervalMs = 5000;  // how often the background flusher wakes up
+constexpr size_t kWritebackBatchBlocks = 256;    // max blocks written back per device lock hold, 1MB
+constexpr uint64_t kStatsDumpIntervalMs = 60000; // how often stats are logged (by the flusher)
+constexpr uint64_t kDirectIOThreshold = MB(1);   // I/Os this large bypass the block cache, see --direct_io_threshold
+constexpr uint64_t kDelallocMaxBlocks = 16384;   // blocks buffered by delayed allocation before all are flushed, 64MB
+constexpr size_t kBlockMapRuns = 4096;           // runs of contiguous blocks cached per open file, see BlockMap
+constexpr size_t kInodeCacheSize = 65536;        // inodes cached by InodeCache before the unreferenced ones are dropped
 
 using blk_id_t = uint32_t;
 
+/* monotonic clock in ms. */
+inline uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 constexpr int kFail = -1;  // Maybe used in all return values.
 constexpr int kSuccess = 0;
 
@@ -47,7 +78,7 @@ constexpr uint64_t kMaxDirNameLength = 251;
 
 constexpr uint64_t kPathCacheSize = MB(32);
 constexpr uint64_t kDiskSize = GB(16);
-constexpr uint32_t kLogBlocks = 0;
+constexpr uint32_t kLogBlocks = 8192;  // 32MB journal at the end of disk
 constexpr uint32_t kFSDataBlocks = kDiskSize / kBlockSize - kLogBlocks;
 constexpr uint32_t kInodeBitmapBlocks = 1;  // 4096 Inodes
 
@@ -0,0 +1,59 @@
+#ifndef DELALLOC_H_
+#define DELALLOC_H_
+
+#include "blk.h"
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Delayed allocation of file writes.
+ * A write past the allocated blocks of a file doesn't allocate, its data is buffered here by logical block,
+ * and the file size past its DiskInode is kept here too, only the data and index blocks it needs are reserved.
+ * Inode::flush allocates all of them at once, so a file appended in small writes (e.g. a WAL) gets
+ * one extent and its index blocks are written once. It's done at fsync, truncate and direct I/O of the file,
+ * when more than kDelallocMaxBlocks are buffered, and by the flusher once they are kDirtyExpireMs old.
+ * Until then the DiskInode keeps the size of the data in its blocks (like i_disksize of ext4), never past what was
+ * written, so a crash loses the buffered data of files that are not fsynced, but never exposes blocks or bytes
+ * that were not written.
+ * Callers hold the vfs lock.
+ */
+class DelayedAlloc {
+public:
+    struct File {
+        uint32_t size;      /* file size, past alloc_end */
+        uint32_t alloc_end; /* end of the allocated blocks of the file (block aligned), later ones are buffered */
+        uint32_t reserved;  /* data and index blocks reserved for the size */
+        uint64_t since_ms; /* when the first write was buffered */
+        /* buffered blocks by logical block id, missing ones (holes) are zero. */
+        std::map<uint32_t, std::unique_ptr<Block>> blocks;
+    };
+    /* buffered state of inode_id, nullptr if none. */
+    File *find(uint32_t inode_id);
+    /* like find, but a new one with blocks allocated up to "alloc_end" is made if none. */
+    File *get(uint32_t inode_id, uint32_t alloc_end);
+    /* logical block lid of "file", a zero one is buffered if missing. */
+    Block *block(File *file, uint32_t lid);
+    /* drop buffered blocks of "file" from logical block lid on. */
+    void truncate(File *file, uint32_t lid);
+    /* set the blocks reserved by "file". */
+    void reserve(File *file, uint32_t reserved);
+    /* forget inode_id, e.g. it's flushed or removed, its reservation is released. */
+    void drop(uint32_t inode_id);
+    /* inodes with buffered writes, only those buffered before "expire_ms" if it's not 0. */
+    std::vector<uint32_t> files(uint64_t expire_ms = 0) const;
+    /* number of blocks reserved, and of blocks buffered. */
+    uint64_t reserved() const {
+        return reserved_;
+    }
+    uint64_t buffered() const {
+        return buffered_;
+    }
+
+private:
+    std::unordered_map<uint32_t, File> files_; /* inode id -> buffered state */
+    uint64_t reserved_ = 0;
+    uint64_t buffered_ = 0;
+};
+}  // namespace sbfs
+
+#endif  // DELALLOC_H_
@@ -5,6 +5,7 @@
 #include <list>
 #include <map>
 
+#include "fs.h"
 #include "inode.h"
 
 namespace sbfs {
@@ -16,10 +17,18 @@ public:
         fd_counter.store(10, std::memory_order_relaxed);  // jump stdin and stdout
     }
 
-    uint64_t open(const Inode &inode) {
+    /*
+     * "direct" if opened with O_DIRECT, its reads and writes bypass the block cache.
+     * The block mapping and the inode of an open file are cached, see BlockMap and InodeCache.
+     */
+    uint64_t open(const Inode &inode, bool direct = false) {
         uint64_t fd = fd_counter.fetch_add(1, std::memory_order_relaxed);
-        fd_manager.insert(std::make_pair(fd, inode));
+        fd_manager.insert(std::make_pair(fd, OpenFile{ inode, direct }));
         deltaRefCnt(inode, 1);
+        inode.fs->block_map_->open(inode.fs->getDiskInodeId(inode.pos));
+        if (inode.fs->inode_cache_->open(inode.fs->getDiskInodeId(inode.pos), inode.pos) != kSuccess) {
+            DLOG(WARNING) << "cache inode of fd " << fd << " failed";
+        }
         return fd;
     }
 
@@ -29,16 +38,24 @@ public:
         if (it == fd_manager.end()) {
             return false;
         }
-        *inode = it->second;
+        *inode = it->second.inode;
         return true;
     }
 
+    bool isDirect(uint64_t fd) {
+        auto it = fd_manager.find(fd);
+        return it != fd_manager.end() && it->second.direct;
+    }
+
     void close(uint64_t fd) {
         if (fd == 0) return;
-        if (fd_manager.find(fd) != fd_manager.end()) {
-            Inode inode = fd_manager[fd];
-            deltaRefCnt(inode, -1);
-            fd_manager.erase(fd);
+        auto it = fd_manager.find(fd);
+        if (it != fd_manager.end()) {
+            deltaRefCnt(it->second.inode, -1);
+            auto &inode = it->second.inode;
+            inode.fs->block_map_->close(inode.fs->getDiskInodeId(inode.pos));
+            inode.fs->inode_cache_->close(inode.fs->getDiskInodeId(inode.pos));
+            fd_manager.erase(it);
         }
     }
 
@@ -55,8 +72,12 @@ public:
     }
 
 private:
-    /* File handler -> Inode */
-    std::map<uint64_t, Inode> fd_manager;
+    struct OpenFile {
+        Inode inode;
+        bool direct;
+    };
+    /* File handler -> open file */
+    std::map<uint64_t, OpenFile> fd_manager;
     std::map<Inode, uint64_t> reference_count;
     /* Start from 1 for 0 is reserved for not-open */
     std::atomic<uint64_t> fd_counter;
@@ -3,20 +3,26 @@
 
 #include <fuse3/fuse.h>
 
+#include "block_map.h"
 #include "config.h"
+#include "delalloc.h"
 #include "fs_layout.h"
 #include "inode.h"
+#include "inode_cache.h"
+#include "readahead.h"
 
 namespace sbfs {
 
 class alignas(kBlockSize) SBFileSystem {
 public:
+    static constexpr uint32_t kNoParent = UINT32_MAX;
+
     /* Create a new SBFS. */
     static SBFileSystem create(const char *path, const uint64_t size, uint32_t total_blocks,
-                               uint32_t inode_bitmap_blocks);
+                               uint32_t inode_bitmap_blocks, const DeviceOptions &options = DeviceOptions());
 
     /* Open an existing SBFS. */
-    static SBFileSystem open(const char *path);
+    static SBFileSystem open(const char *path, const DeviceOptions &options = DeviceOptions());
 
     /* get root Inode. */
     Inode root();
@@ -30,11 +36,20 @@ public:
     /* get actual disk inode id by inode position. */
     uint32_t getDiskInodeId(const Position &pos) const;
 
-    /* Allocate an inode, returns inode id. */
-    uint32_t alloc_inode();
+    /*
+     * Allocate an inode in the group chosen by pick_group for a new file / directory ("dir") in directory
+     * "parent" (kNoParent for the root), returns inode id.
+     */
+    uint32_t alloc_inode(uint32_t parent = kNoParent, bool dir = false);
+
+    /*
+     * Allocate a data block nearest to "goal" (e.g. the block after the previous one of the file, or data_goal
+     * of its inode, 0 for the first free one), returns block id (not block_id - data_area_start).
+     */
+    uint32_t alloc_data(blk_id_t goal = 0);
 
-    /* Allocate a data block, returns block id (not block_id - data_area_start). */
-    uint32_t alloc_data();
+    /* where the data of inode "inode_id" should start: the first block of the data group of its inode group. */
+    blk_id_t data_goal(uint32_t inode_id) const;
 
     /* Deallocate an inode. */
     int free_inode(uint32_t inode_id);
@@ -42,18 +57,50 @@ public:
     /* Deallocate a data block. */
     int free_data(uint32_t block_id);
 
+    /*
+     * Allocate and write the delayed allocations (see DelayedAlloc) of all files, or only of those buffered
+     * before "expire_ms" if it's not 0.
+     */
+    int flush_delayed(uint64_t expire_ms = 0);
+
+    /* number of data blocks and inodes, and of free ones (reserved blocks are not), from the in-memory bitmaps. */
+    void usage(uint64_t *blocks, uint64_t *free_blocks, uint64_t *inodes, uint64_t *free_inodes) const;
+
     Bitmap *data_bitmap_; /* Bitmap for data, attention: data block size is kBlockSize. */
+    Readahead *readahead_; /* sequential read detection of files. */
+    DelayedAlloc *delalloc_; /* buffered writes past the allocated blocks of files, nullptr if disabled. */
+    BlockMap *block_map_;    /* block mapping of open files. */
+    InodeCache *inode_cache_; /* in-core inodes, written back lazily. */
+    bool extents_;           /* new inodes use extent trees, see ExtentHeader. */
 
 private:
-    /* called after init super block. */
-    void initBitmapAndBlock();
+    /* called after init super block, loads the bitmaps (clears them if "format"). */
+    void initBitmapAndBlock(bool format);
     /* create root inode. */
     void createRoot();
+    /*
+     * Block groups: data group g is the blocks of the g-th data bitmap block, inode group g is the g-th
+     * inodes_per_group_ inodes, the inodes of group g have their data in data group g (see data_goal).
+     * Orlov allocator of ext4, pick the group of a new inode:
+     * a directory under the root goes to a group with no less free inodes and blocks than the average,
+     * the one of them with the most free blocks searched from a random group, so that top level trees are spread
+     * over the disk and have room to grow. Other directories stay in the group of their parent, unless it has far
+     * less free inodes or blocks than the average, then the next group that hasn't. A file goes to the group of
+     * its parent if it has a free inode and block, else the next one that has, so a directory, its files and
+     * their data are close.
+     */
+    uint32_t pick_group(uint32_t parent, bool dir);
+    uint32_t inode_group(uint32_t inode_id) const;
+    uint64_t group_free_inodes(uint32_t group) const;
+    uint64_t group_free_blocks(uint32_t group) const;
     SuperBlock super_block_;
     BlockDevice *device_;
     Bitmap *inode_bitmap_; /* Bitmap for inodes, attention: inode size may be < kBlockSize. */
     uint32_t inode_area_start_block_;
     uint32_t data_area_start_block_;
+    uint32_t groups_;           /* number of block groups, one per data bitmap block */
+    uint32_t inodes_per_group_;
+    std::minstd_rand rand_;     /* start of the search for top level directories */
 };
 };  // namespace sbfs
 
@@ -2,6 +2,7 @@
 #define FS_LAYOUT_H_
 
 #include "blk_dev.h"
+#include "block_map.h"
 
 namespace sbfs {
 
@@ -22,7 +23,7 @@ struct Position {
 
 /*
  * General layout:
- * Super block -> Inode Bitmap -> Inodes -> Data Bitmap -> Data
+ * Super block -> Inode Bitmap -> Inodes -> Data Bitmap -> Data -> Journal
  */
 
 /* Only one, located at Block 0 of disk. */
@@ -34,6 +35,8 @@ struct alignas(kBlockSize) SuperBlock {
     uint32_t data_bitmap_blocks;
     uint32_t data_area_blocks;
     Position root_inode_pos;
+    uint32_t log_start_block; /* journal area, right after total_blocks */
+    uint32_t log_blocks;
     [[nodiscard]] inline bool isValid() const {
         return magic == kFSMagic;
     }
@@ -45,16 +48,27 @@ struct alignas(kBlockSize) SuperBlock {
         DLOG(WARNING) << "data_bitmap_blocks: " << data_bitmap_blocks;
         DLOG(WARNING) << "data_area_blocks: " << data_area_blocks;
         DLOG(WARNING) << "root inode pos: " << root_inode_pos.block_id << " " << root_inode_pos.block_offset;
+        DLOG(WARNING) << "log_start_block: " << log_start_block;
+        DLOG(WARNING) << "log_blocks: " << log_blocks;
     }
-    uint8_t padding[kBlockSize - 32];
+    uint8_t padding[kBlockSize - 40];
 };
 static_assert(sizeof(SuperBlock) == kBlockSize, "SuperBlock size error");
 
+/* Contiguous blocks [start, start + len), start is an ABSOLUTE block id. */
+struct Extent {
+    blk_id_t start;
+    uint32_t len;
+};
+
 /*
- * One bitmap block can manage (kBlockSize * 8) blocks.
- * this data structure is in memory, but the allocate record is in disk.
+ * One bitmap block can manage (kBlockSize * 8) blocks, call them a group.
  * only two bitmaps needed. (DiskInode, data)
- * TODO: store the bitmap in memory at boost time, reduce disk access overhead.
+ * The whole bitmap is loaded in memory at mount, with the free count of each group, and a hint
+ * below which every bit is set, so alloc skips full groups and words without any disk access.
+ * A changed bit is also changed in its bitmap block through the block cache, so it's persisted
+ * by the running transaction (journal) or the background writeback, like any other block.
+ * Callers hold the vfs lock.
  */
 struct Bitmap {
     /* Where the bitmap starts */
@@ -66,24 +80,89 @@ struct Bitmap {
     blk_id_t data_segment_offset;
     Bitmap(blk_id_t start_block_id, blk_id_t num_blocks, blk_id_t data_segment_offset);
 
+    /**
+     * @brief read the bitmap blocks into memory, call it once before alloc / free
+     *
+     * @param format clear the bitmap blocks instead (a new file system)
+     * @return kFail if failed, kSuccess if success
+     */
+    int load(BlockDevice *dev, bool format = false);
+    /* bits of a bitmap block. */
+    static constexpr uint64_t kGroupBits = kBlockSize * 8;
     /**
      * @brief alloc a block bitmap, and set that place to 1
      *
+     * @param goal ABSOLUTE block id wanted, the nearest free one is taken, see find_near (0 for the first free one)
      * @return blk_id_t the ABSOLUTE block id
      *
      * @return kFail if failed
      */
-    blk_id_t alloc(BlockDevice *dev) const;
+    blk_id_t alloc(BlockDevice *dev, blk_id_t goal = 0);
     /**
      * @brief free a block
      *
      * @param block_id the ABSOLUTE block id
      * @return kFail if failed, kSuccess if success
      */
-    int free(blk_id_t block_id, BlockDevice *dev) const;
+    int free(blk_id_t block_id, BlockDevice *dev);
+    /**
+     * @brief alloc "count" blocks in as few extents as the free space allows, the first one nearest to "goal"
+     * (see find_near), then first fit after it
+     *
+     * @param goal ABSOLUTE block id wanted, e.g. the one after the last block of a file (0 for the first free one)
+     * @param extents the allocated extents are appended, in allocation order
+     * @return kFail if failed (nothing is allocated), kSuccess if success
+     */
+    int alloc_range(uint32_t count, blk_id_t goal, std::vector<Extent> *extents, BlockDevice *dev);
+    /**
+     * @brief free blocks [start, start + len)
+     *
+     * @param start the ABSOLUTE block id
+     * @return kFail if failed, kSuccess if success
+     */
+    int free_range(blk_id_t start, uint32_t len, BlockDevice *dev);
+    /* number of bits, and of free ones. */
+    uint64_t total() const {
+        return (uint64_t)num_blocks * kBlockSize * 8;
+    }
+    uint64_t free_count() const {
+        return free_;
+    }
+    /* free bits of ABSOLUTE ids [start, start + len), e.g. of a block group. */
+    uint64_t free_count(blk_id_t start, uint64_t len) const;
+
+private:
+    /* first free bit >= from (bits are relative to data_segment_offset), total() if none. */
+    uint64_t find_free(uint64_t from) const;
+    /*
+     * free bit nearest to "goal": the first one from it on in its group, else the last one before it in the group,
+     * else the first one after the group (wrapping around), total() if none.
+     */
+    uint64_t find_near(uint64_t goal) const;
+    /* number of free bits from "from" on, at most max. */
+    uint64_t free_run(uint64_t from, uint64_t max) const;
+    /*
+     * set or clear bits [bit, bit + len) in memory and in their bitmap blocks, on failure nothing is changed,
+     * in a transaction the memory is restored if it's aborted (the blocks are dropped with it).
+     */
+    int set_range(uint64_t bit, uint64_t len, bool used, BlockDevice *dev);
+    /* change back the (word, mask) of "words" set (or cleared) by set_range, in memory and in the bitmap blocks. */
+    void revert(const std::vector<std::pair<uint64_t, uint64_t>> &words, bool used, BlockDevice *dev);
+    /* set (or clear) the bits of "mask" in each (word, mask) of "words", in memory only. */
+    void restore(const std::vector<std::pair<uint64_t, uint64_t>> &words, bool used);
+
+    std::vector<uint64_t> words_;      /* the bitmap */
+    std::vector<uint32_t> group_free_; /* free bits of each bitmap block */
+    uint64_t free_ = 0;
+    uint64_t hint_ = 0; /* words before it have no free bit */
 };
 
-enum DiskInodeType : uint32_t { kFile, kDirectory };
+enum DiskInodeType : uint16_t { kFile, kDirectory };
+
+/* flags of DiskInode. */
+enum DiskInodeFlag : uint16_t {
+    kInodeExtents = 1, /* data mapped by an extent tree (see ExtentHeader) instead of direct / indirect blocks */
+};
 
 /* Index should be stored in data region. */
 struct IndirectIndex1 {
@@ -94,6 +173,32 @@ struct IndirectIndex2 {
     blk_id_t indirect1[kBlockSize / sizeof(blk_id_t)];
 };
 
+/*
+ * Extent tree of a file, like ext4: a B+-tree of its logical blocks, its root is in the inode in place of
+ * the direct / indirect block ids, other nodes are data blocks. A node is a header and its sorted entries,
+ * a leaf (depth 0) maps an extent of the file, an index node points to a child node.
+ * Files only grow and shrink at the end, so nodes are only added and removed at the right edge of the tree,
+ * all but the last node of a level are full. Appending blocks right after the last extent only extends it,
+ * so a contiguous file is a single entry. The root holds 7 entries, other nodes 340.
+ */
+struct ExtentHeader {
+    uint16_t magic;   /* kExtentMagic */
+    uint16_t entries; /* entries in use */
+    uint16_t max;     /* entries of the node */
+    uint16_t depth;   /* 0 for a leaf */
+};
+
+struct ExtentEntry {
+    uint32_t lblk;  /* first logical block */
+    blk_id_t pblk;  /* ABSOLUTE block id of the first block (leaf) or of the child node (index node) */
+    uint32_t len;   /* blocks of the extent (leaf), unused in index nodes */
+};
+
+constexpr uint16_t kExtentMagic = 0x5BE7;
+constexpr uint16_t kExtentRootEntries = (sizeof(blk_id_t) * (kInodeDirectCnt + 2) - sizeof(ExtentHeader)) /
+                                        sizeof(ExtentEntry);
+constexpr uint16_t kExtentNodeEntries = (kBlockSize - sizeof(ExtentHeader)) / sizeof(ExtentEntry);
+
 /* Same to DiskInode in rCore */
 struct DiskInode {
     /* Bytes for dir/file, use total_blocks to get block num. */
@@ -110,10 +215,12 @@ struct DiskInode {
     /* used in chmod, also contains file type (no need to implement now). */
     uint16_t mode;
 
+    /* block map, or the root of the extent tree (see extent_root) with kInodeExtents. */
     blk_id_t direct[kInodeDirectCnt];
     blk_id_t indirect1;
     blk_id_t indirect2;
     DiskInodeType type;
+    uint16_t flags; /* DiskInodeFlag, 0 in inodes written before flags (type was 32 bits) */
 
     DiskInode() = default;
     /* Metadata (create time etc.) should be updated. */
@@ -127,8 +234,22 @@ struct DiskInode {
      */
     blk_id_t block_id(uint32_t inner_id, BlockDevice *dev);
 
-    /* calculate how many blocks needed by a file/dir with "size" */
+    /*
+     * calculate how many blocks needed by a file/dir with "size",
+     * with extents it's the most it could need, i.e. every block is an extent
+     */
     uint32_t total_blocks(uint32_t size);
+    /*
+     * the most blocks (data and index) allocated by growing the blocks of the file from "from" to "to" bytes,
+     * with extents as if every new block were an extent
+     */
+    uint32_t grow_blocks(uint32_t from, uint32_t to);
+
+    /* map the data of this inode (empty) with an extent tree, see ExtentHeader. */
+    void use_extents();
+    [[nodiscard]] inline bool extents() const {
+        return flags & kInodeExtents;
+    }
 
     /**
      * @brief resize the size of a file to new_size,
@@ -136,8 +257,11 @@ struct DiskInode {
      * decrease to 0 will redirect to clear, which is much faster
      * @attention metadata will be updated
      * @attention if inode is set, resize will first write inode, than write bitmap
+     * @param goal where the first block of an empty file is wanted (see SBFileSystem::data_goal), the blocks
+     * after it follow its last block
      */
-    int resize(uint32_t new_size, Bitmap *data_bitmap, BlockDevice *dev, const Inode *inode = nullptr);
+    int resize(uint32_t new_size, Bitmap *data_bitmap, BlockDevice *dev, const Inode *inode = nullptr,
+               blk_id_t goal = 0);
 
     /**
      * @brief read 'len' byte from data start from 'offset' to 'buf', metadata will be updated
@@ -145,25 +269,45 @@ struct DiskInode {
      * @param offset offset must be smaller than the file size
      * @param buf we don't check the size of buf, so it's your responsibility
      * @param len 'offset + len' is larger than the file size, it will be truncated
+     * @param direct bypass the block cache, whole blocks go straight to 'buf' if it's aligned to them
+     * @param map cached block mapping of the file if it's open, see BlockMap
      * @return number of bytes read on success, kFail on failure
      */
-    int read_data(uint32_t offset, uint8_t *buf, uint32_t len, BlockDevice *dev);
+    int read_data(uint32_t offset, uint8_t *buf, uint32_t len, BlockDevice *dev, bool direct = false,
+                  BlockMap::File *map = nullptr);
+    /**
+     * @brief prefetch data blocks [lid, lid + count) into the block cache in background, blocks beyond
+     * the file size are skipped
+     * @return int kSuccess on success, kFail on failure
+     */
+    int prefetch(uint32_t lid, uint32_t count, BlockDevice *dev, BlockMap::File *map = nullptr);
     /**
      * @brief write 'len' byte from 'buf' to data start from 'offset', metadata will be updated
      * @attention: offset is relatively to the file that this inode governs
      * @param offset offset must be smaller than the file size
      * @param buf we don't check the size of buf, so it's your responsibility
      * @param len if 'offset + len' is larger than the file size, it will be truncated
+     * @param direct bypass the block cache, whole blocks go straight from 'buf' if it's aligned to them
+     * @param map cached block mapping of the file if it's open, see BlockMap
      * @return number of bytes write on success, kFail on failure
      */
-    int write_data(uint32_t offset, const uint8_t *buf, uint32_t len, BlockDevice *dev);
+    int write_data(uint32_t offset, const uint8_t *buf, uint32_t len, BlockDevice *dev, bool direct = false,
+                   BlockMap::File *map = nullptr);
 
     /**
-     * @brief sync all data blocks to disk, disk inode itself are not synced
-     * @param direct if true, sync indirect1 and indirect2 to disk if exists
+     * @brief sync all data blocks (and indirect blocks) to disk, disk inode itself are not synced
+     * @param owner id of the inode, its blocks are the dirty ones written in its OwnerScope
+     * @param meta_ids metadata blocks committed to the journal in the same group commit, e.g. the inode block
      * @return int kSuccess on success, kFail on failure
      */
-    int sync_data(BlockDevice *dev, bool indirect = false);
+    int sync_data(BlockDevice *dev, uint32_t owner, const std::vector<blk_id_t> &meta_ids = {});
+
+    /**
+     * @brief 1 (access) or 2(modify) or 4(change) in flag
+     *
+     * @param flag
+     */
+    void update_meta(int flag);
 
     inline void print() const {
         DLOG(WARNING) << "size: " << size;
@@ -178,16 +322,35 @@ struct DiskInode {
 
 private:
     int clear(Bitmap *data_bitmap, BlockDevice *dev);
-    int increase(int, int, int, int, BlockDevice *, Bitmap *);
+    int increase(int, int, int, int, BlockDevice *, Bitmap *, blk_id_t);
     int decrease(int, int, int, int, BlockDevice *, Bitmap *, const Inode * = nullptr);
-    /**
-     * @brief 1 (access) or 2(modify) or 4(change) in flag
-     *
-     * @param flag
+    /*
+     * ABSOLUTE block ids of data blocks [lid, lid + count) to "ids", kFail if one is out of range.
+     * They are looked up in "map" first (if any), the runs of the node of a missing one are added to it.
      */
-    void update_meta(int flag);
+    int map_blocks(uint32_t lid, uint32_t count, blk_id_t *ids, BlockDevice *dev, BlockMap::File *map);
+    /* runs of the index block (direct blocks, extent leaf) with logical block lid, appended to "runs" in order. */
+    int map_node(uint32_t lid, std::vector<BlockMap::Run> *runs, BlockDevice *dev);
+
+    /* the root of the extent tree, over the direct / indirect block ids. */
+    inline ExtentHeader *extent_root() {
+        return (ExtentHeader *)direct;
+    }
+    /* the leaf of the extent tree with logical block lid, pinned by "ref" unless it's the root, nullptr if failed. */
+    ExtentHeader *extent_leaf(uint32_t lid, BlockRef *ref, BlockDevice *dev);
+    /* extend the extent tree from old_data_blocks to new_data_blocks, like increase. */
+    int extent_increase(uint32_t old_data_blocks, uint32_t new_data_blocks, BlockDevice *dev, Bitmap *data_bitmap,
+                        blk_id_t goal);
+    /* map logical blocks [lblk, lblk + e.len) to "e", at the end of the extent tree. */
+    int extent_append(uint32_t lblk, const Extent &e, BlockDevice *dev, Bitmap *data_bitmap);
+    /* shrink the extent tree to new_data_blocks, like decrease. */
+    int extent_decrease(uint32_t new_data_blocks, BlockDevice *dev, Bitmap *data_bitmap, const Inode *inode);
 };
 
+static_assert(sizeof(ExtentHeader) + sizeof(ExtentEntry) * kExtentRootEntries <=
+                  sizeof(blk_id_t) * (kInodeDirectCnt + 2),
+              "extent root size error");
+
 static_assert(sizeof(DiskInode) <= kBlockSize, "DiskInode size error");
 
 struct DirEntry {
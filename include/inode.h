@@ -2,7 +2,9 @@
 #define INODE_H_
 
 #include "blk_dev.h"
+#include "block_map.h"
 #include "config.h"
+#include "delalloc.h"
 #include "fs_layout.h"
 
 namespace sbfs {
@@ -25,20 +27,31 @@ struct Inode {
      * Read "size" bytes from offset to "buf".
      * Metadata (access time etc.) should be updated.
      * attention: offset is relative to data managed by this inode.
+     * "direct" reads bypass the block cache (and readahead), see BlockDevice::read_direct.
      */
-    int read_data(uint32_t offset, uint8_t *buf, uint32_t size) const;
+    int read_data(uint32_t offset, uint8_t *buf, uint32_t size, bool direct = false) const;
     /*
      * Write "size" bytes from "buf" to offset.
      * Metadata (access time etc.) should be updated.
      * attention: offset is relative to data managed by this inode.
+     * "direct" writes bypass the block cache, see BlockDevice::write_direct.
+     * Other writes past the allocated blocks are buffered by delayed allocation, see DelayedAlloc.
      */
-    int write_data(uint32_t offset, const uint8_t *buf, uint32_t size) const;
+    int write_data(uint32_t offset, const uint8_t *buf, uint32_t size, bool direct = false) const;
     /*
-     * Read disk inode of this inode to buf.
+     * Allocate the blocks of the buffered writes of this inode at once and write them, see DelayedAlloc.
+     * kSuccess if there are none.
+     */
+    int flush() const;
+    /* file size of "disk_inode" of this inode, with the buffered writes. */
+    uint32_t file_size(const DiskInode &disk_inode) const;
+    /*
+     * Read disk inode of this inode to buf (from InodeCache).
      */
     int read_inode(DiskInode *buf) const;
     /*
      * Write disk inode of this inode from buf.
+     * It's written to its block lazily, see InodeCache, at once in a transaction.
      */
     int write_inode(const DiskInode *buf) const;
     /*
@@ -53,6 +66,7 @@ struct Inode {
      * 4. write inode of new file / directory.
      * 5. update parent directory's data block, add new entry.
      * 6. update parent directory's inode (size, access time etc.)
+     * All of them are committed as one transaction.
      */
     int create(const char *name, DiskInode *disk_inode, Inode *inode) const;
     /*
@@ -70,6 +84,7 @@ struct Inode {
     /*
      * Remove a file / directory with "name" in current dir.
      * Only support directory type.
+     * Committed as one transaction.
      */
     int remove(const char *name) const;
     /*
@@ -87,10 +102,49 @@ struct Inode {
      * sync data (and inode metadata) to disk.
      * if metadata is True, then should sync metadata.
      * else sync data only.
-     * 1. sync data by calling disk inode's sync_data().
-     * 2. sync metadata by directly call sync() with block ID.
+     * sync data by calling disk inode's sync_data(), the inode block (if metadata) is committed
+     * to the journal in the same group commit, so concurrent fsyncs share one flush.
+     * The caller writes the inode back to its block first (InodeCache::writeback).
      */
     [[nodiscard]] int sync(bool metadata = true) const;
+    /*
+     * Pin the directory block holding the "idx"-th entry of "disk_inode",
+     * *entries points to the first entry of that block, in place.
+     */
+    int pin_entries(DiskInode *disk_inode, uint32_t idx, BlockRef *ref, DirEntry **entries) const;
+    /* Find "name" in directory "disk_inode", its index to *idx and the Inode it refers to to *inode. */
+    int find_entry(DiskInode *disk_inode, const char *name, uint32_t *idx, Inode *inode) const;
+    /* Set the "idx"-th entry of directory "disk_inode" in place. */
+    int put_entry(DiskInode *disk_inode, uint32_t idx, const DirEntry &entry) const;
+    /* Remove the "idx"-th entry by moving the last one here, then shrink the directory (inode written). */
+    int drop_entry(DiskInode *disk_inode, uint32_t idx) const;
+
+    /*
+     * Buffer a write past the allocated blocks, or grow the file to offset + size if "buf" is nullptr,
+     * the blocks are reserved, the head of the write in the last allocated block (if any) is written to it.
+     */
+    int write_delayed(DiskInode *disk_inode, uint32_t offset, const uint8_t *buf, uint32_t size) const;
+    /* Read a range ending past the size of "disk_inode", that part from the buffered writes. */
+    int read_delayed(DiskInode *disk_inode, uint32_t offset, uint8_t *buf, uint32_t size) const;
+    /* end of the allocated blocks of "disk_inode" (block aligned), buffered writes start there. */
+    uint32_t alloc_end(const DiskInode &disk_inode) const;
+    /*
+     * Grow "disk_inode" to "end" (at most alloc_end) in its last allocated block, writing zero past its old size,
+     * with buffered writes the tail of that block isn't part of the file until something is written there.
+     */
+    int zero_tail(DiskInode *disk_inode, uint32_t end) const;
+    /*
+     * Grow the blocks of "disk_inode" to "new_size" (not buffered), it fails if that could take blocks
+     * reserved by the buffered writes of other files.
+     */
+    int grow(DiskInode *disk_inode, uint32_t new_size) const;
+    /* buffered writes of this inode, nullptr if none. */
+    DelayedAlloc::File *delayed() const;
+    /* cached block mapping of this inode, nullptr if it's not open. */
+    BlockMap::File *block_map() const;
+
+    /* where the first data block of this inode is wanted, see SBFileSystem::data_goal. */
+    blk_id_t data_goal() const;
 
     /* Judge if the Inode item is valid. */
     [[nodiscard]] inline bool isValid() const {
@@ -0,0 +1,59 @@
+#ifndef INODE_CACHE_H_
+#define INODE_CACHE_H_
+
+#include <map>
+
+#include "blk_dev.h"
+#include "config.h"
+#include "fs_layout.h"
+
+namespace sbfs {
+/*
+ * In-core inode table: decoded DiskInodes by inode id, so that each file operation doesn't copy the inode out
+ * of its inode table block and back (pinning the block twice). put() only changes the cached inode and marks
+ * it dirty, dirty inodes are written back lazily (fsync of the file, the flusher, eviction, unmount), all dirty
+ * inodes of an inode table block with one block write. Inside a transaction put() writes through, so that the
+ * inodes changed by create / remove / rename are in the same commit as their directory blocks, and the cached
+ * inodes are restored if it's aborted.
+ * Inodes of open files are referenced (FDManager) and stay cached, others are dropped past kInodeCacheSize.
+ * Callers hold the vfs lock.
+ */
+class InodeCache {
+public:
+    explicit InodeCache(BlockDevice *device) : device_(device) {}
+    /* the cached inode inode_id at "pos", read from its block on a miss, nullptr if that fails. */
+    const DiskInode *get(uint32_t inode_id, const Position &pos);
+    /* change the cached inode inode_id at "pos" to "inode". */
+    int put(uint32_t inode_id, const Position &pos, const DiskInode &inode);
+    /* a file is opened / closed, it stays cached while it's open. */
+    int open(uint32_t inode_id, const Position &pos);
+    void close(uint32_t inode_id);
+    /* inode_id is freed, its cached inode is dropped without writing it back. */
+    void drop(uint32_t inode_id);
+    /* write the dirty inodes of inode table block "block_id" to it, with one block write. */
+    int writeback(blk_id_t block_id);
+    /* write back all dirty inodes, block by block. */
+    int writeback_all();
+
+private:
+    struct Entry {
+        DiskInode inode;
+        Position pos;
+        uint32_t refs; /* open count */
+        bool dirty;
+    };
+    /* if the cache is full, write back all dirty inodes and drop the unreferenced ones. */
+    int make_room();
+    /* take "entry" of inode_id off the dirty lists. */
+    void unlist(Entry &entry, uint32_t inode_id);
+    /* in a transaction, the cached inode_id (or its absence) is restored if the transaction is aborted. */
+    void keep_for_abort(uint32_t inode_id);
+    /* the cached inode_id, read from its block on a miss, nullptr if that fails. */
+    Entry *load(uint32_t inode_id, const Position &pos);
+    BlockDevice *device_;
+    std::unordered_map<uint32_t, Entry> inodes_;      /* inode id -> cached inode */
+    std::map<blk_id_t, std::vector<uint32_t>> dirty_; /* inode table block -> its dirty inodes */
+};
+}  // namespace sbfs
+
+#endif  // INODE_CACHE_H_
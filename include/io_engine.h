@@ -0,0 +1,83 @@
+#ifndef IO_ENGINE_H_
+#define IO_ENGINE_H_
+
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+
+#include "backend.h"
+#include "blk.h"
+#include "config.h"
+
+namespace sbfs {
+/* called when an asynchronous request finishes, res is kSuccess or kFail. */
+using io_callback_t = std::function<void(int res)>;
+
+/*
+ * I/O engine under BlockDevice.
+ * With IO_URING defined and enabled at mount time, requests are queued to an io_uring
+ * on the backend's file (at most queue_depth in flight), otherwise every request is served
+ * synchronously by the backend and its callback is invoked before returning.
+ */
+class IOEngine {
+public:
+    IOEngine(StorageBackend *backend, bool use_io_uring, uint32_t queue_depth);
+    ~IOEngine();
+
+    /* Whether requests really go through io_uring. */
+    bool is_async() const {
+        return async_;
+    }
+    /*
+     * Register blocks [base, base + count) (i.e. the cache arena) as io_uring fixed buffers,
+     * later requests on blocks in it use read_fixed / write_fixed.
+     * The kernel pins the whole range, so it's all committed, and counted in RLIMIT_MEMLOCK.
+     */
+    int register_buffers(Block *base, uint64_t count);
+    /* Unregister them, no request may be in flight (see drain). */
+    void unregister_buffers();
+    /* Queue a read of block_id into buf, cb is called on completion. */
+    int read_async(blk_id_t block_id, Block *buf, io_callback_t cb);
+    /* Queue a write of buf to block_id, cb is called on completion. */
+    int write_async(blk_id_t block_id, const Block *buf, io_callback_t cb);
+    /* Submit queued requests, and reap completions (wait for at least min_complete of them). */
+    int poll(uint32_t min_complete = 0);
+    /* Wait until no request is in flight. */
+    int drain();
+
+    /* Synchronous read / write, served by the backend when io_uring is not used. */
+    int read(blk_id_t block_id, Block *buf);
+    int write(blk_id_t block_id, const Block *buf);
+    /* Synchronous vectored read / write of "cnt" blocks starting at block_id. */
+    int readv(blk_id_t block_id, const iovec *iov, int cnt);
+    int writev(blk_id_t block_id, const iovec *iov, int cnt);
+    /* Synchronous flush of the backend, it doesn't touch the ring, so it's safe to call from any thread. */
+    int flush();
+
+private:
+#ifdef IO_URING
+    struct IORequest {
+        io_callback_t cb;
+        uint32_t expected; /* bytes to transfer */
+        int next_free;
+    };
+    /* take a free request and an sqe, "prep" fills the sqe, cb is called with the result on completion. */
+    int queue(io_callback_t cb, uint32_t expected, const std::function<void(io_uring_sqe *)> &prep);
+    int wait_for(bool &done);
+    int fixed_index(const Block *buf) const;
+
+    io_uring ring_;
+    std::vector<IORequest> requests_; /* one request for each queue entry */
+    int free_request_;
+    const Block *fixed_base_; /* registered blocks, see register_buffers */
+    uint64_t fixed_count_;
+#endif
+    StorageBackend *backend_;
+    int fd_;
+    bool async_;
+    uint32_t queue_depth_;
+    uint32_t inflight_;
+};
+}  // namespace sbfs
+
+#endif  // IO_ENGINE_H_
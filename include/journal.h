@@ -0,0 +1,85 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "blk.h"
+#include "config.h"
+
+namespace sbfs {
+class BlockDevice;
+
+constexpr uint32_t kJournalMagic = 0x4a4e4c48;        // header
+constexpr uint32_t kJournalDescMagic = 0x4a4e4c44;    // descriptor
+constexpr uint32_t kJournalCommitMagic = 0x4a4e4c43;  // commit record
+/* max home ids in one descriptor block, a larger transaction takes several descriptors. */
+constexpr uint32_t kJournalDescBlocks = (kBlockSize - 12) / sizeof(blk_id_t);
+
+/*
+ * Journal layout (physical redo log):
+ * Header -> [Descriptor -> logged blocks -> (Descriptor -> logged blocks ...) -> Commit] -> [Descriptor -> ...] ...
+ * The header is only rewritten at checkpoint, it records the sequence of the first transaction,
+ * transactions follow it back to back, replay stops at the first one with a wrong sequence or checksum.
+ * All descriptors of a transaction carry its sequence, the commit record counts the blocks of all of them.
+ */
+struct alignas(kBlockSize) JournalHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint8_t padding[kBlockSize - 8];
+};
+static_assert(sizeof(JournalHeader) == kBlockSize, "JournalHeader size error");
+
+struct alignas(kBlockSize) JournalDescriptor {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    blk_id_t block_ids[kJournalDescBlocks]; /* home location of each logged block */
+};
+static_assert(sizeof(JournalDescriptor) == kBlockSize, "JournalDescriptor size error");
+
+struct alignas(kBlockSize) JournalCommit {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t padding;
+    uint64_t checksum; /* of descriptors and logged blocks, so a torn transaction is never replayed */
+};
+
+class Journal {
+public:
+    /* The log occupies [start_block, start_block + num_blocks) of dev. */
+    Journal(BlockDevice *dev, blk_id_t start_block, uint32_t num_blocks);
+    /* Initialize an empty log, used when the FS is created. */
+    int format();
+    /* Replay committed transactions to their home locations, used when the FS is opened. */
+    int recover();
+    /* The largest transaction that fits the log, commit rejects a larger one without writing anything. */
+    uint32_t max_tx_blocks() const;
+    /*
+     * Log "bufs" for "block_ids" with one commit record, then flush the log once.
+     * After it returns kSuccess, the transaction survives crash, after kFail it is never replayed.
+     */
+    int commit(const std::vector<blk_id_t> &block_ids, const std::vector<const Block *> &bufs);
+    /* Write all logged blocks back to their home locations, then empty the log. */
+    int checkpoint();
+    /*
+     * Must be called before block_id is written to its home location (other than by checkpoint),
+     * if it is logged, checkpoint first so that replay never overwrites a newer block with an older one.
+     */
+    int before_home_write(blk_id_t block_id);
+
+private:
+    int write_header();
+    /* blocks taken in the log by a transaction of count blocks, descriptors and commit record included. */
+    static uint32_t tx_log_blocks(uint32_t count);
+    static uint64_t checksum(const std::vector<JournalDescriptor> &descs, const std::vector<const Block *> &bufs);
+
+    BlockDevice *dev_;
+    blk_id_t start_block_;
+    uint32_t num_blocks_;
+    uint32_t sequence_; /* sequence of next transaction */
+    uint32_t head_;     /* next free block of the log, relative to start_block_ */
+    bool checkpointing_;
+    std::map<blk_id_t, Block> logged_; /* latest logged content of each block since last checkpoint */
+};
+}  // namespace sbfs
+
+#endif  // JOURNAL_H_
@@ -1,77 +1,245 @@
 #ifndef LRU_CACHE_H_
 #define LRU_CACHE_H_
 
+#include "arena.h"
 #include "blk.h"
+#include "block_index.h"
 #include "config.h"
+#include "stats.h"
 
 namespace sbfs {
 class BlockDevice;
+
+/* Replacement policy of the block cache. */
+enum CachePolicy : uint32_t {
+    kLRUPolicy, /* plain LRU, a large sequential read flushes everything */
+    /*
+     * 2Q (Johnson & Shasha), scan resistant: a new block goes to a FIFO (A1in), evicted from there its id is
+     * remembered (A1out), and only a block referenced again after that enters the LRU of hot blocks (Am).
+     * Blocks read once by a scan never displace the hot inode / bitmap / index blocks.
+     */
+    k2QPolicy,
+};
+
+/*
+ * Block cache, partitioned by block id hash into kCacheShards shards,
+ * each owns a set of slots with its own lock, hash index, LRU list and dirty indexes,
+ * so that lookups of different shards never contend.
+ * The slots are one BlockArena, optionally on hugetlb pages. Slot i belongs to shard i % kCacheShards,
+ * so that the cache can be resized online by adding or releasing slots at the end of the arena.
+ */
 class LRUCacheManager {
 public:
-    LRUCacheManager(const uint64_t cache_size, BlockDevice *parent);
+    /* cache_size can be changed by resize later, up to max_cache_size (if it's larger). */
+    LRUCacheManager(const uint64_t cache_size, BlockDevice *parent, CachePolicy policy = k2QPolicy,
+                    bool hugetlb = false, uint64_t max_cache_size = 0);
     ~LRUCacheManager();
+    /*
+     * Change the cache size (in bytes, within [kCacheShards blocks, max_cache_size]).
+     * Shrinking writes back and evicts the blocks in released slots, and gives their memory back to the system,
+     * it returns kFail if some of them can't be released (pinned, or write back failed), a later resize retries.
+     * The caller must make sure no block is pinned, nor a pointer from take_dirty is in use.
+     */
+    int resize(uint64_t cache_size);
+    /* current cache size, in blocks. */
+    uint64_t size() const {
+        return _size;
+    }
+    /* Parse "lru" or "2q", returns kFail for other names. */
+    static int parse_policy(const char *name, CachePolicy *policy);
     /*
      * insert or update a block to cache, if full, evict and write back (another) one.
      * return 0 if success, kFail if failed.
      * if update, set "dirty" (Inconsistent to )
+     * owner is the inode the block belongs to, its dirty blocks can be found by take_dirty(owner).
      */
-    int upsert(blk_id_t block_id, const Block *block, bool is_update = false);
+    int upsert(blk_id_t block_id, const Block *block, bool is_update = false, uint32_t owner = kNoOwner);
+    /*
+     * Like upsert, "len" bytes of "buf" are written from "offset" of the block,
+     * a missed block is read from disk first, unless it's written whole.
+     */
+    int upsert(blk_id_t block_id, const uint8_t *buf, uint32_t offset, uint32_t len, uint32_t owner = kNoOwner);
     /* get a block from cache. returns kFail if failed. */
     int get(blk_id_t block_id, Block *block);
+    /*
+     * Like get, but fails if the block is pinned (it may be modified in place right now),
+     * used by readers that don't hold the device lock.
+     */
+    int peek(blk_id_t block_id, Block *block);
+    /* Like peek, "len" bytes from "offset" of the block are copied to "buf". */
+    int peek(blk_id_t block_id, uint8_t *buf, uint32_t offset, uint32_t len);
+    /*
+     * put a clean block just read from disk into cache, no disk access is needed.
+     * "prefetched" if it's read by readahead, whether it's referenced later is counted in Stats.
+     */
+    int fill(blk_id_t block_id, const Block *block, bool prefetched = false);
+    /* update a block only if it is cached (and set "dirty"), returns kFail if it is not cached. */
+    int update(blk_id_t block_id, const Block *block, uint32_t owner = kNoOwner);
+    /* whether block_id is cached, LRU order is not changed. */
+    bool contains(blk_id_t block_id);
 
+    /*
+     * Pin a block in the cache (read from disk if missed) and return its buffer, nullptr if failed
+     * (e.g. all slots are pinned). It's not evicted until unpin, so the caller can access it in place.
+     */
+    Block *pin(blk_id_t block_id);
+    /* Unpin a block, set "dirty" (with owner, see upsert) if the caller modified it. */
+    void unpin(blk_id_t block_id, bool dirty, uint32_t owner = kNoOwner);
     /* remove a block from cache, if dirty, write back. */
     int remove(blk_id_t block_id);
     /* write back block. */
     int sync(blk_id_t block_id);
-    /* sync all blocks. */
-    int sync_all();
+    /*
+     * Find dirty ones of "block_ids", mark them clean and append (block id, cached block) to "blocks",
+     * the caller writes them back. The pointers are valid until the cache is touched again.
+     */
+    int take_dirty(const std::vector<blk_id_t> &block_ids, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    /* Like above, for all dirty blocks of inode "owner", in ascending block id order. */
+    int take_dirty(uint32_t owner, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    /* Like above, for all dirty blocks (used by sync all), in ascending block id order. */
+    int take_all_dirty(std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    /*
+     * Pick dirty blocks for background writeback, at most max_blocks of them, sorted by block id:
+     * the ones dirty for kDirtyExpireMs, and if more than kDirtyBackgroundRatio% of the cache is dirty,
+     * the least recently used ones until it's below, so that eviction mostly finds clean victims.
+     * They are marked clean, the caller writes them back before the cache is touched again.
+     */
+    int pick_writeback(uint64_t now_ms, size_t max_blocks, std::vector<std::pair<blk_id_t, const Block *>> *blocks);
+    /*
+     * Mark the blocks taken above dirty again (with the owner they had), when writing them back failed.
+     * Entries that are not the cached block (e.g. a copy of the caller) are skipped.
+     */
+    int redirty(const std::vector<std::pair<blk_id_t, const Block *>> &blocks);
+    /* number of dirty blocks. */
+    uint64_t dirty_blocks() const {
+        return _dirty_cnt;
+    }
+    /* whether more than kDirtyBackgroundRatio% of the cache is dirty. */
+    bool over_dirty_ratio() const {
+        return _dirty_cnt > _size * kDirtyBackgroundRatio / 100;
+    }
+    /* memory of all slots, used to register them to the io engine. */
+    const BlockArena &arena() const {
+        return _arena;
+    }
 
 private:
+    /* intrusive list of slots, linked by BlockStatus prev / next, most recent first. */
+    struct List {
+        int first = -1;
+        int last = -1;
+        uint64_t size = 0;
+    };
+    /* BlockStatus::queue, the list a slot is on. */
+    enum Queue : uint8_t {
+        kHotQueue,  /* LRU list, Am of 2Q */
+        kInQueue,   /* A1in of 2Q */
+        kFreeQueue, /* on the free list, or released by resize */
+    };
+    /*
+     * A partition of the cache, slots [begin, end) of _buffer.
+     * The lock is recursive, eviction writes back through the device, whose completions may fill the cache.
+     */
+    struct Shard {
+        std::recursive_mutex mtx;
+        int FREE_first;
+        uint64_t slots;                               // number of slots owned, see resize
+        List hot;                                     // LRU, or Am of 2Q
+        List in;                                      // A1in of 2Q, empty for LRU
+        uint64_t in_limit;                            // A1in is trimmed first when it's larger
+        std::vector<blk_id_t> ghost;                  // A1out of 2Q, a ring, kNoBlock if hit since
+        uint64_t ghost_head;                          // next position of ghost to overwrite
+        BlockIndex ghost_index;                       // map blk id to position in ghost
+        BlockIndex hashtable;                         // map blk id to slot id
+        std::set<blk_id_t> dirty;                     // ids of dirty blocks, ordered for writeback
+        // owner inode to ids of its dirty blocks, blocks without owner are not here
+        std::unordered_map<uint32_t, std::set<blk_id_t>> owner_dirty;
+    };
+    static constexpr blk_id_t kNoBlock = UINT32_MAX;
+    /* the first slot >= "from" of shard s. */
+    uint64_t first_slot(uint64_t s, uint64_t from) const {
+        return from + (s + _shards.size() - from % _shards.size()) % _shards.size();
+    }
+    /* size A1in and A1out to the slots of a shard. */
+    void set_limits(Shard &sh);
+    Shard &shard_of(blk_id_t id) {
+        /* fibonacci hashing, so that strided ids spread over shards too. */
+        return _shards[(uint32_t)(id * 2654435769u) % _shards.size()];
+    }
+
     /**
      * @brief Get the page object
      *
      * @param id
      * @param slot
+     * @param read read a missed block from disk, false if the caller overwrites it whole
      * @return int
      */
-    int get_page(blk_id_t id, int &slot);
+    int get_page(Shard &sh, blk_id_t id, int &slot, bool read = true);
     /**
      * @brief evict a block from cache
      *
      * @param id
      * @return int
      */
-    int remove_page(blk_id_t id);
+    int remove_page(Shard &sh, blk_id_t id);
+
+    /* get a slot for block "id" (a free one or evict one) and put it on the list chosen by the policy. */
+    int alloc(Shard &sh, blk_id_t id, int &slot);
+    /* slot to evict next, pinned ones are skipped, -1 if none. */
+    int victim(Shard &sh);
+    /* a cached block is referenced. */
+    void touch(Shard &sh, int slot);
+    /* remember id evicted from A1in, forgetting the oldest one. */
+    void ghost_add(Shard &sh, blk_id_t id);
+    /* whether id is remembered in A1out, it's forgotten then. */
+    bool ghost_hit(Shard &sh, blk_id_t id);
 
-    int alloc(int &slot);
+    /* mark a slot dirty, and keep the dirty indexes, a dirty block keeps its owner unless a new one is given. */
+    void set_dirty(Shard &sh, int slot, uint32_t owner = kNoOwner);
+    void set_clean(Shard &sh, int slot);
+    /* drop the block from the dirty set of its owner. */
+    void unlink_owner(Shard &sh, const BlockStatus &stu);
 
-    int FREE_add(int slot) {
+    int FREE_add(Shard &sh, int slot) {
         auto &stu = _buffer[slot].second;
-        stu.next = FREE_first;
-        FREE_first = slot;
+        stu.queue = kFreeQueue;
+        if ((uint64_t)slot >= _size) {
+            /* released by resize. */
+            return 0;
+        }
+        stu.next = sh.FREE_first;
+        sh.FREE_first = slot;
         return 0;
     }
-    int LRU_add(int slot) {
+    List &list_of(Shard &sh, int slot) {
+        return _buffer[slot].second.queue == kInQueue ? sh.in : sh.hot;
+    }
+    int LRU_add(Shard &sh, int slot, Queue queue) {
         auto &stu = _buffer[slot].second;
-        stu.next = LRU_first;
+        stu.queue = queue;
+        auto &l = list_of(sh, slot);
+        stu.next = l.first;
         stu.prev = -1;
-        if (LRU_first != -1) {
-            _buffer[LRU_first].second.prev = slot;
+        if (l.first != -1) {
+            _buffer[l.first].second.prev = slot;
         }
-        LRU_first = slot;
-        if (LRU_last == -1) {
-            LRU_last = slot;
+        l.first = slot;
+        if (l.last == -1) {
+            l.last = slot;
         }
+        ++l.size;
         return 0;
     }
-    int LRU_remove(int slot) {
+    int LRU_remove(Shard &sh, int slot) {
         auto &stu = _buffer[slot].second;
-        if (slot == LRU_first) {
-            LRU_first = stu.next;
+        auto &l = list_of(sh, slot);
+        if (slot == l.first) {
+            l.first = stu.next;
         }
 
-        if (slot == LRU_last) {
-            LRU_last = stu.prev;
+        if (slot == l.last) {
+            l.last = stu.prev;
         }
         if (stu.next != -1) {
             _buffer[stu.next].second.prev = stu.prev;
@@ -80,16 +248,18 @@ private:
             _buffer[stu.prev].second.next = stu.next;
         }
         stu.prev = stu.next = -1;
+        --l.size;
         return 0;
     }
 
-    int FREE_first;
-    int LRU_first;
-    int LRU_last;
-    std::unordered_map<blk_id_t, int> _hashtable;          // map blk id to slot id
-    std::vector<std::pair<Block *, BlockStatus>> _buffer;  // actual cache
-    uint64_t _size;                                        // maxium slot of buffer
-    uint64_t _cache_size;                                  // actual cache size, in Bytes
+    CachePolicy _policy;
+    std::vector<Shard> _shards;
+    BlockArena _arena;                                     // memory of the slots
+    std::vector<std::pair<Block *, BlockStatus>> _buffer;  // actual cache, in _arena
+    std::atomic<uint64_t> _size;                           // number of slots in use, [0, _size) of buffer
+    uint64_t _max_size;                                    // number of slots of buffer, maximum _size
+    std::mutex _resize_mtx;
+    std::atomic<uint64_t> _dirty_cnt;                      // number of dirty blocks of all shards
     BlockDevice *_dev;
 };
 }  // namespace sbfs
@@ -0,0 +1,40 @@
+#ifndef PRESSURE_H_
+#define PRESSURE_H_
+
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Memory pressure monitor on Linux PSI.
+ * A trigger is set on memory.pressure of the cgroup sbfs runs in (cgroup v2, so the limit of a container counts),
+ * or on /proc/pressure/memory of the host if there is none: when some task stalls on memory for kPressureStallMs
+ * in a kPressureWindowMs window, the callback is called with true, and each kPressureCalmMs without that, with false.
+ */
+class PressureMonitor {
+public:
+    using callback_t = std::function<void(bool pressure)>;
+
+    PressureMonitor() = default;
+    PressureMonitor(const PressureMonitor &) = delete;
+    PressureMonitor &operator=(const PressureMonitor &) = delete;
+    ~PressureMonitor() {
+        stop();
+    }
+    /* Start the monitor thread, returns kFail if PSI is not available (kernel < 4.20, or disabled). */
+    int start(callback_t cb);
+    /* Stop the monitor thread and wait for it. */
+    void stop();
+
+private:
+    /* open the pressure file of our cgroup (or the host) and write the trigger, -1 if failed. */
+    static int open_trigger();
+    void loop();
+
+    int fd_ = -1;      /* pressure file with the trigger */
+    int stop_fd_ = -1; /* eventfd, signaled by stop */
+    callback_t cb_;
+    std::thread thread_;
+};
+}  // namespace sbfs
+
+#endif  // PRESSURE_H_
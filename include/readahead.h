@@ -0,0 +1,34 @@
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include "config.h"
+
+namespace sbfs {
+/*
+ * Sequential stream detection of file reads.
+ * A read starting at (or inside the last block of) the previous read of the same file is sequential.
+ * For a sequential stream the next "window" blocks are prefetched, a new prefetch is issued
+ * when the reader gets within half a window of the prefetched end, and the window doubles each time
+ * (up to kReadaheadMaxBlocks). A random read halves the window, below kReadaheadMinBlocks it's off.
+ */
+class Readahead {
+public:
+    /*
+     * Record a read of logical blocks [lid, rid] of inode_id,
+     * set [*start, *start + *count) to logical blocks to prefetch, *count is 0 if nothing to do.
+     */
+    void on_read(uint32_t inode_id, uint32_t lid, uint32_t rid, uint32_t *start, uint32_t *count);
+    /* Drop the stream of inode_id, e.g. it's truncated or removed. */
+    void forget(uint32_t inode_id);
+
+private:
+    struct Stream {
+        uint32_t next;   /* logical block after the last read */
+        uint32_t ahead;  /* logical block after the last prefetched one */
+        uint32_t window; /* 0 if not a sequential stream */
+    };
+    std::unordered_map<uint32_t, Stream> streams_; /* inode id -> stream */
+};
+}  // namespace sbfs
+
+#endif  // READAHEAD_H_
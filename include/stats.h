@@ -0,0 +1,69 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "config.h"
+
+namespace sbfs {
+/* Event counters, see Stats. */
+enum Counter : uint32_t {
+    kCacheHits,           /* lookups found in the block cache */
+    kCacheMisses,         /* lookups read from disk */
+    kCacheEvictions,      /* blocks evicted to make room */
+    kCacheDirtyEvictions, /* of them, dirty ones written back synchronously by the evicting request */
+    kReadaheadBlocks,     /* blocks put in the cache by readahead */
+    kReadaheadHits,       /* of them, referenced before eviction */
+    kReadaheadWasted,     /* of them, evicted without a reference */
+    kDiskReadBlocks,
+    kDiskWriteBlocks,
+    kWritebackBlocks, /* written back by the background flusher */
+    kFsyncCalls,
+    kFsyncGroups, /* group commits serving them */
+    kDirectReadBlocks,  /* read bypassing the block cache, see BlockDevice::read_direct */
+    kDirectWriteBlocks, /* written bypassing the block cache */
+    kDelallocFlushes,   /* files with delayed allocation flushed, see DelayedAlloc */
+    kDelallocBlocks,    /* blocks allocated by them */
+    kInodeWritebacks,   /* inode table block writes of dirty inodes, see InodeCache */
+    kNumCounters,
+};
+
+/* Latency histograms, in us, see Stats. */
+enum Histogram : uint32_t {
+    kDiskReadLatency,  /* one read request (a block or a run) */
+    kDiskWriteLatency, /* one write request (a block or a run) */
+    kFlushLatency,     /* flush of the disk write cache */
+    kFsyncLatency,     /* a fsync call, waiting for the group included */
+    kWritebackLatency, /* a batch of the background flusher */
+    kNumHistograms,
+};
+
+/*
+ * Statistics of the block layer.
+ * Each thread updates its own counters and histograms (relaxed atomics, no shared cache line),
+ * report() sums all threads, so recording is cheap and reading is rare.
+ * Histogram bucket b counts latencies in [2^(b-1), 2^b) us.
+ */
+class Stats {
+public:
+    static void add(Counter counter, uint64_t n = 1);
+    static void record(Histogram histogram, uint64_t us);
+    /* text report, one "name value" per line, histograms as count, mean and percentiles. */
+    static std::string report();
+};
+
+/* Record the lifetime of a scope to a histogram, e.g. { LatencyTimer t(kFsyncLatency); ... } */
+class LatencyTimer {
+public:
+    explicit LatencyTimer(Histogram histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~LatencyTimer() {
+        Stats::record(histogram_, std::chrono::duration_cast<std::chrono::microseconds>(
+                                      std::chrono::steady_clock::now() - start_)
+                                      .count());
+    }
+
+private:
+    Histogram histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+}  // namespace sbfs
+
+#endif  // STATS_H_
@@ -10,7 +10,10 @@ extern SBFileSystem *sbfs;
 extern PathResolver *path_resolver;
 extern FDManager *fd_manager;
 
-void init_vfs(const char *path, const uint64_t size, bool is_open);
+void init_vfs(const char *path, const uint64_t size, bool is_open, const DeviceOptions &options = DeviceOptions());
+
+/* Called by FUSE in the serving process, starts background threads. */
+void *sb_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
 
 void sb_destroy(void *private_data);
 
@@ -0,0 +1,71 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+
+namespace sbfs {
+BlockArena::~BlockArena() {
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+    }
+}
+
+void BlockArena::release(uint64_t first, uint64_t count) {
+    uintptr_t begin = (uintptr_t)(base_ + first);
+    uintptr_t end = (uintptr_t)(base_ + first + count);
+    if (hugetlb_) {
+        /* only whole huge pages can be dropped. */
+        begin = (begin + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        end = end / kHugePageSize * kHugePageSize;
+    }
+    if (begin < end && madvise((void *)begin, end - begin, MADV_DONTNEED) != 0) {
+        DLOG(WARNING) << "madvise MADV_DONTNEED of arena failed " << strerror(errno);
+    }
+}
+
+int BlockArena::init(uint64_t count, bool hugetlb) {
+    rt_assert(map_ == nullptr, "arena is already mapped");
+    size_t size = count * kBlockSize;
+    size_t huge_size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    if (hugetlb) {
+        /* hugetlb pages are reserved at mmap, so running out of them fails here rather than on a later fault. */
+        void *p = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            map_ = p;
+            map_size_ = huge_size;
+            base_ = (Block *)p;
+            count_ = count;
+            hugetlb_ = true;
+            DLOG(INFO) << "arena of " << count << " blocks on hugetlb pages";
+            return kSuccess;
+        }
+        LOG(WARNING) << "mmap " << huge_size << " bytes of hugetlb pages failed " << strerror(errno)
+                     << ", fallback to transparent huge pages";
+    }
+    /* map a huge page more, so that the arena starts at a huge page boundary and THP can back all of it. */
+    size_t map_size = huge_size + kHugePageSize;
+    void *p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        LOG(ERROR) << "mmap arena of " << count << " blocks failed " << strerror(errno);
+        return kFail;
+    }
+    uintptr_t begin = ((uintptr_t)p + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    /* give back the unaligned head and the tail. */
+    if (begin > (uintptr_t)p) {
+        munmap(p, begin - (uintptr_t)p);
+    }
+    uintptr_t end = begin + huge_size;
+    if (end < (uintptr_t)p + map_size) {
+        munmap((void *)end, (uintptr_t)p + map_size - end);
+    }
+    if (madvise((void *)begin, huge_size, MADV_HUGEPAGE) != 0) {
+        /* THP disabled or not built in, small pages still work. */
+        DLOG(WARNING) << "madvise MADV_HUGEPAGE failed " << strerror(errno);
+    }
+    map_ = (void *)begin;
+    map_size_ = huge_size;
+    base_ = (Block *)begin;
+    count_ = count;
+    DLOG(INFO) << "arena of " << count << " blocks at " << map_;
+    return kSuccess;
+}
+}  // namespace sbfs
@@ -0,0 +1,151 @@
+#include "backend.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace sbfs {
+StorageBackend *StorageBackend::create(BackendType type, const char *path, uint64_t size) {
+    DLOG(INFO) << "create backend " << type << " at " << path << " with size " << size;
+    if (type == kRamBackend) {
+        void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            DLOG(WARNING) << "mmap RAM disk failed " << strerror(errno);
+            return nullptr;
+        }
+        return new MemoryBackend(-1, (uint8_t *)base, size);
+    }
+
+    int flags = O_RDWR | O_NOATIME | O_CREAT;
+    if (type == kFileBackend) {
+        flags |= O_DIRECT;
+    }
+    int fd = open(path, flags, 0644);
+    if (fd < 0) {
+        DLOG(WARNING) << "open " << path << " failed";
+        return nullptr;
+    }
+    if (ftruncate(fd, size) < 0) {
+        DLOG(WARNING) << "ftruncate " << path << " failed";
+        close(fd);
+        return nullptr;
+    }
+    if (type == kFileBackend) {
+        return new FileBackend(fd);
+    }
+
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        DLOG(WARNING) << "mmap " << path << " failed " << strerror(errno);
+        close(fd);
+        return nullptr;
+    }
+    return new MemoryBackend(fd, (uint8_t *)base, size);
+}
+
+int StorageBackend::parse_type(const char *name, BackendType *type) {
+    if (strcmp(name, "file") == 0) {
+        *type = kFileBackend;
+    } else if (strcmp(name, "mmap") == 0) {
+        *type = kMmapBackend;
+    } else if (strcmp(name, "ram") == 0) {
+        *type = kRamBackend;
+    } else {
+        return kFail;
+    }
+    return kSuccess;
+}
+
+FileBackend::~FileBackend() {
+    close(fd_);
+}
+
+int FileBackend::read(blk_id_t block_id, Block *buf) {
+    if (pread(fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize) != kBlockSize) {
+        DLOG(WARNING) << "pread " << block_id << " failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int FileBackend::write(blk_id_t block_id, const Block *buf) {
+    if (pwrite(fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize) != kBlockSize) {
+        DLOG(WARNING) << "pwrite " << block_id << " failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int FileBackend::readv(blk_id_t block_id, const iovec *iov, int cnt) {
+    if (preadv(fd_, iov, cnt, (uint64_t)block_id * kBlockSize) != cnt * kBlockSize) {
+        DLOG(WARNING) << "preadv " << block_id << " cnt " << cnt << " failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int FileBackend::writev(blk_id_t block_id, const iovec *iov, int cnt) {
+    if (pwritev(fd_, iov, cnt, (uint64_t)block_id * kBlockSize) != cnt * kBlockSize) {
+        DLOG(WARNING) << "pwritev " << block_id << " cnt " << cnt << " failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int FileBackend::flush() {
+    if (fdatasync(fd_) != 0) {
+        DLOG(WARNING) << "fdatasync failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+
+MemoryBackend::~MemoryBackend() {
+    munmap(base_, size_);
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+int MemoryBackend::read(blk_id_t block_id, Block *buf) {
+    iovec iov{ buf, kBlockSize };
+    return readv(block_id, &iov, 1);
+}
+
+int MemoryBackend::write(blk_id_t block_id, const Block *buf) {
+    iovec iov{ const_cast<Block *>(buf), kBlockSize };
+    return writev(block_id, &iov, 1);
+}
+
+int MemoryBackend::readv(blk_id_t block_id, const iovec *iov, int cnt) {
+    uint64_t offset = (uint64_t)block_id * kBlockSize;
+    if (offset + (uint64_t)cnt * kBlockSize > size_) {
+        DLOG(WARNING) << "read " << block_id << " cnt " << cnt << " out of range";
+        return kFail;
+    }
+    for (int i = 0; i < cnt; ++i, offset += kBlockSize) {
+        memcpy(iov[i].iov_base, base_ + offset, kBlockSize);
+    }
+    return kSuccess;
+}
+
+int MemoryBackend::writev(blk_id_t block_id, const iovec *iov, int cnt) {
+    uint64_t offset = (uint64_t)block_id * kBlockSize;
+    if (offset + (uint64_t)cnt * kBlockSize > size_) {
+        DLOG(WARNING) << "write " << block_id << " cnt " << cnt << " out of range";
+        return kFail;
+    }
+    for (int i = 0; i < cnt; ++i, offset += kBlockSize) {
+        memcpy(base_ + offset, iov[i].iov_base, kBlockSize);
+    }
+    return kSuccess;
+}
+
+int MemoryBackend::flush() {
+    if (fd_ >= 0 && msync(base_, size_, MS_SYNC) != 0) {
+        DLOG(WARNING) << "msync failed " << strerror(errno);
+        return kFail;
+    }
+    return kSuccess;
+}
+}  // namespace sbfs
@@ -1,3 +1,4 @@
+#include "bitscan.h"
 #include "fs_layout.h"
 
 using namespace std;
@@ -21,58 +22,263 @@ int leading_zero(uint64_t x) {
     return __builtin_ctzll(not_x);
 }
 
+/* words of a bitmap block (a group). */
+constexpr uint64_t kWordsPerGroup = kBlockSize / sizeof(uint64_t);
+
 Bitmap::Bitmap(blk_id_t start_block_id, blk_id_t num_blocks, blk_id_t data_segment_offset)
     : start_block_id(start_block_id), num_blocks(num_blocks), data_segment_offset(data_segment_offset) {
     // init();
 }
 
-blk_id_t Bitmap::alloc(BlockDevice *dev) const {
-    Block buf;
-    int slot_per_block = kBlockSize * 8;
+int Bitmap::load(BlockDevice *dev, bool format) {
+    vector<Block> blocks(num_blocks);
+    vector<pair<blk_id_t, Block *>> ids;
     for (blk_id_t i = 0; i < num_blocks; i++) {
-        if (dev->read(start_block_id + i, &buf) != kSuccess) {
-            DLOG(WARNING) << "bitmap read " << start_block_id + i << " failed";
+        ids.emplace_back(start_block_id + i, &blocks[i]);
+    }
+    if (format) {
+        memset(blocks.data(), 0, blocks.size() * sizeof(Block));
+        if (dev->write_blocks(vector<pair<blk_id_t, const Block *>>(ids.begin(), ids.end())) != kSuccess) {
+            DLOG(WARNING) << "bitmap format " << start_block_id << " failed";
             return kFail;
         }
-        auto sz = sizeof(uint64_t);
-        auto p = (uint64_t *)(buf.data);
-        for (int j = 0; j < kBlockSize / sz; j++) {
-            int k = leading_zero(p[j]);
-            DLOG(INFO) << "bitmap read " << start_block_id << " " << i << " " << j << " " << p[j];
-            DLOG(INFO) << "Allocated K is " << k;
-            // int k = -1;
-            if (k != -1) {
-                p[j] |= (1ul << k);
-                if (dev->write(start_block_id + i, &buf) != kSuccess) {
-                    DLOG(WARNING) << "bitmap write " << start_block_id + i << " failed";
-                    return kFail;
-                }
-                DLOG(WARNING) << "ret = " << i * slot_per_block + j * sz + k << " + " << data_segment_offset;
-                return i * slot_per_block + j * sz * 8 + k + data_segment_offset;
+    } else if (dev->read_blocks(ids) != kSuccess) {
+        DLOG(WARNING) << "bitmap read " << start_block_id << " failed";
+        return kFail;
+    }
+    words_.resize(total() / 64);
+    memcpy(words_.data(), blocks.data(), words_.size() * sizeof(uint64_t));
+    group_free_.assign(num_blocks, 0);
+    free_ = 0;
+    for (uint64_t w = 0; w < words_.size(); w++) {
+        group_free_[w / kWordsPerGroup] += 64 - __builtin_popcountll(words_[w]);
+    }
+    for (auto n : group_free_) {
+        free_ += n;
+    }
+    hint_ = 0;
+    DLOG(WARNING) << "bitmap " << start_block_id << " loaded, " << free_ << " of " << total() << " free";
+    return kSuccess;
+}
+
+blk_id_t Bitmap::alloc(BlockDevice *dev, blk_id_t goal) {
+    bool near = goal >= data_segment_offset && goal - data_segment_offset < total();
+    uint64_t bit = near ? find_near(goal - data_segment_offset) : find_free(hint_ * 64);
+    if (bit == total()) {
+        DLOG(WARNING) << "bitmap alloc failed: no empty block found";
+        return kFail;
+    }
+    if (!near) {
+        hint_ = bit / 64;
+    }
+    if (set_range(bit, 1, true, dev) != kSuccess) {
+        return kFail;
+    }
+    return bit + data_segment_offset;
+}
+
+int Bitmap::alloc_range(uint32_t count, blk_id_t goal, vector<Extent> *extents, BlockDevice *dev) {
+    if (count > free_) {
+        DLOG(WARNING) << "bitmap alloc " << count << " failed: only " << free_ << " free";
+        return kFail;
+    }
+    /*
+     * the free bit nearest to the goal (or the first one), then first fit after it, wrapping around,
+     * count <= free_ so it's enough.
+     */
+    uint64_t bit = goal >= data_segment_offset && goal - data_segment_offset < total()
+                       ? find_near(goal - data_segment_offset)
+                       : find_free(hint_ * 64);
+    size_t first = extents->size();
+    while (count > 0) {
+        bit = find_free(bit);
+        if (bit == total()) {
+            bit = find_free(hint_ * 64);
+        }
+        uint64_t len = free_run(bit, count);
+        if (set_range(bit, len, true, dev) != kSuccess) {
+            /* give back the extents of this call. */
+            for (size_t i = first; i < extents->size(); i++) {
+                free_range((*extents)[i].start, (*extents)[i].len, dev);
             }
+            extents->resize(first);
+            return kFail;
         }
+        extents->push_back(Extent{ (blk_id_t)(bit + data_segment_offset), (uint32_t)len });
+        count -= len;
+        bit += len;
     }
-    DLOG(WARNING) << "bitmap alloc failed: no empty block found";
-    return kFail;
+    return kSuccess;
+}
+
+int Bitmap::free(blk_id_t block_id, BlockDevice *dev) {
+    return free_range(block_id, 1, dev);
 }
 
-int Bitmap::free(blk_id_t block_id, BlockDevice *dev) const {
-    block_id -= data_segment_offset;
-    Block buf;
-    int slot_per_block = kBlockSize * 8;
-    blk_id_t block_id_in_bitmap = block_id / slot_per_block;
-    int slot_id_in_bitmap = block_id % slot_per_block;
-    rt_assert(block_id_in_bitmap < num_blocks, "block_id out of bitmap range");
-    if (dev->read(start_block_id + block_id_in_bitmap, &buf) != kSuccess) {
-        DLOG(WARNING) << "bitmap read " << start_block_id + block_id_in_bitmap << " failed";
+int Bitmap::free_range(blk_id_t start, uint32_t len, BlockDevice *dev) {
+    uint64_t bit = start - data_segment_offset;
+    rt_assert(bit + len <= total(), "block_id out of bitmap range");
+    if (set_range(bit, len, false, dev) != kSuccess) {
         return kFail;
     }
-    auto sz = sizeof(uint64_t) * 8;
-    auto p = (uint64_t *)(buf.data);
-    p[slot_id_in_bitmap / sz] &= ~(1ul << (slot_id_in_bitmap % sz));
-    if (dev->write(start_block_id + block_id_in_bitmap, &buf) != kSuccess) {
-        DLOG(WARNING) << "bitmap write " << start_block_id + block_id_in_bitmap << " failed";
-        return kFail;
+    hint_ = std::min(hint_, bit / 64);
+    return kSuccess;
+}
+
+uint64_t Bitmap::find_free(uint64_t from) const {
+    uint64_t w = from / 64;
+    if (w >= words_.size()) {
+        return total();
+    }
+    /* bits before "from" count as used. */
+    uint64_t x = words_[w] | ((1ull << (from % 64)) - 1);
+    if (x != UINT64_MAX) {
+        return w * 64 + leading_zero(x);
+    }
+    /* then the first word that isn't full, skipping full groups. */
+    for (++w; w < words_.size();) {
+        uint64_t g = w / kWordsPerGroup, end = (g + 1) * kWordsPerGroup;
+        if (group_free_[g] != 0) {
+            w += find_word_not(&words_[w], end - w, UINT64_MAX);
+            if (w < end) {
+                return w * 64 + leading_zero(words_[w]);
+            }
+        }
+        w = end;
+    }
+    return total();
+}
+
+uint64_t Bitmap::find_near(uint64_t goal) const {
+    uint64_t g = goal / kGroupBits;
+    uint64_t bit = find_free(goal);
+    if (bit < (g + 1) * kGroupBits || group_free_[g] == 0) {
+        return bit == total() ? find_free(hint_ * 64) : bit;
+    }
+    /* the free bits of the group are all before the goal, take the last one. */
+    for (uint64_t w = goal / 64;; --w) {
+        uint64_t free_bits = ~words_[w];
+        if (w == goal / 64) {
+            free_bits &= (1ull << (goal % 64)) - 1;
+        }
+        if (free_bits != 0) {
+            return w * 64 + 63 - __builtin_clzll(free_bits);
+        }
+    }
+}
+
+uint64_t Bitmap::free_count(blk_id_t start, uint64_t len) const {
+    uint64_t bit = start - data_segment_offset, end = std::min(total(), bit + len), n = 0;
+    while (bit < end) {
+        if (bit % kGroupBits == 0 && bit + kGroupBits <= end) {
+            n += group_free_[bit / kGroupBits];
+            bit += kGroupBits;
+            continue;
+        }
+        uint64_t k = std::min(end - bit, 64 - bit % 64);
+        uint64_t mask = (k == 64 ? UINT64_MAX : (1ull << k) - 1) << (bit % 64);
+        n += __builtin_popcountll(~words_[bit / 64] & mask);
+        bit += k;
+    }
+    return n;
+}
+
+uint64_t Bitmap::free_run(uint64_t from, uint64_t max) const {
+    uint64_t end = std::min(total(), from + max);
+    /* the used bits of the first word from "from" on, the free ones before the first of them are in the run. */
+    uint64_t used = words_[from / 64] >> (from % 64);
+    if (used != 0) {
+        return std::min<uint64_t>(__builtin_ctzll(used), end - from);
+    }
+    /* then whole free words, and the free bits at the start of the word ending the run. */
+    uint64_t bit = (from / 64 + 1) * 64;
+    if (bit < end) {
+        uint64_t w = bit / 64, n = (end - bit + 63) / 64;
+        uint64_t k = find_word_not(&words_[w], n, 0);
+        bit += k * 64;
+        if (k < n) {
+            bit += __builtin_ctzll(words_[w + k]);
+        }
+    }
+    return std::min(bit, end) - from;
+}
+
+int Bitmap::set_range(uint64_t bit, uint64_t len, bool used, BlockDevice *dev) {
+    /*
+     * the changed bits (word, mask), the earlier groups are changed back if a later bitmap block can't be pinned,
+     * and in a transaction they are restored in memory if it's aborted.
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> undo;
+    for (uint64_t end = bit + len; bit < end;) {
+        uint64_t g = bit / kGroupBits, group_end = std::min(end, (g + 1) * kGroupBits);
+        BlockRef ref;
+        if (dev->pin(start_block_id + g, &ref) != kSuccess) {
+            DLOG(WARNING) << "bitmap read " << start_block_id + g << " failed";
+            revert(undo, used, dev);
+            return kFail;
+        }
+        for (uint64_t n; bit < group_end; bit += n) {
+            n = std::min(group_end - bit, 64 - bit % 64);
+            uint64_t mask = (n == 64 ? UINT64_MAX : (1ull << n) - 1) << (bit % 64);
+            uint64_t &word = words_[bit / 64];
+            uint64_t &disk_word = ref.as<uint64_t>()[bit % kGroupBits / 64];
+            /* bits already in the state are not counted again. */
+            uint32_t changed = __builtin_popcountll((used ? ~word : word) & mask);
+            if (changed != 0) {
+                undo.emplace_back(bit / 64, (used ? ~word : word) & mask);
+            }
+            word = used ? word | mask : word & ~mask;
+            disk_word = used ? disk_word | mask : disk_word & ~mask;
+            if (used) {
+                group_free_[g] -= changed;
+                free_ -= changed;
+            } else {
+                group_free_[g] += changed;
+                free_ += changed;
+            }
+        }
+        ref.mark_dirty();
+    }
+    if (dev->in_tx() && !undo.empty()) {
+        dev->on_abort([this, used, undo = std::move(undo)]() { restore(undo, !used); });
     }
     return kSuccess;
 }
+
+void Bitmap::revert(const std::vector<std::pair<uint64_t, uint64_t>> &words, bool used, BlockDevice *dev) {
+    restore(words, !used);
+    BlockRef ref;
+    uint64_t pinned = UINT64_MAX;
+    for (auto &[w, mask] : words) {
+        uint64_t g = w * 64 / kGroupBits;
+        if (g != pinned) {
+            /* pinned by set_range just before, so it's cached. */
+            if (dev->pin(start_block_id + g, &ref) != kSuccess) {
+                LOG(WARNING) << "bitmap block " << start_block_id + g << " can't be changed back";
+                pinned = UINT64_MAX;
+                continue;
+            }
+            pinned = g;
+            ref.mark_dirty();
+        }
+        uint64_t &disk_word = ref.as<uint64_t>()[w % (kGroupBits / 64)];
+        disk_word = used ? disk_word & ~mask : disk_word | mask;
+    }
+}
+
+void Bitmap::restore(const std::vector<std::pair<uint64_t, uint64_t>> &words, bool used) {
+    for (auto &[w, mask] : words) {
+        uint32_t n = __builtin_popcountll(mask);
+        uint64_t g = w * 64 / kGroupBits;
+        if (used) {
+            words_[w] |= mask;
+            group_free_[g] -= n;
+            free_ -= n;
+        } else {
+            words_[w] &= ~mask;
+            group_free_[g] += n;
+            free_ += n;
+            hint_ = std::min(hint_, w);
+        }
+    }
+}
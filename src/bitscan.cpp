@@ -0,0 +1,111 @@
+#include "bitscan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace sbfs {
+namespace {
+size_t find_word_not_scalar(const uint64_t *words, size_t n, uint64_t value) {
+    size_t i = 0;
+    for (; i < n && words[i] == value; ++i) {
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) size_t find_word_not_avx2(const uint64_t *words, size_t n, uint64_t value) {
+    const __m256i v = _mm256_set1_epi64x(value);
+    size_t i = 0;
+    /* 8 words (a cache line) per iteration. */
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(words + i)), v);
+        __m256i b = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(words + i + 4)), v);
+        uint32_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(a)) | _mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4;
+        if (mask != 0xff) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + find_word_not_scalar(words + i, n - i, value);
+}
+
+__attribute__((target("avx512f"))) size_t find_word_not_avx512(const uint64_t *words, size_t n, uint64_t value) {
+    const __m512i v = _mm512_set1_epi64(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 mask = _mm512_cmpneq_epi64_mask(_mm512_loadu_si512(words + i), v);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    /* the tail with a masked load, words past n are never touched. */
+    if (i < n) {
+        __mmask8 tail = (1u << (n - i)) - 1;
+        __mmask8 mask = _mm512_mask_cmpneq_epi64_mask(tail, _mm512_maskz_loadu_epi64(tail, words + i), v);
+        return mask != 0 ? i + __builtin_ctz(mask) : n;
+    }
+    return n;
+}
+#endif
+
+bool supported(BitscanKernel kernel) {
+    switch (kernel) {
+#if defined(__x86_64__)
+        case kAVX512Scan:
+            return __builtin_cpu_supports("avx512f");
+        case kAVX2Scan:
+            return __builtin_cpu_supports("avx2");
+#else
+        /* the SIMD kernels are x86 only. */
+        case kAVX512Scan:
+        case kAVX2Scan:
+            return false;
+#endif
+        default:
+            return true;
+    }
+}
+
+BitscanKernel best_kernel() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+#endif
+    return supported(kAVX512Scan) ? kAVX512Scan : supported(kAVX2Scan) ? kAVX2Scan : kScalarScan;
+}
+
+using find_word_not_t = size_t (*)(const uint64_t *, size_t, uint64_t);
+#if defined(__x86_64__)
+const find_word_not_t kKernels[] = { find_word_not_scalar, find_word_not_avx2, find_word_not_avx512 };
+#else
+/* indexed by BitscanKernel, the others are never supported. */
+const find_word_not_t kKernels[] = { find_word_not_scalar, find_word_not_scalar, find_word_not_scalar };
+#endif
+
+/* scalar until the CPU is checked at startup, so that it's usable in any static initializer. */
+BitscanKernel active_kernel = kScalarScan;
+find_word_not_t find_word_not_impl = find_word_not_scalar;
+const int kDetected = set_bitscan_kernel(best_kernel());
+}  // namespace
+
+size_t find_word_not(const uint64_t *words, size_t n, uint64_t value) {
+    return find_word_not_impl(words, n, value);
+}
+
+BitscanKernel bitscan_kernel() {
+    return active_kernel;
+}
+
+const char *bitscan_kernel_name(BitscanKernel kernel) {
+    static const char *kNames[] = { "scalar", "avx2", "avx512" };
+    return kNames[kernel];
+}
+
+int set_bitscan_kernel(BitscanKernel kernel) {
+    if (!supported(kernel)) {
+        return kFail;
+    }
+    active_kernel = kernel;
+    find_word_not_impl = kKernels[kernel];
+    return kSuccess;
+}
+}  // namespace sbfs
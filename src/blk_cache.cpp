@@ -3,12 +3,13 @@
 #include "blk_dev.h"
 
 namespace sbfs {
-BlockCacheManager::BlockCacheManager(const uint64_t cache_size, BlockDevice *parent)
+BlockCacheManager::BlockCacheManager(const uint64_t cache_size, BlockDevice *parent, CachePolicy policy,
+                                     bool hugetlb, uint64_t max_cache_size)
     : parent_(parent), size_(cache_size) {}
 
 BlockCacheManager::~BlockCacheManager() {}
 
-int BlockCacheManager::upsert(blk_id_t block_id, const Block *block) {
+int BlockCacheManager::upsert(blk_id_t block_id, const Block *block, bool is_update, uint32_t owner) {
     parent_->write_to_disk(block_id, block);
     return kSuccess;
 }
@@ -17,15 +18,79 @@ int BlockCacheManager::get(blk_id_t block_id, Block *block) {
     return kFail;
 }
 
-int BlockCacheManager::remove(blk_id_t block_id) {
+int BlockCacheManager::peek(blk_id_t block_id, Block *block) {
+    return kFail;
+}
+
+int BlockCacheManager::peek(blk_id_t block_id, uint8_t *buf, uint32_t offset, uint32_t len) {
+    return kFail;
+}
+
+int BlockCacheManager::fill(blk_id_t block_id, const Block *block, bool prefetched) {
     return kSuccess;
 }
 
-int BlockCacheManager::sync(blk_id_t block_id) {
+int BlockCacheManager::update(blk_id_t block_id, const Block *block, uint32_t owner) {
+    return kFail;
+}
+
+int BlockCacheManager::upsert(blk_id_t block_id, const uint8_t *buf, uint32_t offset, uint32_t len, uint32_t owner) {
+    return kFail;
+}
+
+bool BlockCacheManager::contains(blk_id_t block_id) const {
+    return false;
+}
+
+Block *BlockCacheManager::pin(blk_id_t block_id) {
+    return nullptr;
+}
+
+void BlockCacheManager::unpin(blk_id_t block_id, bool dirty, uint32_t owner) {}
+
+int BlockCacheManager::take_dirty(const std::vector<blk_id_t> &block_ids,
+                                  std::vector<std::pair<blk_id_t, const Block *>> *blocks) {
     return kSuccess;
 }
 
-int BlockCacheManager::sync_all() {
+int BlockCacheManager::take_dirty(uint32_t owner, std::vector<std::pair<blk_id_t, const Block *>> *blocks) {
+    return kSuccess;
+}
+
+int BlockCacheManager::take_all_dirty(std::vector<std::pair<blk_id_t, const Block *>> *blocks) {
+    return kSuccess;
+}
+
+int BlockCacheManager::pick_writeback(uint64_t now_ms, size_t max_blocks,
+                                      std::vector<std::pair<blk_id_t, const Block *>> *blocks) {
+    return kSuccess;
+}
+
+int BlockCacheManager::redirty(const std::vector<std::pair<blk_id_t, const Block *>> &blocks) {
+    return kSuccess;
+}
+
+uint64_t BlockCacheManager::dirty_blocks() const {
+    return 0;
+}
+
+bool BlockCacheManager::over_dirty_ratio() const {
+    return false;
+}
+
+int BlockCacheManager::resize(uint64_t cache_size) {
+    return kSuccess;
+}
+
+uint64_t BlockCacheManager::size() const {
+    return 0;
+}
+
+int BlockCacheManager::remove(blk_id_t block_id) {
+    return kSuccess;
+}
+
+int BlockCacheManager::sync(blk_id_t block_id) {
     return kSuccess;
 }
 
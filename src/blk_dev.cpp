@@ -1,87 +1,531 @@
 #include "blk_dev.h"
 
-#include <fcntl.h>
-#include <unistd.h>
+#include <limits.h>
 
 #include "lru_cache.h"
 
 namespace sbfs {
-BlockDevice::BlockDevice(const char *path, const uint64_t size) : blk_cache_mgr_(kBlockCacheSize, this) {
+BlockDevice::BlockDevice(const char *path, const uint64_t size, const DeviceOptions &options)
+    : blk_cache_mgr_(options.cache_size, this, options.cache_policy, options.cache_hugetlb, options.cache_max_size),
+      engine_(nullptr),
+      journal_(nullptr),
+      num_log_blocks_(0),
+      tx_depth_(0),
+      tx_thread_(std::thread::id()),
+      owner_(kNoOwner),
+      tx_aborted_(false),
+      gc_flushing_(false),
+      gc_last_group_(0),
+      wb_stop_(false),
+      ra_stop_(false),
+      pressure_monitor_(options.pressure_monitor),
+      cache_target_(options.cache_size),
+      direct_io_threshold_(options.direct_io_threshold) {
     rt_assert(size % kBlockSize == 0, "size must be multiple of kBlockSize");
     DLOG(INFO) << "create BlockDevice with size " << size;
-    fd_ = open(path, O_DIRECT | O_RDWR | O_NOATIME | O_CREAT, 0644);
-
-    if (fd_ < 0) {
-        DLOG(WARNING) << "open " << path << " failed";
-        return;
-    }
-
-    if (ftruncate(fd_, size) < 0) {
-        DLOG(WARNING) << "ftruncate " << path << " failed";
-        return;
+    backend_ = StorageBackend::create(options.backend, path, size);
+    if (backend_ == nullptr) {
+        LOG(FATAL) << "create storage backend of " << path << " failed";
     }
 
     num_data_blocks_ = size / kBlockSize;
+
+    engine_ = new IOEngine(backend_, options.io_uring, options.queue_depth);
+#ifdef BLOCK_CACHE
+    engine_->register_buffers(blk_cache_mgr_.arena().base(), blk_cache_mgr_.size());
+#endif
 }
 
 BlockDevice::~BlockDevice() {
-    close(fd_);
+    stop_pressure_monitor();
+    stop_writeback();
+    stop_readahead();
+    /* prefetch completions may write back evicted blocks through the journal. */
+    engine_->drain();
+    delete journal_;
+    delete engine_;
+    delete backend_;
 }
 
 int BlockDevice::read(blk_id_t block_id, Block *buf) {
     DLOG(INFO) << "read block " << block_id << " to " << buf;
     rt_assert(block_id < num_data_blocks_, "block_id out of range");
     rt_assert(buf != nullptr, "buf is nullptr");
+    /*
+     * a cache hit doesn't need the device lock, the cache shard is locked by itself.
+     * not in a transaction of this thread, the block may be in tx_blocks_.
+     */
+    if (!in_tx() && blk_cache_mgr_.peek(block_id, buf) == kSuccess) {
+        return kSuccess;
+    }
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
 
+    if (in_tx()) {
+        auto it = tx_blocks_.find(block_id);
+        if (it != tx_blocks_.end()) {
+            memcpy(buf, &it->second, sizeof(Block));
+            return kSuccess;
+        }
+    }
+    wait_prefetch(block_id);
     if (blk_cache_mgr_.get(block_id, buf) == kFail) {
-        if (pread(fd_, buf, kBlockSize, block_id * kBlockSize) != kBlockSize) {
-            DLOG(WARNING) << "pread " << block_id << " failed " << strerror(errno);
+        if (read_from_disk(block_id, buf) != kSuccess) {
             return kFail;
         }
-        blk_cache_mgr_.upsert(block_id, buf);
+        blk_cache_mgr_.fill(block_id, buf);
     }
     return kSuccess;
 }
 
 int BlockDevice::write(blk_id_t block_id, const Block *buf) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
     DLOG(INFO) << "write block " << block_id << " from " << buf;
     rt_assert(block_id < num_data_blocks_, "block_id out of range");
     rt_assert(buf != nullptr, "buf is nullptr");
 
-    if (blk_cache_mgr_.upsert(block_id, buf) == kFail) {
+    if (in_tx()) {
+        memcpy(&tx_blocks_[block_id], buf, sizeof(Block));
+        return kSuccess;
+    }
+    prefetching_.erase(block_id);
+    if (blk_cache_mgr_.upsert(block_id, buf, false, owner_) == kFail) {
         DLOG(WARNING) << "upsert " << block_id << " failed";
         return kFail;
     }
+    add_meta(block_id);
+    if (blk_cache_mgr_.over_dirty_ratio()) {
+        /* don't wait for the next period, or eviction will soon pay for synchronous writeback. */
+        wb_cv_.notify_one();
+    }
+    return kSuccess;
+}
+
+int BlockDevice::read_blocks(const std::vector<std::pair<blk_id_t, Block *>> &blocks) {
+    DLOG(INFO) << "read " << blocks.size() << " blocks";
+    /* cache hits first without the device lock, see read. */
+    std::vector<std::pair<blk_id_t, Block *>> rest;
+    bool tx = in_tx();
+    if (!tx) {
+        for (auto &[block_id, buf] : blocks) {
+            if (blk_cache_mgr_.peek(block_id, buf) == kFail) {
+                rest.emplace_back(block_id, buf);
+            }
+        }
+        if (rest.empty()) {
+            return kSuccess;
+        }
+    }
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    std::vector<std::pair<blk_id_t, Block *>> missed;
+    for (auto &[block_id, buf] : tx ? blocks : rest) {
+        rt_assert(block_id < num_data_blocks_, "block_id out of range");
+        if (tx && tx_blocks_.find(block_id) != tx_blocks_.end()) {
+            memcpy(buf, &tx_blocks_[block_id], sizeof(Block));
+            continue;
+        }
+        wait_prefetch(block_id);
+        if (blk_cache_mgr_.get(block_id, buf) == kFail) {
+            missed.emplace_back(block_id, buf);
+        }
+    }
+    if (missed.empty()) {
+        return kSuccess;
+    }
+    if (read_runs(missed) != kSuccess) {
+        return kFail;
+    }
+    for (auto &[block_id, buf] : missed) {
+        blk_cache_mgr_.fill(block_id, buf);
+    }
+    return kSuccess;
+}
+
+int BlockDevice::write_blocks(const std::vector<std::pair<blk_id_t, const Block *>> &blocks) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    DLOG(INFO) << "write " << blocks.size() << " blocks";
+    if (in_tx()) {
+        for (auto &[block_id, buf] : blocks) {
+            memcpy(&tx_blocks_[block_id], buf, sizeof(Block));
+        }
+        return kSuccess;
+    }
+    std::vector<std::pair<blk_id_t, const Block *>> missed;
+    for (auto &[block_id, buf] : blocks) {
+        rt_assert(block_id < num_data_blocks_, "block_id out of range");
+#ifdef BLOCK_CACHE
+        /* whole blocks, so missed ones are installed dirty without reading them, see write. */
+        prefetching_.erase(block_id);
+        if (blk_cache_mgr_.upsert(block_id, buf, false, owner_) == kFail) {
+            missed.emplace_back(block_id, buf);
+        }
+#else
+        missed.emplace_back(block_id, buf);
+#endif
+    }
+    if (blk_cache_mgr_.over_dirty_ratio()) {
+        wb_cv_.notify_one();
+    }
+    if (missed.empty()) {
+        return kSuccess;
+    }
+    return write_runs(missed);
+}
+
+/* the part of block "i" of a range from "offset" of the first block, at "pos" of the buffer. */
+static void range_part(size_t i, uint32_t offset, uint32_t len, uint32_t *from, uint32_t *pos, uint32_t *n) {
+    *from = i == 0 ? offset : 0;
+    *pos = i == 0 ? 0 : i * kBlockSize - offset;
+    *n = std::min<uint32_t>(kBlockSize - *from, len - *pos);
+}
+
+int BlockDevice::read_range(const std::vector<blk_id_t> &block_ids, uint32_t offset, uint8_t *buf, uint32_t len) {
+    DLOG(INFO) << "read " << len << " bytes of " << block_ids.size() << " blocks";
+    uint32_t from, pos, n;
+    /* cache hits first without the device lock, see read_blocks. */
+    std::vector<size_t> rest;
+    for (size_t i = 0; i < block_ids.size(); ++i) {
+        range_part(i, offset, len, &from, &pos, &n);
+        if (in_tx() || blk_cache_mgr_.peek(block_ids[i], buf + pos, from, n) == kFail) {
+            rest.push_back(i);
+        }
+    }
+    if (rest.empty()) {
+        return kSuccess;
+    }
+    /* aligned buffers for the missed ones, they may be read from disk. */
+    std::vector<Block> data(rest.size());
+    std::vector<std::pair<blk_id_t, Block *>> missed;
+    missed.reserve(rest.size());
+    for (size_t k = 0; k < rest.size(); ++k) {
+        missed.emplace_back(block_ids[rest[k]], &data[k]);
+    }
+    if (read_blocks(missed) != kSuccess) {
+        return kFail;
+    }
+    for (size_t k = 0; k < rest.size(); ++k) {
+        range_part(rest[k], offset, len, &from, &pos, &n);
+        memcpy(buf + pos, data[k].data + from, n);
+    }
+    return kSuccess;
+}
+
+int BlockDevice::write_range(const std::vector<blk_id_t> &block_ids, uint32_t offset, const uint8_t *buf,
+                             uint32_t len) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    DLOG(INFO) << "write " << len << " bytes of " << block_ids.size() << " blocks";
+    uint32_t from, pos, n;
+    std::vector<size_t> rest;
+    for (size_t i = 0; i < block_ids.size(); ++i) {
+        rt_assert(block_ids[i] < num_data_blocks_, "block_id out of range");
+        range_part(i, offset, len, &from, &pos, &n);
+        if (!in_tx()) {
+            if (n < kBlockSize) {
+                wait_prefetch(block_ids[i]);
+            }
+            prefetching_.erase(block_ids[i]);
+            if (blk_cache_mgr_.upsert(block_ids[i], buf + pos, from, n, owner_) == kSuccess) {
+                continue;
+            }
+        }
+        rest.push_back(i);
+    }
+    if (blk_cache_mgr_.over_dirty_ratio()) {
+        wb_cv_.notify_one();
+    }
+    if (rest.empty()) {
+        return kSuccess;
+    }
+    /* read-modify-write copies of the rest, the partial ones are read first. */
+    std::vector<Block> data(rest.size());
+    std::vector<std::pair<blk_id_t, Block *>> partial;
+    for (size_t k = 0; k < rest.size(); ++k) {
+        range_part(rest[k], offset, len, &from, &pos, &n);
+        if (n < kBlockSize) {
+            partial.emplace_back(block_ids[rest[k]], &data[k]);
+        }
+    }
+    if (!partial.empty() && read_blocks(partial) != kSuccess) {
+        return kFail;
+    }
+    std::vector<std::pair<blk_id_t, const Block *>> blocks;
+    blocks.reserve(rest.size());
+    for (size_t k = 0; k < rest.size(); ++k) {
+        range_part(rest[k], offset, len, &from, &pos, &n);
+        memcpy(data[k].data + from, buf + pos, n);
+        blocks.emplace_back(block_ids[rest[k]], &data[k]);
+    }
+    return write_blocks(blocks);
+}
+
+int BlockDevice::read_direct(const std::vector<std::pair<blk_id_t, Block *>> &blocks) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    DLOG(INFO) << "read " << blocks.size() << " blocks direct";
+    if (in_tx()) {
+        return read_blocks(blocks);
+    }
+    /* the disk is up to date once the dirty ones are written back. */
+    std::vector<blk_id_t> block_ids;
+    block_ids.reserve(blocks.size());
+    for (auto &[block_id, buf] : blocks) {
+        rt_assert(block_id < num_data_blocks_, "block_id out of range");
+        block_ids.push_back(block_id);
+    }
+    std::vector<std::pair<blk_id_t, const Block *>> dirty;
+    blk_cache_mgr_.take_dirty(block_ids, &dirty);
+    if (!dirty.empty() && write_runs(dirty) != kSuccess) {
+        blk_cache_mgr_.redirty(dirty);
+        return kFail;
+    }
+    auto runs = blocks;
+    Stats::add(kDirectReadBlocks, runs.size());
+    return read_runs(runs);
+}
+
+int BlockDevice::write_direct(const std::vector<std::pair<blk_id_t, const Block *>> &blocks) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    DLOG(INFO) << "write " << blocks.size() << " blocks direct";
+    if (in_tx()) {
+        return write_blocks(blocks);
+    }
+    /* cached copies are stale after the write, dirty ones are dropped without a write back. */
+    std::vector<blk_id_t> block_ids;
+    block_ids.reserve(blocks.size());
+    for (auto &[block_id, buf] : blocks) {
+        rt_assert(block_id < num_data_blocks_, "block_id out of range");
+        block_ids.push_back(block_id);
+    }
+    std::vector<std::pair<blk_id_t, const Block *>> dirty;
+    blk_cache_mgr_.take_dirty(block_ids, &dirty);
+    for (auto block_id : block_ids) {
+        if (blk_cache_mgr_.contains(block_id)) {
+            blk_cache_mgr_.remove(block_id);
+        }
+    }
+    auto runs = blocks;
+    Stats::add(kDirectWriteBlocks, runs.size());
+    return write_runs(runs);
+}
+
+int BlockDevice::pin(blk_id_t block_id, BlockRef *ref) {
+    rt_assert(block_id < num_data_blocks_, "block_id out of range");
+    ref->release();
+    /* locked until unpin, so that the flusher or a fsync never sees a half modified block. */
+    mtx_.lock();
+    ref->dev_ = this;
+    ref->block_id_ = block_id;
+    ref->dirty_ = false;
+    ref->cached_ = false;
+    if (in_tx()) {
+        /* modify the copy of the transaction, blocks left unchanged are dropped at commit. */
+        auto it = tx_blocks_.find(block_id);
+        if (it == tx_blocks_.end()) {
+            Block blk;
+            if (read(block_id, &blk) != kSuccess) {
+                unpin(ref);
+                return kFail;
+            }
+            it = tx_blocks_.emplace(block_id, blk).first;
+        }
+        ref->blk_ = &it->second;
+        return kSuccess;
+    }
+    wait_prefetch(block_id);
+    ref->blk_ = blk_cache_mgr_.pin(block_id);
+    if (ref->blk_ != nullptr) {
+        ref->cached_ = true;
+        return kSuccess;
+    }
+    ref->copy_.reset(new Block);
+    ref->blk_ = ref->copy_.get();
+    if (read(block_id, ref->blk_) != kSuccess) {
+        unpin(ref);
+        return kFail;
+    }
     return kSuccess;
 }
 
+void BlockDevice::unpin(BlockRef *ref) {
+    if (ref->cached_) {
+        blk_cache_mgr_.unpin(ref->block_id_, ref->dirty_, owner_);
+        if (ref->dirty_) {
+            add_meta(ref->block_id_);
+            prefetching_.erase(ref->block_id_);
+            if (blk_cache_mgr_.over_dirty_ratio()) {
+                wb_cv_.notify_one();
+            }
+        }
+    } else if (ref->copy_ != nullptr && ref->dirty_ && write(ref->block_id_, ref->blk_) != kSuccess) {
+        LOG(WARNING) << "write back pinned copy of " << ref->block_id_ << " failed";
+    }
+    ref->copy_.reset();
+    ref->dev_ = nullptr;
+    ref->blk_ = nullptr;
+    mtx_.unlock();
+}
+
+int BlockDevice::read_runs(std::vector<std::pair<blk_id_t, Block *>> &blocks) const {
+    std::sort(blocks.begin(), blocks.end());
+    std::vector<iovec> iov;
+    for (size_t i = 0, j; i < blocks.size(); i = j) {
+        iov.clear();
+        for (j = i; j < blocks.size() && j - i < IOV_MAX && blocks[j].first == blocks[i].first + (j - i); ++j) {
+            iov.push_back(iovec{ blocks[j].second, kBlockSize });
+        }
+        DLOG(INFO) << "read run of " << iov.size() << " blocks from " << blocks[i].first;
+        if (engine_->readv(blocks[i].first, iov.data(), iov.size()) != kSuccess) {
+            return kFail;
+        }
+    }
+    return kSuccess;
+}
+
+int BlockDevice::write_runs(std::vector<std::pair<blk_id_t, const Block *>> &blocks) const {
+    std::sort(blocks.begin(), blocks.end());
+    std::vector<iovec> iov;
+    for (size_t i = 0, j; i < blocks.size(); i = j) {
+        iov.clear();
+        for (j = i; j < blocks.size() && j - i < IOV_MAX && blocks[j].first == blocks[i].first + (j - i); ++j) {
+            if (journal_ != nullptr && journal_->before_home_write(blocks[j].first) != kSuccess) {
+                return kFail;
+            }
+            prefetching_.erase(blocks[j].first);
+            iov.push_back(iovec{ const_cast<Block *>(blocks[j].second), kBlockSize });
+        }
+        DLOG(INFO) << "write run of " << iov.size() << " blocks to " << blocks[i].first;
+        if (engine_->writev(blocks[i].first, iov.data(), iov.size()) != kSuccess) {
+            return kFail;
+        }
+    }
+    return kSuccess;
+}
+
+void BlockDevice::wait_prefetch(blk_id_t block_id) {
+    if (prefetching_.find(block_id) != prefetching_.end()) {
+        engine_->drain();
+    }
+    install_prefetched();
+}
+
+void BlockDevice::install_prefetched() {
+    for (auto &[block_id, blk] : prefetched_) {
+        /* not in prefetching_ any more if it was written meanwhile, then blk may be stale. */
+        if (prefetching_.erase(block_id) > 0) {
+            blk_cache_mgr_.fill(block_id, blk.get(), true);
+        }
+    }
+    prefetched_.clear();
+}
+
 int BlockDevice::write_to_disk(blk_id_t block_id, const Block *buf) const {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
     rt_assert(block_id < num_data_blocks_, "block_id out of range");
     rt_assert(buf != nullptr, "buf is nullptr");
     DLOG(INFO) << "write block to disk " << block_id << " from " << buf;
-    if (pwrite(fd_, buf, kBlockSize, block_id * kBlockSize) != kBlockSize) {
-        DLOG(WARNING) << "pwrite " << block_id << " failed " << strerror(errno);
+    if (journal_ != nullptr && journal_->before_home_write(block_id) != kSuccess) {
         return kFail;
     }
-    return kSuccess;
+    prefetching_.erase(block_id);
+    return engine_->write(block_id, buf);
 }
 
 int BlockDevice::read_from_disk(blk_id_t block_id, Block *buf) const {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
     rt_assert(block_id < num_data_blocks_, "block_id out of range");
     DLOG(INFO) << "read block from disk " << block_id << " to " << buf;
-    if (pread(fd_, buf, kBlockSize, block_id * kBlockSize) != kBlockSize) {
-        DLOG(WARNING) << "pread " << block_id << " failed " << strerror(errno);
+    return engine_->read(block_id, buf);
+}
+
+int BlockDevice::read_async(blk_id_t block_id, Block *buf, io_callback_t cb) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    rt_assert(block_id < num_data_blocks_, "block_id out of range");
+    return engine_->read_async(block_id, buf, std::move(cb));
+}
+
+int BlockDevice::write_async(blk_id_t block_id, const Block *buf, io_callback_t cb) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    rt_assert(block_id < num_data_blocks_, "block_id out of range");
+    if (journal_ != nullptr && journal_->before_home_write(block_id) != kSuccess) {
         return kFail;
     }
-    return kSuccess;
+    prefetching_.erase(block_id);
+    return engine_->write_async(block_id, buf, std::move(cb));
+}
+
+int BlockDevice::poll(bool wait) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    int ret = wait ? engine_->drain() : engine_->poll();
+    install_prefetched();
+    return ret;
+}
+
+int BlockDevice::prefetch(const std::vector<blk_id_t> &block_ids) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    install_prefetched();
+    std::vector<blk_id_t> missed;
+    for (auto block_id : block_ids) {
+        rt_assert(block_id < num_data_blocks_, "block_id out of range");
+        if (blk_cache_mgr_.contains(block_id) || prefetching_.find(block_id) != prefetching_.end() ||
+            (in_tx() && tx_blocks_.find(block_id) != tx_blocks_.end())) {
+            continue;
+        }
+        missed.push_back(block_id);
+    }
+    if (missed.empty()) {
+        return kSuccess;
+    }
+    DLOG(INFO) << "prefetch " << missed.size() << " blocks from " << missed.front();
+    if (!engine_->is_async()) {
+        /* reading them here would block the reader, the readahead thread does it. */
+        {
+            std::lock_guard<std::mutex> guard(ra_mtx_);
+            if (ra_stop_ || ra_queue_.size() >= kReadaheadQueue) {
+                return kSuccess;
+            }
+            if (!ra_thread_.joinable()) {
+                ra_thread_ = std::thread(&BlockDevice::readahead_loop, this);
+            }
+            prefetching_.insert(missed.begin(), missed.end());
+            ra_queue_.push_back(std::move(missed));
+        }
+        ra_cv_.notify_one();
+        return kSuccess;
+    }
+    /* the buffers live until the last completion drops its reference. */
+    auto data = std::make_shared<std::vector<Block>>(missed.size());
+    for (size_t i = 0; i < missed.size(); ++i) {
+        blk_id_t block_id = missed[i];
+        Block *buf = &(*data)[i];
+        prefetching_.insert(block_id);
+        int ret = engine_->read_async(block_id, buf, [this, block_id, buf, data](int res) {
+            /* it may complete inside any I/O wait, so it's only queued, see prefetched_. */
+            if (res == kSuccess) {
+                prefetched_.emplace_back(block_id, std::shared_ptr<const Block>(data, buf));
+            } else {
+                prefetching_.erase(block_id);
+            }
+        });
+        if (ret != kSuccess) {
+            prefetching_.erase(block_id);
+            return kFail;
+        }
+    }
+    /* submit only, completions are reaped by later requests. */
+    return engine_->poll();
 }
 
 int BlockDevice::write_tx(const std::vector<blk_id_t> &block_ids, const std::vector<const Block *> &bufs) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
     rt_assert(block_ids.size() == bufs.size(), "block_ids and bufs size not match");
+    /* nothing is written if it fails, the caller rolls back, so a transaction is never torn. */
+    if (journal_ != nullptr && journal_->commit(block_ids, bufs) != kSuccess) {
+        LOG(WARNING) << "journal commit of " << block_ids.size() << " blocks failed";
+        return kFail;
+    }
+    /* committed, home locations are written back by cache or checkpoint later. */
     for (size_t i = 0; i < block_ids.size(); ++i) {
         rt_assert(block_ids[i] < num_data_blocks_, "block_id out of range");
-        /* TODO: transaction */
-        if (write(block_ids[i], bufs[i]) == kFail) {
+        prefetching_.erase(block_ids[i]);
+        if (blk_cache_mgr_.upsert(block_ids[i], bufs[i]) == kFail) {
             DLOG(WARNING) << "write " << block_ids[i] << " failed";
             return kFail;
         }
@@ -89,14 +533,420 @@ int BlockDevice::write_tx(const std::vector<blk_id_t> &block_ids, const std::vec
     return kSuccess;
 }
 
+void BlockDevice::begin_tx() {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    /* transactions are opened under the vfs lock, so never by two threads at once. */
+    rt_assert(tx_depth_ == 0 || tx_thread_ == std::this_thread::get_id(), "transactions of two threads");
+    if (tx_depth_ == 0) {
+        tx_thread_ = std::this_thread::get_id();
+    }
+    ++tx_depth_;
+}
+
+int BlockDevice::commit_tx() {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    rt_assert(tx_depth_ > 0, "commit_tx without begin_tx");
+    if (--tx_depth_ > 0) {
+        return kSuccess;
+    }
+    if (tx_aborted_) {
+        rollback_tx();
+        return kFail;
+    }
+    tx_undo_.clear();
+    if (tx_blocks_.empty()) {
+        return kSuccess;
+    }
+    std::vector<blk_id_t> block_ids;
+    std::vector<const Block *> bufs;
+    Block cur;
+    for (auto &[block_id, blk] : tx_blocks_) {
+        /* pinned but not modified (still the same as cached), no need to log it. */
+        if (blk_cache_mgr_.contains(block_id) && blk_cache_mgr_.get(block_id, &cur) == kSuccess &&
+            memcmp(&cur, &blk, sizeof(Block)) == 0) {
+            continue;
+        }
+        block_ids.push_back(block_id);
+        bufs.push_back(&blk);
+    }
+    if (block_ids.empty()) {
+        tx_blocks_.clear();
+        return kSuccess;
+    }
+    DLOG(INFO) << "commit transaction of " << block_ids.size() << " blocks";
+    if (write_tx(block_ids, bufs) != kSuccess) {
+        rollback_tx();
+        return kFail;
+    }
+    tx_blocks_.clear();
+    return kSuccess;
+}
+
+void BlockDevice::abort_tx() {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    rt_assert(tx_depth_ > 0, "abort_tx without begin_tx");
+    tx_aborted_ = true;
+    if (--tx_depth_ == 0) {
+        rollback_tx();
+    }
+}
+
+void BlockDevice::on_abort(std::function<void()> undo) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    if (in_tx()) {
+        tx_undo_.push_back(std::move(undo));
+    }
+}
+
+void BlockDevice::rollback_tx() {
+    DLOG(WARNING) << "abort transaction of " << tx_blocks_.size() << " blocks";
+    tx_blocks_.clear();
+    /* the undo actions may write (out of the transaction now), they see the blocks before it. */
+    auto undo = std::move(tx_undo_);
+    tx_undo_.clear();
+    tx_aborted_ = false;
+    for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+        (*it)();
+    }
+}
+
+int BlockDevice::init_journal(blk_id_t start_block, uint32_t num_blocks, bool format) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    rt_assert(start_block + num_blocks <= num_data_blocks_, "journal out of range");
+    if (num_blocks < 3) {
+        DLOG(WARNING) << "no journal";
+        return kSuccess;
+    }
+    num_log_blocks_ = num_blocks;
+    journal_ = new Journal(this, start_block, num_blocks);
+    return format ? journal_->format() : journal_->recover();
+}
+
+int BlockDevice::fsync(uint32_t owner, const std::vector<blk_id_t> &meta_ids) {
+    LatencyTimer timer(kFsyncLatency);
+    Stats::add(kFsyncCalls);
+    SyncRequest req{ owner, &meta_ids, kFail, false, false };
+    std::unique_lock<std::mutex> lock(gc_mtx_);
+    gc_queue_.push_back(&req);
+    if (gc_flushing_) {
+        /* join the next group, its leader (or the current one) will wake us up. */
+        gc_cv_.notify_all();
+        gc_cv_.wait(lock, [&] { return req.done || req.leader; });
+        if (req.done) {
+            return req.result;
+        }
+    }
+    gc_flushing_ = true;
+    if (gc_last_group_ > 1) {
+        /* others were syncing recently, give them a chance to join this group. */
+        gc_cv_.wait_for(lock, std::chrono::microseconds(kGroupCommitWindowUs),
+                        [&] { return gc_queue_.size() >= gc_last_group_; });
+    }
+    std::vector<SyncRequest *> group;
+    group.swap(gc_queue_);
+    gc_last_group_ = group.size();
+    lock.unlock();
+
+    int ret = commit_group(group);
+
+    lock.lock();
+    for (auto r : group) {
+        r->result = ret;
+        r->done = true;
+    }
+    /* callers arrived during the flush form the next group, hand it over to one of them. */
+    if (!gc_queue_.empty()) {
+        gc_queue_.front()->leader = true;
+    } else {
+        gc_flushing_ = false;
+    }
+    gc_cv_.notify_all();
+    return req.result;
+}
+
+int BlockDevice::commit_group(const std::vector<SyncRequest *> &group) {
+    Stats::add(kFsyncGroups);
+    std::vector<blk_id_t> meta_ids;
+    {
+        std::lock_guard<std::recursive_mutex> guard(mtx_);
+        std::set<blk_id_t> owner_meta;
+        std::vector<std::pair<uint32_t, std::set<blk_id_t>>> taken_meta;
+        for (auto r : group) {
+            meta_ids.insert(meta_ids.end(), r->meta_ids->begin(), r->meta_ids->end());
+            auto it = owner_meta_.find(r->owner);
+            if (it != owner_meta_.end()) {
+                owner_meta.insert(it->second.begin(), it->second.end());
+                taken_meta.emplace_back(it->first, std::move(it->second));
+                owner_meta_.erase(it);
+            }
+        }
+        /* only the dirty blocks of the owners are visited, a taken owner has none left for a duplicate. */
+        std::vector<std::pair<blk_id_t, const Block *>> dirty;
+        for (auto r : group) {
+            blk_cache_mgr_.take_dirty(r->owner, &dirty);
+        }
+        std::vector<Block> in_place;
+        if (journal_ == nullptr || meta_ids.size() + owner_meta.size() <= journal_->max_tx_blocks()) {
+            meta_ids.insert(meta_ids.end(), owner_meta.begin(), owner_meta.end());
+        } else {
+            /* too many for one journal transaction, they are written in place, the commit below flushes them. */
+            for (auto &d : dirty) {
+                owner_meta.erase(d.first);
+            }
+            in_place.resize(owner_meta.size());
+            size_t n = 0;
+            for (blk_id_t block_id : owner_meta) {
+                /* an evicted block is on disk already. */
+                if (blk_cache_mgr_.get(block_id, &in_place[n]) == kSuccess) {
+                    dirty.emplace_back(block_id, &in_place[n++]);
+                }
+            }
+        }
+        std::sort(meta_ids.begin(), meta_ids.end());
+        meta_ids.erase(std::unique(meta_ids.begin(), meta_ids.end()), meta_ids.end());
+        DLOG(INFO) << "group commit of " << group.size() << " callers, " << dirty.size() << " data blocks, "
+                   << meta_ids.size() << " meta blocks";
+        /* on failure the blocks are dirty again and the owners keep their metadata, a later fsync retries them. */
+        auto undo = [&]() {
+            blk_cache_mgr_.redirty(dirty);
+            for (auto &[owner, ids] : taken_meta) {
+                owner_meta_[owner].insert(ids.begin(), ids.end());
+            }
+            return kFail;
+        };
+        if (write_runs(dirty) != kSuccess) {
+            return undo();
+        }
+        if (!meta_ids.empty()) {
+            /*
+             * the journal commit flushes the data written above too.
+             * bypass tx_blocks_, a transaction of another thread may be open, and it must stay atomic.
+             */
+            std::vector<Block> meta(meta_ids.size());
+            std::vector<const Block *> bufs;
+            for (size_t i = 0; i < meta_ids.size(); ++i) {
+                if (blk_cache_mgr_.get(meta_ids[i], &meta[i]) == kFail &&
+                    read_from_disk(meta_ids[i], &meta[i]) != kSuccess) {
+                    return undo();
+                }
+                bufs.push_back(&meta[i]);
+            }
+            return write_tx(meta_ids, bufs) == kSuccess ? kSuccess : undo();
+        }
+        return flush() == kSuccess ? kSuccess : undo();
+    }
+}
+
+void BlockDevice::start_writeback(std::function<void()> hook) {
+    std::lock_guard<std::mutex> guard(wb_mtx_);
+    if (wb_thread_.joinable()) {
+        return;
+    }
+    wb_stop_ = false;
+    wb_hook_ = std::move(hook);
+    wb_thread_ = std::thread(&BlockDevice::writeback_loop, this);
+    DLOG(INFO) << "background writeback started";
+}
+
+void BlockDevice::stop_writeback() {
+    {
+        std::lock_guard<std::mutex> guard(wb_mtx_);
+        wb_stop_ = true;
+    }
+    wb_cv_.notify_one();
+    if (wb_thread_.joinable()) {
+        wb_thread_.join();
+    }
+}
+
+void BlockDevice::stop_readahead() {
+    {
+        std::lock_guard<std::mutex> guard(ra_mtx_);
+        ra_stop_ = true;
+    }
+    ra_cv_.notify_one();
+    if (ra_thread_.joinable()) {
+        ra_thread_.join();
+    }
+}
+
+void BlockDevice::readahead_loop() {
+    std::unique_lock<std::mutex> lock(ra_mtx_);
+    while (true) {
+        ra_cv_.wait(lock, [this] { return ra_stop_ || !ra_queue_.empty(); });
+        if (ra_stop_) {
+            break;
+        }
+        auto block_ids = std::move(ra_queue_.front());
+        ra_queue_.pop_front();
+        lock.unlock();
+        auto data = std::make_shared<std::vector<Block>>(block_ids.size());
+        std::vector<std::pair<blk_id_t, Block *>> blocks;
+        for (size_t i = 0; i < block_ids.size(); ++i) {
+            blocks.emplace_back(block_ids[i], &(*data)[i]);
+        }
+        int res = read_runs(blocks);
+        {
+            /* like an async completion, queued for the next reader to install. */
+            std::lock_guard<std::recursive_mutex> guard(mtx_);
+            for (auto &[block_id, buf] : blocks) {
+                if (res == kSuccess) {
+                    prefetched_.emplace_back(block_id, std::shared_ptr<const Block>(data, buf));
+                } else {
+                    prefetching_.erase(block_id);
+                }
+            }
+        }
+        if (res != kSuccess) {
+            DLOG(WARNING) << "readahead of " << blocks.size() << " blocks failed";
+        }
+        lock.lock();
+    }
+}
+
+void BlockDevice::writeback_loop() {
+    std::unique_lock<std::mutex> lock(wb_mtx_);
+    uint64_t last_dump = now_ms();
+    while (!wb_stop_) {
+        wb_cv_.wait_for(lock, std::chrono::milliseconds(kWritebackIntervalMs));
+        lock.unlock();
+        if (wb_hook_) {
+            wb_hook_();
+        }
+        if (now_ms() - last_dump >= kStatsDumpIntervalMs) {
+            LOG(INFO) << "sbfs stats\n" << stats();
+            last_dump = now_ms();
+        }
+        /* in batches, so that the device lock is released between them. */
+        std::vector<std::pair<blk_id_t, const Block *>> blocks;
+        size_t written = 0, left = 0;
+        do {
+            std::lock_guard<std::recursive_mutex> guard(mtx_);
+            LatencyTimer timer(kWritebackLatency);
+            blocks.clear();
+            blk_cache_mgr_.pick_writeback(now_ms(), kWritebackBatchBlocks, &blocks);
+            if (!blocks.empty() && write_runs(blocks) != kSuccess) {
+                /* dirty again, so that the next round or a fsync retries them (and reports the failure). */
+                DLOG(WARNING) << "background writeback of " << blocks.size() << " blocks failed";
+                blk_cache_mgr_.redirty(blocks);
+                break;
+            }
+            written += blocks.size();
+            Stats::add(kWritebackBlocks, blocks.size());
+            left = blk_cache_mgr_.dirty_blocks();
+        } while (blocks.size() == kWritebackBatchBlocks);
+        if (written > 0) {
+            DLOG(INFO) << "background writeback of " << written << " blocks, " << left << " dirty left";
+        }
+        lock.lock();
+    }
+}
+
+int BlockDevice::resize_cache(uint64_t size) {
+    /* no block is pinned while the device is locked by us. */
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    cache_target_ = size;
+    return resize_cache_locked(size);
+}
+
+int BlockDevice::resize_cache_locked(uint64_t size) {
+#ifdef BLOCK_CACHE
+    /*
+     * registered memory is pinned, its pages are kept by io_uring after the cache drops them,
+     * so register the new size again, with nothing in flight.
+     */
+    engine_->drain();
+    engine_->unregister_buffers();
+    int ret = blk_cache_mgr_.resize(size);
+    engine_->register_buffers(blk_cache_mgr_.arena().base(), blk_cache_mgr_.size());
+    return ret;
+#else
+    return blk_cache_mgr_.resize(size);
+#endif
+}
+
+uint64_t BlockDevice::cache_size() const {
+    return blk_cache_mgr_.size() * kBlockSize;
+}
+
+std::string BlockDevice::stats() const {
+    std::ostringstream out;
+    out << Stats::report();
+    out << "cache_size_blocks " << blk_cache_mgr_.size() << "\n";
+    out << "cache_target_blocks " << cache_target_ / kBlockSize << "\n";
+    out << "cache_dirty_blocks " << blk_cache_mgr_.dirty_blocks() << "\n";
+    return out.str();
+}
+
+void BlockDevice::start_pressure_monitor() {
+    if (pressure_monitor_) {
+        pressure_.start([this](bool pressure) { on_pressure(pressure); });
+    }
+}
+
+void BlockDevice::stop_pressure_monitor() {
+    pressure_.stop();
+}
+
+void BlockDevice::on_pressure(bool pressure) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    uint64_t size = cache_size();
+    uint64_t target = size;
+    if (pressure) {
+        target = std::max(std::min(size, kCacheMinSize), size / 100 * (100 - kCacheShrinkPercent));
+    } else if (size < cache_target_) {
+        target = std::min(cache_target_, size + cache_target_ / 100 * kCacheGrowPercent);
+    }
+    if (target == size) {
+        return;
+    }
+    LOG(INFO) << (pressure ? "memory pressure, shrink" : "memory pressure calmed, grow") << " block cache from "
+              << size / MB(1) << "MB to " << target / MB(1) << "MB";
+    resize_cache_locked(target);
+}
+
+int BlockDevice::flush() {
+    return engine_->flush();
+}
+
 int BlockDevice::sync(blk_id_t block_id) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
     rt_assert(block_id < num_data_blocks_, "block_id out of range");
 
     return blk_cache_mgr_.sync(block_id);
 }
 
 int BlockDevice::sync_all() {
-    return blk_cache_mgr_.sync_all();
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    if (journal_ != nullptr && journal_->checkpoint() != kSuccess) {
+        return kFail;
+    }
+    std::vector<std::pair<blk_id_t, const Block *>> dirty;
+    blk_cache_mgr_.take_all_dirty(&dirty);
+    DLOG(INFO) << "sync all of " << dirty.size() << " dirty blocks";
+    if (write_runs(dirty) != kSuccess) {
+        blk_cache_mgr_.redirty(dirty);
+        return kFail;
+    }
+    if (flush() != kSuccess) {
+        return kFail;
+    }
+    /* all of them are on disk. */
+    owner_meta_.clear();
+    return kSuccess;
+}
+
+void BlockDevice::add_meta(blk_id_t block_id) {
+    if (owner_ != kNoOwner && !in_tx()) {
+        owner_meta_[owner_].insert(block_id);
+    }
+}
+
+uint32_t BlockDevice::set_owner(uint32_t owner) {
+    std::lock_guard<std::recursive_mutex> guard(mtx_);
+    uint32_t prev = owner_;
+    owner_ = owner;
+    return prev;
 }
 
 };  // namespace sbfs
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "block_map.h"
+
+namespace sbfs {
+bool BlockMap::File::find(uint32_t lid, Run *run) const {
+    /* the last run starting at or before lid. */
+    auto it = std::upper_bound(runs_.begin(), runs_.end(), lid, [](uint32_t l, const Run &r) { return l < r.lblk; });
+    if (it == runs_.begin() || lid - (it - 1)->lblk >= (it - 1)->len) {
+        return false;
+    }
+    *run = *(it - 1);
+    return true;
+}
+
+void BlockMap::File::insert(const Run &run) {
+    if (runs_.size() >= kBlockMapRuns) {
+        runs_.clear();
+    }
+    auto first = std::upper_bound(runs_.begin(), runs_.end(), run.lblk,
+                                  [](uint32_t l, const Run &r) { return l < r.lblk; });
+    if (first != runs_.begin() && (first - 1)->lblk + (first - 1)->len > run.lblk) {
+        --first;
+    }
+    auto last = first;
+    while (last != runs_.end() && last->lblk < run.lblk + run.len) {
+        ++last;
+    }
+    runs_.insert(runs_.erase(first, last), run);
+}
+
+void BlockMap::File::truncate(uint32_t lid) {
+    while (!runs_.empty() && runs_.back().lblk >= lid) {
+        runs_.pop_back();
+    }
+    if (!runs_.empty() && runs_.back().lblk + runs_.back().len > lid) {
+        runs_.back().len = lid - runs_.back().lblk;
+    }
+}
+
+void BlockMap::open(uint32_t inode_id) {
+    ++files_[inode_id].refs;
+}
+
+void BlockMap::close(uint32_t inode_id) {
+    auto it = files_.find(inode_id);
+    if (it != files_.end() && --it->second.refs == 0) {
+        files_.erase(it);
+    }
+}
+
+BlockMap::File *BlockMap::get(uint32_t inode_id) {
+    auto it = files_.find(inode_id);
+    return it == files_.end() ? nullptr : &it->second.file;
+}
+
+void BlockMap::truncate(uint32_t inode_id, uint32_t lid) {
+    auto it = files_.find(inode_id);
+    if (it != files_.end()) {
+        it->second.file.truncate(lid);
+    }
+}
+}  // namespace sbfs
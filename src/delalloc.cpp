@@ -0,0 +1,57 @@
+#include "delalloc.h"
+
+namespace sbfs {
+DelayedAlloc::File *DelayedAlloc::find(uint32_t inode_id) {
+    auto it = files_.find(inode_id);
+    return it == files_.end() ? nullptr : &it->second;
+}
+
+DelayedAlloc::File *DelayedAlloc::get(uint32_t inode_id, uint32_t alloc_end) {
+    auto it = files_.find(inode_id);
+    if (it == files_.end()) {
+        it = files_.emplace(inode_id, File{ alloc_end, alloc_end, 0, now_ms(), {} }).first;
+    }
+    return &it->second;
+}
+
+Block *DelayedAlloc::block(File *file, uint32_t lid) {
+    auto &blk = file->blocks[lid];
+    if (!blk) {
+        blk = std::make_unique<Block>();
+        memset(blk.get(), 0, sizeof(Block));
+        ++buffered_;
+    }
+    return blk.get();
+}
+
+void DelayedAlloc::truncate(File *file, uint32_t lid) {
+    auto it = file->blocks.lower_bound(lid);
+    buffered_ -= std::distance(it, file->blocks.end());
+    file->blocks.erase(it, file->blocks.end());
+}
+
+void DelayedAlloc::reserve(File *file, uint32_t reserved) {
+    reserved_ = reserved_ - file->reserved + reserved;
+    file->reserved = reserved;
+}
+
+void DelayedAlloc::drop(uint32_t inode_id) {
+    auto it = files_.find(inode_id);
+    if (it == files_.end()) {
+        return;
+    }
+    reserved_ -= it->second.reserved;
+    buffered_ -= it->second.blocks.size();
+    files_.erase(it);
+}
+
+std::vector<uint32_t> DelayedAlloc::files(uint64_t expire_ms) const {
+    std::vector<uint32_t> ids;
+    for (auto &[id, file] : files_) {
+        if (expire_ms == 0 || file.since_ms < expire_ms) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+}  // namespace sbfs
@@ -24,39 +24,94 @@ constexpr uint32_t MAX_BLOCK_SIZE =
     INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT + INODE_INDIRECT_COUNT * INODE_INDIRECT_COUNT;
 constexpr uint32_t MAX_FILE_SIZE = min((uint64_t)UINT32_MAX, ((uint64_t)MAX_BLOCK_SIZE) * kBlockSize);
 
+static uint32_t data_blocks(uint32_t size) {
+    return (size + kBlockSize - 1) / kBlockSize;
+}
+
+/* entries of an extent tree node, right after its header. */
+static inline ExtentEntry *extent_entries(ExtentHeader *node) {
+    return (ExtentEntry *)(node + 1);
+}
+
+/* the last entry of "node" starting at or before logical block lid, the first one if none. */
+static inline uint16_t extent_search(ExtentHeader *node, uint32_t lid) {
+    auto begin = extent_entries(node), end = begin + node->entries;
+    auto it = upper_bound(begin, end, lid, [](uint32_t l, const ExtentEntry &e) { return l < e.lblk; });
+    return it == begin ? 0 : it - begin - 1;
+}
+
+void DiskInode::use_extents() {
+    rt_assert(size == 0, "only an empty inode switches to extents");
+    for (auto &id : direct) {
+        id = 0;
+    }
+    indirect1 = indirect2 = 0;
+    flags |= kInodeExtents;
+    auto root = extent_root();
+    root->magic = kExtentMagic;
+    root->max = kExtentRootEntries;
+}
+
+ExtentHeader *DiskInode::extent_leaf(uint32_t lid, BlockRef *ref, BlockDevice *dev) {
+    ExtentHeader *node = extent_root();
+    while (node->depth > 0 && node->entries > 0) {
+        blk_id_t child = extent_entries(node)[extent_search(node, lid)].pblk;
+        if (dev->pin(child, ref) != kSuccess) {
+            DLOG(WARNING) << "read extent node " << child << " failed";
+            return nullptr;
+        }
+        node = ref->as<ExtentHeader>();
+        if (node->magic != kExtentMagic) {
+            LOG(ERROR) << "bad extent node " << child;
+            return nullptr;
+        }
+    }
+    return node->depth == 0 ? node : nullptr;
+}
+
 blk_id_t DiskInode::block_id(uint32_t inner_id, BlockDevice *dev) {
+    if (extents()) {
+        BlockRef ref;
+        ExtentHeader *leaf = extent_leaf(inner_id, &ref, dev);
+        if (leaf == nullptr || leaf->entries == 0) {
+            return kFail;
+        }
+        auto &e = extent_entries(leaf)[extent_search(leaf, inner_id)];
+        if (inner_id < e.lblk || inner_id - e.lblk >= e.len) {
+            return kFail;
+        }
+        return e.pblk + (inner_id - e.lblk);
+    }
     if (inner_id >= MAX_BLOCK_SIZE) {
         // rt_assert(inner_id < MAX_BLOCK_SIZE, "inner_id out of range, max file size exceeded");
         return kFail;
     }
-    Block buf;
+    BlockRef ref;
     if (inner_id < INODE_DIRECT_COUNT) {
         return direct[inner_id];
     } else if (inner_id < INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT) {
         int idx = inner_id - INODE_DIRECT_COUNT;
-        if (dev->read(indirect1, &buf) != kSuccess) {
+        if (dev->pin(indirect1, &ref) != kSuccess) {
             DLOG(WARNING) << "read indirect1 block " << indirect1 << " failed";
             return kFail;
         }
-        auto p = (uint32_t *)(buf.data);
+        auto p = ref.as<uint32_t>();
         auto ret = p[idx];
         DLOG(WARNING) << "indirect1 block " << indirect1 << " offset " << idx << " ret " << ret;
         return ret;
     } else {
         int idx = inner_id - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT;
         int blk = idx / INODE_INDIRECT_COUNT;
-        if (dev->read(indirect2, &buf) != kSuccess) {
+        if (dev->pin(indirect2, &ref) != kSuccess) {
             DLOG(WARNING) << "read indirect2 block " << indirect2 << " failed";
             return kFail;
         }
-        auto data = (uint32_t *)buf.data;
-        auto blk_id = data[blk];
-        Block buf2;
-        if (dev->read(blk_id, &buf2) != kSuccess) {
+        auto blk_id = ref.as<uint32_t>()[blk];
+        if (dev->pin(blk_id, &ref) != kSuccess) {
             DLOG(WARNING) << "read second level of indirect2 block " << blk_id << " failed";
             return kFail;
         }
-        auto data2 = (uint32_t *)buf2.data;
+        auto data2 = ref.as<uint32_t>();
         auto ret_id = data2[idx % INODE_INDIRECT_COUNT];
         DLOG(WARNING) << "inner id" << inner_id << "indirect2" << indirect2 << " at offset\n\t " << blk << " indirect1 "
                       << blk_id << " at offset\n\t " << idx % INODE_INDIRECT_COUNT << " ret= " << ret_id;
@@ -66,18 +121,24 @@ blk_id_t DiskInode::block_id(uint32_t inner_id, BlockDevice *dev) {
     return kFail;
 }
 
-static uint32_t data_blocks(uint32_t size) {
-    return (size + kBlockSize - 1) / kBlockSize;
-}
 
 uint32_t DiskInode::total_blocks(uint32_t size) {
     rt_assert(size <= MAX_FILE_SIZE, "max file size exceeded");
     auto data = data_blocks(size);
-    if (data < INODE_DIRECT_COUNT)  // only direct is enough
+    if (extents()) {
+        /* every block an extent: full leaves, and the index nodes above them up to the root. */
+        uint32_t blocks = data;
+        for (uint32_t nodes = data; nodes > kExtentRootEntries;) {
+            nodes = (nodes + kExtentNodeEntries - 1) / kExtentNodeEntries;
+            blocks += nodes;
+        }
+        return blocks;
+    }
+    if (data <= INODE_DIRECT_COUNT)  // only direct is enough
     {
         return data;
     }
-    if (data - INODE_DIRECT_COUNT < INODE_INDIRECT_COUNT)  // need indirect1
+    if (data - INODE_DIRECT_COUNT <= INODE_INDIRECT_COUNT)  // need indirect1
     {
         return data + 1;
     }
@@ -89,48 +150,99 @@ uint32_t DiskInode::total_blocks(uint32_t size) {
     return data + 2 + ((rest + INODE_INDIRECT_COUNT - 1) / INODE_INDIRECT_COUNT);  // need indirect2
 }
 
+uint32_t DiskInode::grow_blocks(uint32_t from, uint32_t to) {
+    if (to <= from) {
+        return 0;
+    }
+    if (extents()) {
+        /*
+         * the new blocks are appended as one extent each at most, each level of the tree (as deep as it could be
+         * at "to") gets a node per kExtentNodeEntries entries added below it, and one for the split of its last.
+         */
+        uint32_t blocks = data_blocks(to) - data_blocks(from), entries = blocks;
+        for (uint32_t nodes = data_blocks(to); nodes > kExtentRootEntries;) {
+            nodes = (nodes + kExtentNodeEntries - 1) / kExtentNodeEntries;
+            entries = (entries + kExtentNodeEntries - 1) / kExtentNodeEntries + 1;
+            blocks += entries;
+        }
+        return blocks;
+    }
+    return total_blocks(to) - total_blocks(from);
+}
+
+/* number of indirect1 blocks under indirect2 of a file with "data" data blocks. */
+static uint32_t indirect2_groups(uint32_t data) {
+    uint32_t base = INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT;
+    return data > base ? (data - base + INODE_INDIRECT_COUNT - 1) / INODE_INDIRECT_COUNT : 0;
+}
+
+/* free "ids" (in any order) with one free_range per contiguous run. */
+static int free_blocks(vector<blk_id_t> &ids, Bitmap *data_bitmap, BlockDevice *dev) {
+    sort(ids.begin(), ids.end());
+    for (size_t i = 0, j; i < ids.size(); i = j) {
+        for (j = i + 1; j < ids.size() && ids[j] == ids[i] + (j - i); ++j) {
+        }
+        if (data_bitmap->free_range(ids[i], j - i, dev) != kSuccess) {
+            DLOG(WARNING) << "free " << j - i << " blocks from " << ids[i] << " failed";
+            return kFail;
+        }
+    }
+    return kSuccess;
+}
+
 // todo: write back all at once to reduce overhead
 int DiskInode::increase(int old_blocks, int old_data_blocks, int new_blocks, int new_data_blocks, BlockDevice *dev,
-                        Bitmap *data_bitmap) {
+                        Bitmap *data_bitmap, blk_id_t goal) {
     int new_direct_blocks = new_blocks - old_blocks - (new_data_blocks - old_data_blocks);
     rt_assert(new_direct_blocks >= 0, "new direct blocks should be non-negative");
 
+    /*
+     * all new data and index blocks are allocated at once, as few extents as possible, right after
+     * the last block of the file (or at the goal of an empty one) or as near to it as possible,
+     * and handed out in file order below, so the file is contiguous except an index block before each 4MB of data.
+     */
+    uint32_t count = new_data_blocks - old_data_blocks + indirect2_groups(new_data_blocks) -
+                     indirect2_groups(old_data_blocks);
+    count += new_data_blocks > INODE_DIRECT_COUNT && !indirect1;
+    count += new_data_blocks > INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT && !indirect2;
+    if (old_data_blocks > 0) {
+        goal = block_id(old_data_blocks - 1, dev) + 1;
+    }
+    vector<Extent> extents;
+    if (data_bitmap->alloc_range(count, goal, &extents, dev) != kSuccess) {
+        DLOG(WARNING) << "alloc " << count << " blocks failed at increase";
+        return kFail;
+    }
+    vector<blk_id_t> pool;
+    pool.reserve(count);
+    for (auto &e : extents) {
+        for (uint32_t k = 0; k < e.len; ++k) {
+            pool.push_back(e.start + k);
+        }
+    }
+    size_t next = 0;
+
     // we will do this in three steps
 
     // step one, increase direct blocks
     for (int i = old_data_blocks; i < min(new_data_blocks, INODE_DIRECT_COUNT); i++) {
-        blk_id_t new_blk = data_bitmap->alloc(dev);
-        if (new_blk == kFail) {
-            DLOG(WARNING) << "alloc data bitmap failed at increase 1";
-            return kFail;
-        }
-        direct[i] = new_blk;
+        direct[i] = pool[next++];
     }
 
     // step two, increase indirect1 blocks
     if (new_data_blocks > INODE_DIRECT_COUNT) {
-        if (!indirect1) {
-            indirect1 = data_bitmap->alloc(dev);
-            if (indirect1 == kFail) {
-                DLOG(WARNING) << "alloc indirect1 bitmap failed at increase 2";
-                return kFail;
-            }
-        }
         Block ind1;
-        if (dev->read(indirect1, &ind1) != kSuccess) {
+        if (!indirect1) {
+            indirect1 = pool[next++];
+            memset(&ind1, 0, sizeof(Block));
+        } else if (dev->read(indirect1, &ind1) != kSuccess) {
             DLOG(WARNING) << "read indirect1 block " << indirect1 << " failed at increase 2";
             return kFail;
         }
         auto p = (uint32_t *)(ind1.data);
         for (int i = max(old_data_blocks, INODE_DIRECT_COUNT);
              i < min(new_data_blocks, INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT); i++) {
-            blk_id_t new_blk = data_bitmap->alloc(dev);
-            DLOG(WARNING) << "alloc indirect1 " << new_blk;
-            if (new_blk == kFail) {
-                DLOG(WARNING) << "alloc data bitmap failed at increase 2";
-                return kFail;
-            }
-            p[i - INODE_DIRECT_COUNT] = new_blk;
+            p[i - INODE_DIRECT_COUNT] = pool[next++];
         }
         if (dev->write(indirect1, &ind1) != kSuccess) {
             DLOG(WARNING) << "write indirect1 block " << indirect1 << " failed at increase 2";
@@ -140,65 +252,46 @@ int DiskInode::increase(int old_blocks, int old_data_blocks, int new_blocks, int
     // step three, increase indirect2 blocks
 
     if (new_data_blocks > INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT) {
-        if (!indirect2) {
-            indirect2 = data_bitmap->alloc(dev);
-            if (indirect2 == kFail) {
-                DLOG(WARNING) << "alloc indirect2 bitmap failed at increase 3";
-                return kFail;
-            }
-        }
         Block ind2;
-        if (dev->read(indirect2, &ind2) != kSuccess) {
+        if (!indirect2) {
+            indirect2 = pool[next++];
+            memset(&ind2, 0, sizeof(Block));
+        } else if (dev->read(indirect2, &ind2) != kSuccess) {
             DLOG(WARNING) << "read indirect2 block " << indirect2 << " failed at increase 3";
             return kFail;
         }
         auto p = (uint32_t *)(ind2.data);
-        int old_idx_limit = old_data_blocks - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT - 1;
-        int blk_limit = old_idx_limit / INODE_INDIRECT_COUNT;
-        if (old_idx_limit < 0) blk_limit = -1;
-        DLOG(WARNING) << "increase indirect2 "
-                      << " old idx " << old_idx_limit << " blk " << blk_limit << endl;
-        for (int i = max(old_data_blocks, INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT); i < new_data_blocks; i++) {
-            int j = i - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT;
-            int blk = j / INODE_INDIRECT_COUNT;
-            // at indirect2, we have to allocate a new indirect1 block that is not previously allocated
-            if (blk > blk_limit) {
-                blk_id_t new_ind1 = data_bitmap->alloc(dev);
-                DLOG(WARNING) << "alloc indirect2->1 " << new_ind1;
-
-                if (new_ind1 == kFail) {
-                    DLOG(WARNING) << "alloc indirect1 bitmap failed at increase 3";
-                    return kFail;
-                }
-                p[blk] = new_ind1;
-                ++blk_limit;
-                // todo : we may write back all at once, which might reduce overhead
-                if (dev->write(indirect2, &ind2) != kSuccess) {
-                    DLOG(WARNING) << "write indirect2 block " << indirect2 << " failed at increase 3";
-                    return kFail;
-                }
-            }
+        int first = max(old_data_blocks, INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT) - INODE_DIRECT_COUNT -
+                    INODE_INDIRECT_COUNT;
+        int last = new_data_blocks - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT;
+        int old_groups = indirect2_groups(old_data_blocks);
+        DLOG(WARNING) << "increase indirect2 from " << first << " to " << last << " old groups " << old_groups;
+        // fill one indirect1 block at a time, a new one is allocated before its data blocks
+        for (int j = first; j < last;) {
+            int blk = j / INODE_INDIRECT_COUNT, end = min(last, (blk + 1) * INODE_INDIRECT_COUNT);
             Block ind21;
-            if (dev->read(p[blk], &ind21) != kSuccess) {
+            if (blk >= old_groups) {
+                p[blk] = pool[next++];
+                memset(&ind21, 0, sizeof(Block));
+            } else if (dev->read(p[blk], &ind21) != kSuccess) {
                 DLOG(WARNING) << "read indirect1 block " << p[blk] << " failed at increase 3";
                 return kFail;
             }
-
-            blk_id_t new_blk = data_bitmap->alloc(dev);
-            DLOG(WARNING) << "alloc new block at ind2 " << j << " from indirect21 " << blk << " ret = " << new_blk;
-            if (new_blk == kFail) {
-                DLOG(WARNING) << "alloc data bitmap failed at increase 3";
-                return kFail;
-            }
-
             auto p2 = (uint32_t *)(ind21.data);
-            p2[j % INODE_INDIRECT_COUNT] = new_blk;
+            for (; j < end; ++j) {
+                p2[j % INODE_INDIRECT_COUNT] = pool[next++];
+            }
             if (dev->write(p[blk], &ind21) != kSuccess) {
                 DLOG(WARNING) << "write indirect1 block " << p[blk] << " failed at increase 3";
                 return kFail;
             }
         }
+        if (dev->write(indirect2, &ind2) != kSuccess) {
+            DLOG(WARNING) << "write indirect2 block " << indirect2 << " failed at increase 3";
+            return kFail;
+        }
     }
+    rt_assert(next == pool.size(), "allocated blocks left at increase");
     return kSuccess;
 }
 
@@ -208,8 +301,8 @@ int DiskInode::decrease(int old_blocks, int old_data_blocks, int new_blocks, int
     rt_assert(new_direct_blocks <= 0, "new direct blocks should be non-positive");
     // we will do this in three steps
 
-    vector<int> bitmap_to_free;  // for consistency issue,
-                                 // we must free bitmap only after the data of inode has been write_back
+    vector<blk_id_t> bitmap_to_free;  // for consistency issue,
+                                      // we must free bitmap only after the data of inode has been write_back
 
     // step one, decrease direct blocks
     for (int i = new_data_blocks; i < min(old_data_blocks, INODE_DIRECT_COUNT); i++) {
@@ -358,8 +451,8 @@ int DiskInode::decrease(int old_blocks, int old_data_blocks, int new_blocks, int
                         // }
                         p2[j] = -1;
                     }
-                    if (dev->write(i, &ind1) != kSuccess) {
-                        DLOG(WARNING) << "write indirect1 block " << i << " failed at decrease 3";
+                    if (dev->write(p[i], &ind1) != kSuccess) {
+                        DLOG(WARNING) << "write indirect1 block " << p[i] << " failed at decrease 3";
                         return kFail;
                     }
                 } else if (i == posj.first && i != posi.first) {
@@ -388,8 +481,8 @@ int DiskInode::decrease(int old_blocks, int old_data_blocks, int new_blocks, int
                         // }
                         p2[j] = -1;
                     }
-                    if (dev->write(i, &ind1) != kSuccess) {
-                        DLOG(WARNING) << "write indirect1 block " << i << " failed at decrease 3";
+                    if (dev->write(p[i], &ind1) != kSuccess) {
+                        DLOG(WARNING) << "write indirect1 block " << p[i] << " failed at decrease 3";
                         return kFail;
                     }
                 }
@@ -405,23 +498,218 @@ int DiskInode::decrease(int old_blocks, int old_data_blocks, int new_blocks, int
     if (inode != nullptr) {
         inode->write_inode(this);
     }
-    for (auto i : bitmap_to_free) {
-        auto ret = data_bitmap->free(i, dev);
-        if (ret != kSuccess) {
-            DLOG(WARNING) << "free data bitmap failed at decrease";
+    if (free_blocks(bitmap_to_free, data_bitmap, dev) != kSuccess) {
+        DLOG(WARNING) << "free data bitmap failed at decrease";
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int DiskInode::extent_append(uint32_t lblk, const Extent &e, BlockDevice *dev, Bitmap *data_bitmap) {
+    for (;;) {
+        /* the right edge of the tree, path[0] is the root, the others are copies of their node blocks. */
+        ExtentHeader *root = extent_root();
+        int depth = root->depth;
+        vector<Block> blocks(depth);
+        vector<blk_id_t> ids(depth + 1, 0);
+        vector<ExtentHeader *> path{ root };
+        for (int i = 1; i <= depth; ++i) {
+            ids[i] = extent_entries(path.back())[path.back()->entries - 1].pblk;
+            if (dev->read(ids[i], &blocks[i - 1]) != kSuccess) {
+                DLOG(WARNING) << "read extent node " << ids[i] << " failed at append";
+                return kFail;
+            }
+            path.push_back((ExtentHeader *)blocks[i - 1].data);
+        }
+        auto write_node = [&](int i) {
+            return i == 0 ? kSuccess : dev->write(ids[i], &blocks[i - 1]);
+        };
+        ExtentHeader *leaf = path.back();
+        if (leaf->entries > 0) {
+            auto &last = extent_entries(leaf)[leaf->entries - 1];
+            if (last.lblk + last.len == lblk && last.pblk + last.len == e.start) {
+                last.len += e.len;
+                return write_node(depth);
+            }
+        }
+        if (leaf->entries < leaf->max) {
+            extent_entries(leaf)[leaf->entries++] = ExtentEntry{ lblk, e.start, e.len };
+            return write_node(depth);
+        }
+        /* new nodes are put after the extent, like index blocks of increase. */
+        auto new_node = [&](uint16_t node_depth, const ExtentEntry *entries, uint16_t count, blk_id_t *id) {
+            *id = data_bitmap->alloc(dev, e.start + e.len);
+            if (*id == (blk_id_t)kFail) {
+                DLOG(WARNING) << "alloc extent node failed at append";
+                return kFail;
+            }
+            Block node;
+            memset(&node, 0, sizeof(Block));
+            auto h = (ExtentHeader *)node.data;
+            *h = ExtentHeader{ kExtentMagic, count, kExtentNodeEntries, node_depth };
+            memcpy(extent_entries(h), entries, sizeof(ExtentEntry) * count);
+            return dev->write(*id, &node);
+        };
+        /* the leaf is full, the deepest index node with room gets a new branch down to a new leaf. */
+        int level = depth - 1;
+        while (level >= 0 && path[level]->entries == path[level]->max) {
+            --level;
+        }
+        if (level < 0) {
+            /* all full, the tree grows: the root moves to a new node, and it's the only child of the root. */
+            blk_id_t id;
+            if (new_node(depth, extent_entries(root), root->entries, &id) != kSuccess) {
+                return kFail;
+            }
+            root->depth++;
+            root->entries = 1;
+            extent_entries(root)[0].pblk = id;
+            extent_entries(root)[0].len = 0;
+            continue;
+        }
+        ExtentEntry entry{ lblk, e.start, e.len };
+        for (int i = depth; i > level; --i) {
+            blk_id_t id;
+            if (new_node(depth - i, &entry, 1, &id) != kSuccess) {
+                return kFail;
+            }
+            entry = ExtentEntry{ lblk, id, 0 };
+        }
+        extent_entries(path[level])[path[level]->entries++] = entry;
+        return write_node(level);
+    }
+}
+
+int DiskInode::extent_increase(uint32_t old_data_blocks, uint32_t new_data_blocks, BlockDevice *dev,
+                               Bitmap *data_bitmap, blk_id_t goal) {
+    /* data blocks at once, as in increase, then the extents are added one by one. */
+    if (old_data_blocks > 0) {
+        goal = block_id(old_data_blocks - 1, dev) + 1;
+    }
+    vector<Extent> runs;
+    if (data_bitmap->alloc_range(new_data_blocks - old_data_blocks, goal, &runs, dev) != kSuccess) {
+        DLOG(WARNING) << "alloc " << new_data_blocks - old_data_blocks << " blocks failed at extent increase";
+        return kFail;
+    }
+    uint32_t lblk = old_data_blocks;
+    for (auto &e : runs) {
+        if (extent_append(lblk, e, dev, data_bitmap) != kSuccess) {
+            DLOG(WARNING) << "append extent " << e.start << " + " << e.len << " at " << lblk << " failed";
+            return kFail;
+        }
+        lblk += e.len;
+    }
+    return kSuccess;
+}
+
+/*
+ * drop logical blocks from "n" on under "node", from its last entry backwards, they and the emptied nodes
+ * go to "to_free". A changed child node is written back.
+ */
+static int extent_truncate(ExtentHeader *node, uint32_t n, vector<Extent> *to_free, BlockDevice *dev) {
+    while (node->entries > 0) {
+        auto &e = extent_entries(node)[node->entries - 1];
+        if (node->depth == 0) {
+            if (e.lblk + e.len <= n) {
+                break;
+            }
+            uint32_t keep = e.lblk < n ? n - e.lblk : 0;
+            to_free->push_back(Extent{ e.pblk + keep, e.len - keep });
+            if (keep > 0) {
+                e.len = keep;
+                break;
+            }
+            node->entries--;
+            continue;
+        }
+        Block child;
+        if (dev->read(e.pblk, &child) != kSuccess) {
+            DLOG(WARNING) << "read extent node " << e.pblk << " failed at truncate";
+            return kFail;
+        }
+        auto h = (ExtentHeader *)child.data;
+        if (h->magic != kExtentMagic) {
+            LOG(ERROR) << "bad extent node " << e.pblk;
+            return kFail;
+        }
+        size_t freed = to_free->size();
+        if (extent_truncate(h, n, to_free, dev) != kSuccess) {
+            return kFail;
+        }
+        if (h->entries > 0) {
+            /* the rest is before n. */
+            if (to_free->size() != freed && dev->write(e.pblk, &child) != kSuccess) {
+                DLOG(WARNING) << "write extent node " << e.pblk << " failed at truncate";
+                return kFail;
+            }
+            break;
+        }
+        to_free->push_back(Extent{ e.pblk, 1 });
+        node->entries--;
+    }
+    return kSuccess;
+}
+
+int DiskInode::extent_decrease(uint32_t new_data_blocks, BlockDevice *dev, Bitmap *data_bitmap,
+                               const Inode *inode) {
+    /* like decrease, blocks are freed after the inode is written. */
+    vector<Extent> to_free;
+    ExtentHeader *root = extent_root();
+    if (extent_truncate(root, new_data_blocks, &to_free, dev) != kSuccess) {
+        return kFail;
+    }
+    /* the tree shrinks while the root has a single child that fits in it. */
+    while (root->depth > 0 && root->entries <= 1) {
+        if (root->entries == 0) {
+            root->depth = 0;
+            break;
+        }
+        blk_id_t id = extent_entries(root)[0].pblk;
+        Block child;
+        if (dev->read(id, &child) != kSuccess) {
+            DLOG(WARNING) << "read extent node " << id << " failed at decrease";
+            return kFail;
+        }
+        auto h = (ExtentHeader *)child.data;
+        if (h->entries > root->max) {
+            break;
+        }
+        memcpy(extent_entries(root), extent_entries(h), sizeof(ExtentEntry) * h->entries);
+        root->entries = h->entries;
+        root->depth = h->depth;
+        to_free.push_back(Extent{ id, 1 });
+    }
+    if (inode != nullptr) {
+        inode->write_inode(this);
+    }
+    for (auto &e : to_free) {
+        if (data_bitmap->free_range(e.start, e.len, dev) != kSuccess) {
+            DLOG(WARNING) << "free " << e.len << " blocks from " << e.start << " failed at extent decrease";
             return kFail;
         }
     }
     return kSuccess;
 }
 
-int DiskInode::resize(uint32_t new_size, Bitmap *data_bitmap, BlockDevice *dev, const Inode *inode) {
+int DiskInode::resize(uint32_t new_size, Bitmap *data_bitmap, BlockDevice *dev, const Inode *inode, blk_id_t goal) {
     update_meta(7);
     // if (new_size == 0) return clear(data_bitmap, dev);
     auto old_size = size;
     size = new_size;
     auto old_data_blocks = data_blocks(old_size);
     auto new_data_blocks = data_blocks(size);
+    if (extents()) {
+        if (new_data_blocks > old_data_blocks) {
+            return extent_increase(old_data_blocks, new_data_blocks, dev, data_bitmap, goal);
+        }
+        if (new_data_blocks < old_data_blocks) {
+            return extent_decrease(new_data_blocks, dev, data_bitmap, inode);
+        }
+        if (inode != nullptr) {
+            inode->write_inode(this);
+        }
+        return kSuccess;
+    }
     auto old_blocks = total_blocks(old_size);
     auto new_blocks = total_blocks(size);
     DLOG(WARNING) << "old_size: " << old_size << " new_size: " << new_size << " old_blocks: " << old_blocks
@@ -436,22 +724,21 @@ int DiskInode::resize(uint32_t new_size, Bitmap *data_bitmap, BlockDevice *dev,
     if (old_blocks > new_blocks) {
         return decrease(old_blocks, old_data_blocks, new_blocks, new_data_blocks, dev, data_bitmap, inode);
     } else {
-        return increase(old_blocks, old_data_blocks, new_blocks, new_data_blocks, dev, data_bitmap);
+        return increase(old_blocks, old_data_blocks, new_blocks, new_data_blocks, dev, data_bitmap, goal);
     }
 }
 
 int DiskInode::clear(Bitmap *data_bitmap, BlockDevice *dev) {
+    if (extents()) {
+        return extent_decrease(0, dev, data_bitmap, nullptr);
+    }
     int data_blks = data_blocks(size);
-    int blks = total_blocks(size);
+    vector<blk_id_t> to_free;
     for (int i = 0; i < min(data_blks, INODE_DIRECT_COUNT); ++i) {
-        auto ret = data_bitmap->free(direct[i], dev);
-        if (ret != kSuccess) {
-            DLOG(WARNING) << "free data bitmap failed at clear";
-            return kFail;
-        }
+        to_free.push_back(direct[i]);
         direct[i] = -1;
     }
-    if (indirect1 != 0 && data_blks > INODE_INDIRECT_COUNT) {  // redundant condition
+    if (indirect1 != 0 && data_blks > INODE_DIRECT_COUNT) {
         Block ind;
         if (dev->read(indirect1, &ind) != kSuccess) {
             DLOG(WARNING) << "read indirect block " << indirect1 << " failed at clear";
@@ -459,17 +746,10 @@ int DiskInode::clear(Bitmap *data_bitmap, BlockDevice *dev) {
         }
         auto p = (uint32_t *)(ind.data);
         for (int i = INODE_DIRECT_COUNT; i < min(data_blks, INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT); ++i) {
-            auto ret = data_bitmap->free(p[i - INODE_DIRECT_COUNT], dev);
-            if (ret != kSuccess) {
-                DLOG(WARNING) << "free data bitmap failed at clear";
-                return kFail;
-            }
-        }
-        auto ret = data_bitmap->free(indirect1, dev);
-        if (ret != kSuccess) {
-            DLOG(WARNING) << "free indirect1 bitmap failed at clear";
-            return kFail;
+            to_free.push_back(p[i - INODE_DIRECT_COUNT]);
         }
+        to_free.push_back(indirect1);
+        indirect1 = 0;
     }
     if (indirect2 != 0 && data_blks > INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT) {
         Block ind2;
@@ -480,96 +760,193 @@ int DiskInode::clear(Bitmap *data_bitmap, BlockDevice *dev) {
         auto p2 = (uint32_t *)(ind2.data);
         int rest = data_blks - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT;
         for (int i = 0; i < rest; i += INODE_INDIRECT_COUNT) {
+            blk_id_t ind1_id = p2[i / INODE_INDIRECT_COUNT];
             Block ind1;
-            if (dev->read(p2[i], &ind1) != kSuccess) {
-                DLOG(WARNING) << "read indirect1 block " << p2[i] << " failed at clear";
+            if (dev->read(ind1_id, &ind1) != kSuccess) {
+                DLOG(WARNING) << "read indirect1 block " << ind1_id << " failed at clear";
                 return kFail;
             }
             auto p = (uint32_t *)(ind1.data);
             for (int j = 0; j < INODE_INDIRECT_COUNT && i + j < rest; ++j) {
-                auto ret = data_bitmap->free(p[j], dev);
-                if (ret != kSuccess) {
-                    DLOG(WARNING) << "free data bitmap failed at clear";
-                    return kFail;
-                }
+                to_free.push_back(p[j]);
             }
-            auto ret = data_bitmap->free(p2[i], dev);
-            if (ret != kSuccess) {
-                DLOG(WARNING) << "free indirect1 bitmap failed at clear";
-                return kFail;
-            }
-        }
-        auto ret = data_bitmap->free(indirect2, dev);
-        if (ret != kSuccess) {
-            DLOG(WARNING) << "free indirect2 bitmap failed at clear";
-            return kFail;
+            to_free.push_back(ind1_id);
         }
+        to_free.push_back(indirect2);
+        indirect2 = 0;
+    }
+    if (free_blocks(to_free, data_bitmap, dev) != kSuccess) {
+        DLOG(WARNING) << "free data bitmap failed at clear";
+        return kFail;
     }
     // todo release inode, but we don't have the access here
     // api change required
     return kSuccess;
 }
 
-int DiskInode::read_data(uint32_t offset, uint8_t *buf, uint32_t len, BlockDevice *dev) {
-    update_meta(1);
-
-    if (len == 0) return kSuccess;
-    if (offset > size) {
-        DLOG(WARNING) << "read data offset out of range";
-        return kFail;
+int DiskInode::map_node(uint32_t lid, std::vector<BlockMap::Run> *runs, BlockDevice *dev) {
+    BlockRef ref;
+    if (extents()) {
+        ExtentHeader *leaf = extent_leaf(lid, &ref, dev);
+        if (leaf == nullptr) {
+            return kFail;
+        }
+        for (uint16_t i = 0; i < leaf->entries; ++i) {
+            auto &e = extent_entries(leaf)[i];
+            runs->push_back(BlockMap::Run{ e.lblk, e.pblk, e.len });
+        }
+        return kSuccess;
     }
-    if (offset + len >= size) len = size - offset;
-    int l = offset, r = offset + len;
-    int lid = l / kBlockSize, rid = r / kBlockSize;
-    int loff = l % kBlockSize, roff = r % kBlockSize;
-    rt_assert(lid <= rid, "lid should be <= rid");
-    Block data;
-
-    if (lid == rid) {
-        auto blk = block_id(lid, dev);
-        if (dev->read(blk, &data) != kSuccess) {
-            DLOG(WARNING) << "read block " << blk << " failed at read_data";
+    /* the block ids of the direct blocks, of indirect1 or of an indirect1 block under indirect2. */
+    uint32_t data = data_blocks(size), first;
+    const blk_id_t *ids;
+    if (lid >= data) {
+        return kFail;
+    } else if (lid < INODE_DIRECT_COUNT) {
+        first = 0;
+        ids = direct;
+    } else if (lid < INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT) {
+        first = INODE_DIRECT_COUNT;
+        if (dev->pin(indirect1, &ref) != kSuccess) {
+            DLOG(WARNING) << "read indirect1 block " << indirect1 << " failed at map_node";
             return kFail;
         }
-        DLOG(WARNING) << "read block to buf from " << blk << " offset " << loff << " len " << roff - loff;
-        memcpy(buf, data.data + loff, roff - loff);
+        ids = ref.as<blk_id_t>();
     } else {
-        auto lblk = block_id(lid, dev);
-        int bufoffset = 0;
-        if (dev->read(lblk, &data) != kSuccess) {
-            DLOG(WARNING) << "read block " << lblk << " failed at read_data";
+        uint32_t group = (lid - INODE_DIRECT_COUNT - INODE_INDIRECT_COUNT) / INODE_INDIRECT_COUNT;
+        first = INODE_DIRECT_COUNT + INODE_INDIRECT_COUNT + group * INODE_INDIRECT_COUNT;
+        if (dev->pin(indirect2, &ref) != kSuccess) {
+            DLOG(WARNING) << "read indirect2 block " << indirect2 << " failed at map_node";
+            return kFail;
+        }
+        blk_id_t ind1 = ref.as<blk_id_t>()[group];
+        if (dev->pin(ind1, &ref) != kSuccess) {
+            DLOG(WARNING) << "read second level of indirect2 block " << ind1 << " failed at map_node";
             return kFail;
         }
-        memcpy(buf, data.data + loff, kBlockSize - loff);
-        bufoffset += kBlockSize - loff;
-        DLOG(WARNING) << "read block to buf from " << lblk << " offset " << loff << " len " << kBlockSize - loff;
-        for (int i = lid + 1; i < rid; ++i) {
-            auto blk = block_id(i, dev);
-            if (dev->read(blk, &data) != kSuccess) {
-                DLOG(WARNING) << "read block " << i << " failed at read_data";
+        ids = ref.as<blk_id_t>();
+    }
+    uint32_t end = min<uint32_t>(data, first + (first == 0 ? INODE_DIRECT_COUNT : INODE_INDIRECT_COUNT));
+    for (uint32_t i = first; i < end; ++i) {
+        blk_id_t id = ids[i - first];
+        if (i > first && id == runs->back().pblk + runs->back().len) {
+            ++runs->back().len;
+        } else {
+            runs->push_back(BlockMap::Run{ i, id, 1 });
+        }
+    }
+    return kSuccess;
+}
+
+int DiskInode::map_blocks(uint32_t lid, uint32_t count, blk_id_t *ids, BlockDevice *dev, BlockMap::File *map) {
+    BlockMap::Run run;
+    std::vector<BlockMap::Run> runs;
+    for (uint32_t i = 0; i < count;) {
+        uint32_t cur = lid + i;
+        if (map == nullptr || !map->find(cur, &run)) {
+            /* a whole index block (or extent leaf) at once, all of it is cached. */
+            runs.clear();
+            if (map_node(cur, &runs, dev) != kSuccess) {
+                DLOG(WARNING) << "map block " << cur << " failed";
                 return kFail;
             }
-            DLOG(WARNING) << "read block to buf + " << bufoffset << " from " << blk << " offset " << 0 << " len "
-                          << kBlockSize;
-            memcpy(buf + bufoffset, data.data, kBlockSize);
-            bufoffset += kBlockSize;
-        }
-        if (roff > 0) {
-            auto rblk = block_id(rid, dev);
-            if (dev->read(rblk, &data) != kSuccess) {
-                DLOG(WARNING) << "read block " << rblk << " failed at read_data";
+            auto it = upper_bound(runs.begin(), runs.end(), cur,
+                                  [](uint32_t l, const BlockMap::Run &r) { return l < r.lblk; });
+            if (it == runs.begin() || cur - (it - 1)->lblk >= (it - 1)->len) {
+                DLOG(WARNING) << "block " << cur << " is not mapped";
                 return kFail;
             }
-            DLOG(WARNING) << "read block to buf + " << bufoffset << " from " << rblk << " offset " << 0 << " len "
-                          << roff;
-            memcpy(buf + bufoffset, data.data, roff);
+            run = *(it - 1);
+            if (map != nullptr) {
+                for (auto &r : runs) {
+                    map->insert(r);
+                }
+            }
         }
+        for (uint32_t k = cur - run.lblk; k < run.len && i < count; ++k) {
+            ids[i++] = run.pblk + k;
+        }
+    }
+    return kSuccess;
+}
+
+int DiskInode::read_data(uint32_t offset, uint8_t *buf, uint32_t len, BlockDevice *dev, bool direct,
+                         BlockMap::File *map) {
+    update_meta(1);
+
+    if (len == 0) return kSuccess;
+    if (offset > size) {
+        DLOG(WARNING) << "read data offset out of range";
+        return kFail;
     }
+    if (offset + len >= size) len = size - offset;
+    if (len == 0) return kSuccess;
+    uint32_t lid = offset / kBlockSize, rid = (offset + len - 1) / kBlockSize;
+    DLOG(WARNING) << "disk inode read data lid " << lid << " rid " << rid << " offset " << offset << " len " << len;
 
+    uint32_t head = offset % kBlockSize, tail = (offset + len) % kBlockSize;
+    vector<blk_id_t> ids(rid - lid + 1);
+    if (map_blocks(lid, rid - lid + 1, ids.data(), dev, map) != kSuccess) {
+        return kFail;
+    }
+    if (!direct) {
+        /* copied straight out of the cache. */
+        if (dev->read_range(ids, head, buf, len) != kSuccess) {
+            DLOG(WARNING) << "read blocks " << lid << " to " << rid << " failed at read_data";
+            return kFail;
+        }
+        return len;
+    }
+    bool first_part = head != 0 || (rid == lid && tail != 0), last_part = rid != lid && tail != 0;
+    /*
+     * blocks in "data" are contiguous, so [offset, offset + len) is a plain range of it.
+     * Direct I/O reads whole blocks in place instead if "buf" is block aligned at them, the partial ones to "data".
+     */
+    uint8_t *base = buf - head;
+    bool in_place = (uintptr_t)base % kBlockSize == 0;
+    vector<Block> data(in_place ? 2 : rid - lid + 1);
+    vector<pair<blk_id_t, Block *>> blocks;
+    blocks.reserve(rid - lid + 1);
+    for (uint32_t i = lid; i <= rid; ++i) {
+        Block *blk = in_place ? (Block *)(base + (uint64_t)(i - lid) * kBlockSize) : &data[i - lid];
+        if (in_place && i == lid && first_part) {
+            blk = &data.front();
+        } else if (in_place && i == rid && last_part) {
+            blk = &data.back();
+        }
+        blocks.emplace_back(ids[i - lid], blk);
+    }
+    if (dev->read_direct(blocks) != kSuccess) {
+        DLOG(WARNING) << "read blocks " << lid << " to " << rid << " failed at read_data";
+        return kFail;
+    }
+    if (!in_place) {
+        memcpy(buf, (uint8_t *)data.data() + head, len);
+        return len;
+    }
+    if (first_part) {
+        memcpy(buf, data.front().data + head, std::min<uint32_t>(len, kBlockSize - head));
+    }
+    if (last_part) {
+        memcpy(base + (uint64_t)(rid - lid) * kBlockSize, data.back().data, tail);
+    }
     return len;
 }
 
-int DiskInode::write_data(uint32_t offset, const uint8_t *buf, uint32_t len, BlockDevice *dev) {
+int DiskInode::prefetch(uint32_t lid, uint32_t count, BlockDevice *dev, BlockMap::File *map) {
+    uint32_t rid = std::min(lid + count, data_blocks(size));
+    if (lid >= rid) {
+        return kSuccess;
+    }
+    vector<blk_id_t> block_ids(rid - lid);
+    if (map_blocks(lid, rid - lid, block_ids.data(), dev, map) != kSuccess) {
+        return kFail;
+    }
+    return dev->prefetch(block_ids);
+}
+
+int DiskInode::write_data(uint32_t offset, const uint8_t *buf, uint32_t len, BlockDevice *dev, bool direct,
+                          BlockMap::File *map) {
     update_meta(3);
     if (len == 0) return kSuccess;
     DLOG(WARNING) << "disk inode write data offset " << offset << " len " << len;
@@ -580,104 +957,72 @@ int DiskInode::write_data(uint32_t offset, const uint8_t *buf, uint32_t len, Blo
     if (offset + len >= size) {
         len = size - offset;
     }
-    int l = offset, r = offset + len;
-    int lid = l / kBlockSize, rid = r / kBlockSize;
-    int loff = l % kBlockSize, roff = r % kBlockSize;
-    rt_assert(lid <= rid, "lid should be <= rid");
-    DLOG(WARNING) << "disk inode write data lid " << lid << " loffset " << loff << " rid " << rid << " roffset "
-                  << roff;
-
-    Block data;
-    if (lid == rid) {
-        auto lblk = block_id(lid, dev);
-        if (dev->read(lblk, &data) != kSuccess) {
-            DLOG(WARNING) << "read block " << lblk << " failed at write_data";
-            return kFail;
-        }
-        memcpy(data.data + loff, buf, roff - loff);
-        DLOG(WARNING) << "write to block " << lblk << " offset " << loff << " from buf len " << roff - loff;
+    if (len == 0) return kSuccess;
+    uint32_t lid = offset / kBlockSize, rid = (offset + len - 1) / kBlockSize;
+    DLOG(WARNING) << "disk inode write data lid " << lid << " rid " << rid;
 
-        if (dev->write(lblk, &data) != kSuccess) {
-            DLOG(WARNING) << "write block " << lblk << " failed at write_data";
-            return kFail;
-        }
-    } else {
-        int bufoffset = 0;
-        auto lblk = block_id(lid, dev);
-        if (dev->read(lblk, &data) != kSuccess) {
-            DLOG(WARNING) << "read block " << lblk << " failed at write_data";
+    uint32_t head = offset % kBlockSize, tail = (offset + len) % kBlockSize;
+    vector<blk_id_t> ids(rid - lid + 1);
+    if (map_blocks(lid, rid - lid + 1, ids.data(), dev, map) != kSuccess) {
+        return kFail;
+    }
+    if (!direct) {
+        /* copied straight into the cache. */
+        if (dev->write_range(ids, head, buf, len) != kSuccess) {
+            DLOG(WARNING) << "write blocks " << lid << " to " << rid << " failed at write_data";
             return kFail;
         }
-        memcpy(data.data + loff, buf, kBlockSize - loff);
-        bufoffset += kBlockSize - loff;
-        DLOG(WARNING) << "write to block " << lblk << " offset " << loff << " from buf len " << kBlockSize - loff;
-        if (dev->write(lblk, &data) != kSuccess) {
-            DLOG(WARNING) << "write block " << lblk << " failed at write_data";
-            return kFail;
+        return len;
+    }
+    bool first_part = head != 0 || (rid == lid && tail != 0), last_part = rid != lid && tail != 0;
+    /* like read_data, direct I/O writes whole blocks in place if "buf" is block aligned at them. */
+    const uint8_t *base = buf - head;
+    bool in_place = (uintptr_t)base % kBlockSize == 0;
+    vector<Block> data(in_place ? 2 : rid - lid + 1);
+    vector<pair<blk_id_t, const Block *>> blocks;
+    blocks.reserve(rid - lid + 1);
+    for (uint32_t i = lid; i <= rid; ++i) {
+        const Block *blk = in_place ? (const Block *)(base + (uint64_t)(i - lid) * kBlockSize) : &data[i - lid];
+        if (in_place && i == lid && first_part) {
+            blk = &data.front();
+        } else if (in_place && i == rid && last_part) {
+            blk = &data.back();
         }
-
-        for (int i = lid + 1; i < rid; ++i) {
-            memcpy(data.data, buf + bufoffset, kBlockSize);
-            bufoffset += kBlockSize;
-            auto blk = block_id(i, dev);
-            DLOG(WARNING) << "write to block " << blk << " from buf + " << bufoffset << " len " << kBlockSize;
-            if (dev->write(blk, &data) != kSuccess) {
-                DLOG(WARNING) << "write block " << i << " failed at write_data";
-                return kFail;
-            }
+        blocks.emplace_back(ids[i - lid], blk);
+    }
+    /* the first and last block are read-modify-write, unless the write covers them whole. */
+    vector<pair<blk_id_t, Block *>> edges;
+    if (first_part) {
+        edges.emplace_back(blocks.front().first, &data.front());
+    }
+    if (last_part) {
+        edges.emplace_back(blocks.back().first, &data.back());
+    }
+    if (!edges.empty() && dev->read_direct(edges) != kSuccess) {
+        DLOG(WARNING) << "read first / last block failed at write_data";
+        return kFail;
+    }
+    if (!in_place) {
+        memcpy((uint8_t *)data.data() + head, buf, len);
+    } else {
+        if (first_part) {
+            memcpy(data.front().data + head, buf, std::min<uint32_t>(len, kBlockSize - head));
         }
-        if (roff > 0) {
-            auto rblk = block_id(rid, dev);
-            if (dev->read(rblk, &data) != kSuccess) {
-                DLOG(WARNING) << "read block " << rblk << " failed at write_data";
-                return kFail;
-            }
-            memcpy(data.data, buf + bufoffset, roff);
-            DLOG(WARNING) << "write to block " << rblk << " offset " << 0 << " from buf + " << bufoffset << " len "
-                          << roff;
-            if (dev->write(rblk, &data) != kSuccess) {
-                DLOG(WARNING) << "write block " << rblk << " failed at write_data";
-                return kFail;
-            }
+        if (last_part) {
+            memcpy(data.back().data, base + (uint64_t)(rid - lid) * kBlockSize, tail);
         }
     }
+    if (dev->write_direct(blocks) != kSuccess) {
+        DLOG(WARNING) << "write blocks " << lid << " to " << rid << " failed at write_data";
+        return kFail;
+    }
     return len;
 }
 
-int DiskInode::sync_data(BlockDevice *dev, bool indirect) {
-    int data_blk = data_blocks(size);
-    for (int i = 0; i < data_blk; ++i) {
-        if (dev->sync(block_id(i, dev)) != kSuccess) {
-            DLOG(WARNING) << "sync block " << block_id(i, dev) << " failed at sync_data";
-            return kFail;
-        }
-    }
-    if (indirect) {
-        if (indirect1 != 0) {
-            if (dev->sync(indirect1) != kSuccess) {
-                DLOG(WARNING) << "sync block " << indirect1 << " failed at sync_data";
-                return kFail;
-            }
-        }
-        if (indirect2 != 0) {
-            int rest = total_blocks(size) - data_blk - 2;  // remove indirect1 and indirect2
-            Block buf;
-            if (dev->read(indirect2, &buf) != kSuccess) {
-                DLOG(WARNING) << "read block " << indirect2 << " failed at sync_data";
-                return kFail;
-            }
-            auto p = (uint32_t *)buf.data;
-            for (int i = 0; i < rest; ++i) {
-                if (dev->sync(p[i]) != kSuccess) {
-                    DLOG(WARNING) << "sync block " << p[i] << " failed at sync_data";
-                    return kFail;
-                }
-            }
-            if (dev->sync(indirect2) != kSuccess) {
-                DLOG(WARNING) << "sync block " << indirect2 << " failed at sync_data";
-                return kFail;
-            }
-        }
+int DiskInode::sync_data(BlockDevice *dev, uint32_t owner, const std::vector<blk_id_t> &meta_ids) {
+    if (dev->fsync(owner, meta_ids) != kSuccess) {
+        DLOG(WARNING) << "fsync inode " << owner << " failed at sync_data";
+        return kFail;
     }
     return kSuccess;
 }
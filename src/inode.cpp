@@ -9,68 +9,117 @@
 namespace sbfs {
 
 int Inode::read_inode(DiskInode *buf) const {
-    Block blk;
-    CHECK_RET(fs->device()->read(pos.block_id, &blk));
-    memcpy(buf, blk.data + pos.block_offset, sizeof(DiskInode));
+    const DiskInode *inode = fs->inode_cache_->get(fs->getDiskInodeId(pos), pos);
+    if (inode == nullptr) {
+        return kFail;
+    }
+    memcpy(buf, inode, sizeof(DiskInode));
     return kSuccess;
 }
 
 int Inode::write_inode(const DiskInode *buf) const {
-    Block blk;
-    CHECK_RET(fs->device()->read(pos.block_id, &blk));
-    memcpy(blk.data + pos.block_offset, buf, sizeof(DiskInode));
-    CHECK_RET(fs->device()->write(pos.block_id, &blk));
-    return kSuccess;
+    return fs->inode_cache_->put(fs->getDiskInodeId(pos), pos, *buf);
 }
 
-int Inode::read_data(uint32_t offset, uint8_t *buf, uint32_t size) const {
+int Inode::read_data(uint32_t offset, uint8_t *buf, uint32_t size, bool direct) const {
     DiskInode disk_inode;
     CHECK_RET(read_inode(&disk_inode));
     DLOG(WARNING) << "Read data: " << offset << " " << size;
-    int len = disk_inode.read_data(offset, buf, size, fs->device());
+    auto file = delayed();
+    if (file != nullptr && direct) {
+        /* direct I/O reads the disk, the buffered writes go there first. */
+        CHECK_RET(flush());
+        CHECK_RET(read_inode(&disk_inode));
+    } else if (file != nullptr && offset <= file->size) {
+        /* the file ends at file->size, past disk_inode.size, the rest of the read is buffered (or zero). */
+        size = std::min(size, file->size - offset);
+        if (offset + size > disk_inode.size) {
+            int len = read_delayed(&disk_inode, offset, buf, size);
+            CHECK_RET(len);
+            CHECK_RET(write_inode(&disk_inode));
+            return len;
+        }
+    }
+    int len = disk_inode.read_data(offset, buf, size, fs->device(), direct, block_map());
     CHECK_RET(len);
+    if (len > 0 && !direct) {
+        uint32_t start, count;
+        fs->readahead_->on_read(fs->getDiskInodeId(pos), offset / kBlockSize, (offset + len - 1) / kBlockSize, &start,
+                               &count);
+        if (count > 0 && disk_inode.prefetch(start, count, fs->device(), block_map()) != kSuccess) {
+            /* readahead is only a hint. */
+            DLOG(WARNING) << "prefetch " << count << " blocks from " << start << " failed";
+        }
+    }
     CHECK_RET(write_inode(&disk_inode));
     return len;
 }
 
-int Inode::write_data(uint32_t offset, const uint8_t *buf, uint32_t size) const {
+int Inode::write_data(uint32_t offset, const uint8_t *buf, uint32_t size, bool direct) const {
     DiskInode disk_inode;
     CHECK_RET(read_inode(&disk_inode));
-    if (disk_inode.size < offset + size) {  // increase
-        disk_inode.resize(offset + size, fs->data_bitmap_, fs->device());
+    if (delayed() != nullptr && direct) {
+        /* direct I/O writes the disk, the buffered writes go there first. */
+        CHECK_RET(flush());
+        CHECK_RET(read_inode(&disk_inode));
+    }
+    if (fs->delalloc_ != nullptr && !direct && offset + size > alloc_end(disk_inode)) {
+        CHECK_RET(write_delayed(&disk_inode, offset, buf, size));
+        CHECK_RET(write_inode(&disk_inode));
+        if (fs->delalloc_->buffered() > kDelallocMaxBlocks) {
+            CHECK_RET(fs->flush_delayed());
+        }
+        return size;
+    }
+    int len;
+    {
+        /* data and index blocks belong to this inode, so that sync() finds them. */
+        OwnerScope scope(fs->device(), fs->getDiskInodeId(pos));
+        if (delayed() != nullptr) {
+            /* in the last allocated block of a file with buffered writes, past its written part. */
+            CHECK_RET(zero_tail(&disk_inode, offset));
+        }
+        if (disk_inode.size < offset + size) {  // increase
+            CHECK_RET(grow(&disk_inode, offset + size));
+        }
+        DLOG(WARNING) << "Write data: " << offset << " " << size;
+        len = disk_inode.write_data(offset, buf, size, fs->device(), direct, block_map());
     }
-    DLOG(WARNING) << "Write data: " << offset << " " << size;
-    int len = disk_inode.write_data(offset, buf, size, fs->device());
     CHECK_RET(len);
     CHECK_RET(write_inode(&disk_inode));
     return len;
 }
 
 int Inode::create(const char *name, DiskInode *disk_inode, Inode *inode) const {
+    Transaction tx(fs->device());
     DiskInode cur_disk_inode;
     CHECK_RET(read_inode(&cur_disk_inode));
     if (cur_disk_inode.type != kDirectory) {
         return kFail;
     }
+    if (fs->extents_) {
+        disk_inode->use_extents();
+    }
     // allocate inode id
-    auto new_inode_id = fs->alloc_inode();
+    auto new_inode_id = fs->alloc_inode(fs->getDiskInodeId(pos), disk_inode->type == kDirectory);
+    if (new_inode_id == (uint32_t)kFail) {
+        return kFail;
+    }
     *inode = { .pos = fs->getDiskInodePos(new_inode_id), .fs = fs };
     // allocate block and update parent directory
     // increase
-    CHECK_RET(cur_disk_inode.resize(cur_disk_inode.size + sizeof(DirEntry), fs->data_bitmap_, fs->device()));
-    DirEntry entry(name, new_inode_id);
-    CHECK_RET(cur_disk_inode.write_data(cur_disk_inode.size - sizeof(DirEntry), (uint8_t *)&entry, sizeof(DirEntry),
-                                        fs->device()));
+    CHECK_RET(grow(&cur_disk_inode, cur_disk_inode.size + sizeof(DirEntry)));
+    CHECK_RET(put_entry(&cur_disk_inode, cur_disk_inode.size / sizeof(DirEntry) - 1, DirEntry(name, new_inode_id)));
     if (disk_inode->type == kDirectory) {  // create . and ..
-        DirEntry new_dir_entries[2] = { DirEntry(".", new_inode_id), DirEntry("..", fs->getDiskInodeId(pos)) };
         // increase
-        CHECK_RET(disk_inode->resize(disk_inode->size + sizeof(DirEntry) * 2, fs->data_bitmap_, fs->device()));
-        CHECK_RET(disk_inode->write_data(disk_inode->size - sizeof(DirEntry) * 2, (uint8_t *)&new_dir_entries,
-                                         sizeof(DirEntry) * 2, fs->device()));
+        CHECK_RET(inode->grow(disk_inode, disk_inode->size + sizeof(DirEntry) * 2));
+        CHECK_RET(put_entry(disk_inode, 0, DirEntry(".", new_inode_id)));
+        CHECK_RET(put_entry(disk_inode, 1, DirEntry("..", fs->getDiskInodeId(pos))));
     }
     // write new inode
     CHECK_RET(inode->write_inode(disk_inode));
-    return write_inode(&cur_disk_inode);
+    CHECK_RET(write_inode(&cur_disk_inode));
+    return tx.commit();
 }
 
 int Inode::find(const char *name, Inode *inode) const {
@@ -79,18 +128,9 @@ int Inode::find(const char *name, Inode *inode) const {
     if (disk_inode.type != kDirectory) {
         return kFail;
     }
-    auto tot_blocks = disk_inode.total_blocks(disk_inode.size);
-    DirBlock dir_blk;
-    for (auto i = 0; i < tot_blocks; ++i) {
-        CHECK_RET(disk_inode.read_data(i * sizeof(DirBlock), (uint8_t *)&dir_blk, sizeof(DirBlock), fs->device()));
-        for (auto &entry : dir_blk.entries) {
-            if (strcmp(entry.name, name) == 0) {
-                *inode = { .pos = fs->getDiskInodePos(entry.inode), .fs = fs };
-                return kSuccess;
-            }
-        }
-    }
-    return kFail;
+    uint32_t idx;
+    CHECK_RET(find_entry(&disk_inode, name, &idx, inode));
+    return kSuccess;
 }
 
 int Inode::resize(uint32_t new_size) const {
@@ -99,50 +139,70 @@ int Inode::resize(uint32_t new_size) const {
     if (disk_inode.type != kFile) {
         return kFail;
     }
+    OwnerScope scope(fs->device(), fs->getDiskInodeId(pos));
+    auto file = delayed();
+    if (fs->delalloc_ != nullptr && new_size > alloc_end(disk_inode)) {
+        /* past the allocated blocks, only the buffered part changes. */
+        disk_inode.update_meta(7);
+        if (file != nullptr && new_size < file->size) {
+            fs->delalloc_->truncate(file, (new_size + kBlockSize - 1) / kBlockSize);
+            auto blk = file->blocks.find(new_size / kBlockSize);
+            if (blk != file->blocks.end()) {
+                memset(blk->second->data + new_size % kBlockSize, 0, kBlockSize - new_size % kBlockSize);
+            }
+            file->size = new_size;
+            fs->delalloc_->reserve(file, disk_inode.grow_blocks(file->alloc_end, new_size));
+        } else {
+            CHECK_RET(write_delayed(&disk_inode, new_size, nullptr, 0));
+        }
+        return write_inode(&disk_inode);
+    }
+    if (file != nullptr) {
+        /* shrinking into the allocated blocks, the buffered ones are gone. */
+        CHECK_RET(zero_tail(&disk_inode, new_size));
+        fs->delalloc_->drop(fs->getDiskInodeId(pos));
+    }
     if (new_size > disk_inode.size) {  // increase
-        CHECK_RET(disk_inode.resize(new_size, fs->data_bitmap_, fs->device()));
+        CHECK_RET(grow(&disk_inode, new_size));
         return write_inode(&disk_inode);
     } else {  // decrease
+        fs->readahead_->forget(fs->getDiskInodeId(pos));
+        /* zero the cut tail of the last block, the file may grow into it again. */
+        uint32_t tail_end = std::min<uint32_t>(disk_inode.size, (new_size + kBlockSize - 1) / kBlockSize * kBlockSize);
+        if (new_size < tail_end) {
+            static const Block zero{};
+            CHECK_RET(disk_inode.write_data(new_size, zero.data, tail_end - new_size, fs->device()));
+        }
+        /* the cut blocks are freed, and may be reused by other files. */
+        fs->block_map_->truncate(fs->getDiskInodeId(pos), (new_size + kBlockSize - 1) / kBlockSize);
         return disk_inode.resize(new_size, fs->data_bitmap_, fs->device(), this);
     }
 }
 
 int Inode::remove(const char *name) const {
+    Transaction tx(fs->device());
     DiskInode disk_inode;
     CHECK_RET(read_inode(&disk_inode));
     if (disk_inode.type != kDirectory) {
         return kFail;
     }
-    auto tot_blocks = disk_inode.total_blocks(disk_inode.size);
-    DirBlock dir_blk;
-    for (auto i = 0; i < tot_blocks; ++i) {
-        CHECK_RET(disk_inode.read_data(i * sizeof(DirBlock), (uint8_t *)&dir_blk, sizeof(DirBlock), fs->device()));
-        for (auto j = 0; j < kDirEntries; ++j) {
-            if (strcmp(dir_blk.entries[j].name, name) == 0) {
-                Inode del_inode = { .pos = fs->getDiskInodePos(dir_blk.entries[j].inode), .fs = fs };
-                DiskInode del_disk_inode;
-                CHECK_RET(del_inode.read_inode(&del_disk_inode));
-                --del_disk_inode.link_cnt;
-                if (del_disk_inode.link_cnt == 0) {
-                    if (i != tot_blocks - 1 || j != kDirEntries - 1) {  // move the last entry here
-                        DirEntry last_entry;
-                        CHECK_RET(disk_inode.read_data(disk_inode.size - sizeof(DirEntry), (uint8_t *)&last_entry,
-                                                       sizeof(DirEntry), fs->device()));
-                        CHECK_RET(disk_inode.write_data(i * sizeof(DirBlock) + j * sizeof(DirEntry),
-                                                        (uint8_t *)&last_entry, sizeof(DirEntry), fs->device()));
-                    }
-                    // decrease
-                    CHECK_RET(disk_inode.resize(disk_inode.size - sizeof(DirEntry), fs->data_bitmap_, fs->device(), this));
-                    CHECK_RET(fs->free_inode(dir_blk.entries[j].inode));
-                    // decrease
-                    return del_disk_inode.resize(0, del_inode.fs->data_bitmap_, del_inode.fs->device());
-                } else {
-                    return write_inode(&disk_inode);
-                }
-            }
-        }
+    uint32_t idx;
+    Inode del_inode;
+    CHECK_RET(find_entry(&disk_inode, name, &idx, &del_inode));
+    uint32_t del_id = fs->getDiskInodeId(del_inode.pos);
+    DiskInode del_disk_inode;
+    CHECK_RET(del_inode.read_inode(&del_disk_inode));
+    --del_disk_inode.link_cnt;
+    if (del_disk_inode.link_cnt == 0) {
+        CHECK_RET(drop_entry(&disk_inode, idx));
+        // decrease
+        CHECK_RET(del_disk_inode.resize(0, del_inode.fs->data_bitmap_, del_inode.fs->device()));
+        /* last, the caches of the inode are dropped with it. */
+        CHECK_RET(fs->free_inode(del_id));
+    } else {
+        CHECK_RET(write_inode(&disk_inode));
     }
-    return kFail;
+    return tx.commit();
 }
 
 int Inode::link(const char *name, const Inode *inode, bool replace) const {
@@ -157,61 +217,38 @@ int Inode::link(const char *name, const Inode *inode, bool replace) const {
         ++raw_disk_inode.link_cnt;
         return inode->write_inode(&raw_disk_inode);
     };
+    OwnerScope scope(fs->device(), fs->getDiskInodeId(pos));
     // find entry with same name
-    auto tot_blocks = disk_inode.total_blocks(disk_inode.size);
-    DirBlock dir_blk;
-    for (auto i = 0; i < tot_blocks; ++i) {
-        CHECK_RET(disk_inode.read_data(i * sizeof(DirBlock), (uint8_t *)&dir_blk, sizeof(DirBlock), fs->device()));
-        for (auto j = 0; j < kDirEntries; ++j) {
-            if (strcmp(dir_blk.entries[j].name, name) == 0) {
-                if (!replace) {
-                    return kFail;
-                }
-                CHECK_RET(update_link_cnt());
-                DirEntry entry(dir_blk.entries[j].name, fs->getDiskInodeId(inode->pos));
-                CHECK_RET(disk_inode.write_data(i * sizeof(DirBlock) + j * sizeof(DirEntry), (uint8_t *)&entry,
-                                                sizeof(DirEntry), fs->device()));
-                return write_inode(&disk_inode);
-            }
+    uint32_t idx;
+    Inode old;
+    if (find_entry(&disk_inode, name, &idx, &old) == kSuccess) {
+        if (!replace) {
+            return kFail;
         }
+        CHECK_RET(update_link_cnt());
+        CHECK_RET(put_entry(&disk_inode, idx, DirEntry(name, fs->getDiskInodeId(inode->pos))));
+        return write_inode(&disk_inode);
     }
     CHECK_RET(update_link_cnt());
     // create new entry
     // increase
-    CHECK_RET(disk_inode.resize(disk_inode.size + sizeof(DirEntry), fs->data_bitmap_, fs->device()));
-    DirEntry entry(name, inode->fs->getDiskInodeId(inode->pos));
-    CHECK_RET(disk_inode.write_data(disk_inode.size - sizeof(DirEntry), (uint8_t *)&entry, sizeof(DirEntry),
-                                    fs->device()));
+    CHECK_RET(grow(&disk_inode, disk_inode.size + sizeof(DirEntry)));
+    CHECK_RET(put_entry(&disk_inode, disk_inode.size / sizeof(DirEntry) - 1,
+                        DirEntry(name, inode->fs->getDiskInodeId(inode->pos))));
     return write_inode(&disk_inode);
 }
 
 int Inode::unlink(const char *name, Inode *inode) const {
     auto ret = [&]() {  // find and remove it without releasing
+        OwnerScope scope(fs->device(), fs->getDiskInodeId(pos));
         DiskInode disk_inode;
         CHECK_RET(read_inode(&disk_inode));
         if (disk_inode.type != kDirectory) {
             return kFail;
         }
-        auto tot_blocks = disk_inode.total_blocks(disk_inode.size);
-        DirBlock dir_blk;
-        for (auto i = 0; i < tot_blocks; ++i) {
-            CHECK_RET(disk_inode.read_data(i * sizeof(DirBlock), (uint8_t *)&dir_blk, sizeof(DirBlock), fs->device()));
-            for (auto j = 0; j < kDirEntries; ++j) {
-                if (strcmp(dir_blk.entries[j].name, name) == 0) {
-                    *inode = { .pos = fs->getDiskInodePos(dir_blk.entries[j].inode), .fs = fs };
-                    if (i != tot_blocks - 1 || j != kDirEntries - 1) {  // move the last entry here
-                        DirEntry last_entry;
-                        CHECK_RET(disk_inode.read_data(disk_inode.size - sizeof(DirEntry), (uint8_t *)&last_entry,
-                                                       sizeof(DirEntry), fs->device()));
-                        CHECK_RET(disk_inode.write_data(i * sizeof(DirBlock) + j * sizeof(DirEntry),
-                                                        (uint8_t *)&last_entry, sizeof(DirEntry), fs->device()));
-                    }
-                    // decrease
-                    return disk_inode.resize(disk_inode.size - sizeof(DirEntry), fs->data_bitmap_, fs->device(), this);
-                }
-            }
-        }
-        return kFail;
+        uint32_t idx;
+        CHECK_RET(find_entry(&disk_inode, name, &idx, inode));
+        return drop_entry(&disk_inode, idx);
     }();
     if (ret == kSuccess) {  // update link_cnt
         DiskInode raw_disk_inode;
@@ -223,14 +260,218 @@ int Inode::unlink(const char *name, Inode *inode) const {
     }
 }
 
-int Inode::sync(bool metadata) const {
+int Inode::pin_entries(DiskInode *disk_inode, uint32_t idx, BlockRef *ref, DirEntry **entries) const {
+    blk_id_t block_id = disk_inode->block_id(idx / kDirEntries, fs->device());
+    if (block_id == (blk_id_t)kFail) {
+        return kFail;
+    }
+    CHECK_RET(fs->device()->pin(block_id, ref));
+    *entries = ref->as<DirEntry>();
+    return kSuccess;
+}
+
+int Inode::find_entry(DiskInode *disk_inode, const char *name, uint32_t *idx, Inode *inode) const {
+    uint32_t cnt = disk_inode->size / sizeof(DirEntry);
+    BlockRef ref;
+    DirEntry *entries;
+    for (uint32_t i = 0; i < cnt; i += kDirEntries) {
+        CHECK_RET(pin_entries(disk_inode, i, &ref, &entries));
+        for (uint32_t j = 0; j < kDirEntries && i + j < cnt; ++j) {
+            if (strcmp(entries[j].name, name) == 0) {
+                *idx = i + j;
+                *inode = { .pos = fs->getDiskInodePos(entries[j].inode), .fs = fs };
+                return kSuccess;
+            }
+        }
+    }
+    return kFail;
+}
+
+int Inode::put_entry(DiskInode *disk_inode, uint32_t idx, const DirEntry &entry) const {
+    BlockRef ref;
+    DirEntry *entries;
+    CHECK_RET(pin_entries(disk_inode, idx, &ref, &entries));
+    entries[idx % kDirEntries] = entry;
+    ref.mark_dirty();
+    return kSuccess;
+}
+
+int Inode::drop_entry(DiskInode *disk_inode, uint32_t idx) const {
+    uint32_t last = disk_inode->size / sizeof(DirEntry) - 1;
+    if (idx != last) {  // move the last entry here
+        BlockRef ref;
+        DirEntry *entries;
+        CHECK_RET(pin_entries(disk_inode, last, &ref, &entries));
+        DirEntry last_entry = entries[last % kDirEntries];
+        ref.release();
+        CHECK_RET(put_entry(disk_inode, idx, last_entry));
+    }
+    // decrease
+    return disk_inode->resize(disk_inode->size - sizeof(DirEntry), fs->data_bitmap_, fs->device(), this);
+}
+
+DelayedAlloc::File *Inode::delayed() const {
+    return fs->delalloc_ != nullptr ? fs->delalloc_->find(fs->getDiskInodeId(pos)) : nullptr;
+}
+
+BlockMap::File *Inode::block_map() const {
+    return fs->block_map_->get(fs->getDiskInodeId(pos));
+}
+
+uint32_t Inode::file_size(const DiskInode &disk_inode) const {
+    auto file = delayed();
+    return file != nullptr ? file->size : disk_inode.size;
+}
+
+uint32_t Inode::alloc_end(const DiskInode &disk_inode) const {
+    auto file = delayed();
+    return file != nullptr ? file->alloc_end : (disk_inode.size + kBlockSize - 1) / kBlockSize * kBlockSize;
+}
+
+int Inode::grow(DiskInode *disk_inode, uint32_t new_size) const {
+    if (fs->delalloc_ != nullptr) {
+        auto file = delayed();
+        uint64_t reserved = fs->delalloc_->reserved() - (file != nullptr ? file->reserved : 0);
+        uint64_t need = disk_inode->grow_blocks(alloc_end(*disk_inode), new_size);
+        if (need > 0 && fs->data_bitmap_->free_count() < reserved + need) {
+            DLOG(WARNING) << "grow to " << new_size << " failed, " << fs->data_bitmap_->free_count() << " free, "
+                          << reserved << " reserved";
+            return kFail;
+        }
+    }
+    return disk_inode->resize(new_size, fs->data_bitmap_, fs->device(), nullptr, data_goal());
+}
+
+int Inode::zero_tail(DiskInode *disk_inode, uint32_t end) const {
+    if (disk_inode->size >= end) {
+        return kSuccess;
+    }
+    static const Block zero{};
+    uint32_t old_size = disk_inode->size;
+    disk_inode->size = end;
+    return disk_inode->write_data(old_size, zero.data, end - old_size, fs->device());
+}
+
+int Inode::write_delayed(DiskInode *disk_inode, uint32_t offset, const uint8_t *buf, uint32_t size) const {
+    auto file = delayed();
+    uint32_t alloc_end = this->alloc_end(*disk_inode);
+    uint32_t end = offset + size, new_size = std::max(file_size(*disk_inode), end);
+    /* reserve first (the index blocks the flush will need too), nothing changes if there isn't enough space. */
+    uint32_t reserved = disk_inode->grow_blocks(alloc_end, new_size);
+    uint32_t old_reserved = file != nullptr ? file->reserved : 0;
+    if (reserved > old_reserved &&
+        fs->data_bitmap_->free_count() < fs->delalloc_->reserved() + reserved - old_reserved) {
+        DLOG(WARNING) << "reserve " << reserved << " blocks failed, " << fs->data_bitmap_->free_count() << " free";
+        return kFail;
+    }
+    disk_inode->update_meta(3);
+    if (offset < alloc_end) {
+        /* the head of the write fills the last allocated block, the gap before it is zero. */
+        OwnerScope scope(fs->device(), fs->getDiskInodeId(pos));
+        CHECK_RET(zero_tail(disk_inode, alloc_end));
+        CHECK_RET(disk_inode->write_data(offset, buf, alloc_end - offset, fs->device()));
+    }
+    file = fs->delalloc_->get(fs->getDiskInodeId(pos), alloc_end);
+    for (uint32_t cur = std::max(offset, alloc_end); cur < end;) {
+        uint32_t in = cur % kBlockSize, n = std::min<uint32_t>(end - cur, kBlockSize - in);
+        memcpy(fs->delalloc_->block(file, cur / kBlockSize)->data + in, buf + (cur - offset), n);
+        cur += n;
+    }
+    file->size = new_size;
+    fs->delalloc_->reserve(file, reserved);
+    return kSuccess;
+}
+
+int Inode::read_delayed(DiskInode *disk_inode, uint32_t offset, uint8_t *buf, uint32_t size) const {
+    auto file = delayed();
+    if (offset > file->size) {
+        DLOG(WARNING) << "read data offset out of range";
+        return kFail;
+    }
+    size = std::min(size, file->size - offset);
+    if (offset < disk_inode->size) {
+        CHECK_RET(disk_inode->read_data(offset, buf, disk_inode->size - offset, fs->device()));
+    } else {
+        disk_inode->update_meta(1);
+    }
+    for (uint32_t cur = std::max(offset, disk_inode->size); cur < offset + size;) {
+        uint32_t in = cur % kBlockSize, n = std::min<uint32_t>(offset + size - cur, kBlockSize - in);
+        auto blk = file->blocks.find(cur / kBlockSize);
+        if (blk != file->blocks.end()) {
+            memcpy(buf + (cur - offset), blk->second->data + in, n);
+        } else {
+            memset(buf + (cur - offset), 0, n);
+        }
+        cur += n;
+    }
+    return size;
+}
+
+int Inode::flush() const {
+    auto file = delayed();
+    if (file == nullptr) {
+        return kSuccess;
+    }
     DiskInode disk_inode;
     CHECK_RET(read_inode(&disk_inode));
-    CHECK_RET(disk_inode.sync_data(fs->device()));
+    uint32_t inode_id = fs->getDiskInodeId(pos), start = file->alloc_end, end = file->size;
+    /* whole blocks are written (start is block aligned), so the tail of the last one is zero too. */
+    uint32_t blocks_end = (end + kBlockSize - 1) / kBlockSize * kBlockSize;
+    /* the times are of the buffered writes, not of this. */
+    uint32_t times[] = { disk_inode.access_time, disk_inode.modify_time, disk_inode.change_time };
+    {
+        OwnerScope scope(fs->device(), inode_id);
+        /* the last allocated block becomes part of the file up to its end. */
+        CHECK_RET(zero_tail(&disk_inode, start));
+        /* one allocation for all of them, right after the last block of the file. */
+        CHECK_RET(disk_inode.resize(blocks_end, fs->data_bitmap_, fs->device(), nullptr, data_goal()));
+        /* in batches, holes as zero blocks. */
+        uint64_t threshold = fs->device()->direct_io_threshold();
+        std::vector<Block> data(kWritebackBatchBlocks);
+        for (uint32_t off = start; off < blocks_end;) {
+            uint32_t len = std::min<uint64_t>(blocks_end - off, kWritebackBatchBlocks * kBlockSize);
+            for (uint32_t i = 0; i * kBlockSize < len; ++i) {
+                auto blk = file->blocks.find(off / kBlockSize + i);
+                if (blk != file->blocks.end()) {
+                    data[i] = *blk->second;
+                } else {
+                    memset(&data[i], 0, sizeof(Block));
+                }
+            }
+            bool direct = threshold != 0 && len >= threshold;
+            CHECK_RET(disk_inode.write_data(off, data[0].data, len, fs->device(), direct, block_map()));
+            off += len;
+        }
+    }
+    disk_inode.size = end;
+    disk_inode.access_time = times[0];
+    disk_inode.modify_time = times[1];
+    disk_inode.change_time = times[2];
+    DLOG(INFO) << "flush delayed allocation of inode " << inode_id << " from " << start << " to " << end;
+    Stats::add(kDelallocFlushes);
+    Stats::add(kDelallocBlocks, (end - start + kBlockSize - 1) / kBlockSize);
+    fs->delalloc_->drop(inode_id);
+    return write_inode(&disk_inode);
+}
+
+blk_id_t Inode::data_goal() const {
+    return fs->data_goal(fs->getDiskInodeId(pos));
+}
+
+int Inode::sync(bool metadata) const {
+    /* called without the vfs lock, read the inode from its block (written back by the caller), not InodeCache. */
+    DiskInode disk_inode;
+    {
+        BlockRef ref;
+        CHECK_RET(fs->device()->pin(pos.block_id, &ref));
+        memcpy(&disk_inode, ref.data() + pos.block_offset, sizeof(DiskInode));
+    }
+    /* index blocks are synced too, and the inode block is logged in the same group commit as the data. */
+    std::vector<blk_id_t> meta_ids;
     if (metadata) {
-        CHECK_RET(fs->device()->sync(pos.block_id));
+        meta_ids.push_back(pos.block_id);
     }
-    return kSuccess;
+    return disk_inode.sync_data(fs->device(), fs->getDiskInodeId(pos), meta_ids);
 }
 
 }  // namespace sbfs
\ No newline at end of file
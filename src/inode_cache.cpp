@@ -0,0 +1,171 @@
+#include "inode_cache.h"
+
+namespace sbfs {
+int InodeCache::make_room() {
+    /* not in a transaction, the inodes written back would be lost if it's aborted. */
+    if (inodes_.size() < kInodeCacheSize || device_->in_tx()) {
+        return kSuccess;
+    }
+    if (writeback_all() != kSuccess) {
+        return kFail;
+    }
+    for (auto it = inodes_.begin(); it != inodes_.end();) {
+        it = it->second.refs == 0 ? inodes_.erase(it) : std::next(it);
+    }
+    return kSuccess;
+}
+
+InodeCache::Entry *InodeCache::load(uint32_t inode_id, const Position &pos) {
+    auto it = inodes_.find(inode_id);
+    if (it != inodes_.end()) {
+        return &it->second;
+    }
+    if (make_room() != kSuccess) {
+        return nullptr;
+    }
+    Entry entry{ DiskInode(), pos, 0, false };
+    BlockRef ref;
+    if (device_->pin(pos.block_id, &ref) != kSuccess) {
+        return nullptr;
+    }
+    memcpy(&entry.inode, ref.data() + pos.block_offset, sizeof(DiskInode));
+    return &inodes_.emplace(inode_id, entry).first->second;
+}
+
+const DiskInode *InodeCache::get(uint32_t inode_id, const Position &pos) {
+    Entry *entry = load(inode_id, pos);
+    return entry == nullptr ? nullptr : &entry->inode;
+}
+
+int InodeCache::put(uint32_t inode_id, const Position &pos, const DiskInode &inode) {
+    keep_for_abort(inode_id);
+    auto it = inodes_.find(inode_id);
+    if (it == inodes_.end()) {
+        /* the whole inode is replaced, no need to read it. */
+        if (make_room() != kSuccess) {
+            return kFail;
+        }
+        it = inodes_.emplace(inode_id, Entry{ inode, pos, 0, false }).first;
+    } else {
+        it->second.inode = inode;
+    }
+    if (!it->second.dirty) {
+        it->second.dirty = true;
+        dirty_[pos.block_id].push_back(inode_id);
+    }
+    if (device_->in_tx()) {
+        return writeback(pos.block_id);
+    }
+    return kSuccess;
+}
+
+int InodeCache::open(uint32_t inode_id, const Position &pos) {
+    Entry *entry = load(inode_id, pos);
+    if (entry == nullptr) {
+        return kFail;
+    }
+    ++entry->refs;
+    return kSuccess;
+}
+
+void InodeCache::close(uint32_t inode_id) {
+    auto it = inodes_.find(inode_id);
+    if (it != inodes_.end() && it->second.refs > 0) {
+        --it->second.refs;
+    }
+}
+
+void InodeCache::drop(uint32_t inode_id) {
+    auto it = inodes_.find(inode_id);
+    if (it == inodes_.end()) {
+        return;
+    }
+    keep_for_abort(inode_id);
+    unlist(it->second, inode_id);
+    if (it->second.refs == 0) {
+        inodes_.erase(it);
+    }
+}
+
+void InodeCache::unlist(Entry &entry, uint32_t inode_id) {
+    if (entry.dirty) {
+        auto block = dirty_.find(entry.pos.block_id);
+        auto &ids = block->second;
+        ids.erase(std::find(ids.begin(), ids.end(), inode_id));
+        if (ids.empty()) {
+            dirty_.erase(block);
+        }
+        entry.dirty = false;
+    }
+}
+
+void InodeCache::keep_for_abort(uint32_t inode_id) {
+    if (!device_->in_tx()) {
+        return;
+    }
+    auto it = inodes_.find(inode_id);
+    bool cached = it != inodes_.end();
+    Entry old = cached ? it->second : Entry{};
+    device_->on_abort([this, inode_id, cached, old]() {
+        auto cur = inodes_.find(inode_id);
+        if (cur != inodes_.end()) {
+            unlist(cur->second, inode_id);
+            if (!cached) {
+                inodes_.erase(cur);
+                return;
+            }
+            cur->second.inode = old.inode;
+        } else if (cached) {
+            cur = inodes_.emplace(inode_id, old).first;
+            cur->second.dirty = false;
+        } else {
+            return;
+        }
+        if (old.dirty) {
+            cur->second.dirty = true;
+            dirty_[old.pos.block_id].push_back(inode_id);
+        }
+    });
+}
+
+int InodeCache::writeback(blk_id_t block_id) {
+    auto block = dirty_.find(block_id);
+    if (block == dirty_.end()) {
+        return kSuccess;
+    }
+    BlockRef ref;
+    if (device_->pin(block_id, &ref) != kSuccess) {
+        return kFail;
+    }
+    if (device_->in_tx()) {
+        /* written to the transaction, they are dirty again if it's aborted. */
+        device_->on_abort([this, ids = block->second]() {
+            for (uint32_t inode_id : ids) {
+                auto it = inodes_.find(inode_id);
+                if (it != inodes_.end() && !it->second.dirty) {
+                    it->second.dirty = true;
+                    dirty_[it->second.pos.block_id].push_back(inode_id);
+                }
+            }
+        });
+    }
+    for (uint32_t inode_id : block->second) {
+        Entry &entry = inodes_.at(inode_id);
+        memcpy(ref.data() + entry.pos.block_offset, &entry.inode, sizeof(DiskInode));
+        entry.dirty = false;
+    }
+    ref.mark_dirty();
+    Stats::add(kInodeWritebacks);
+    dirty_.erase(block);
+    return kSuccess;
+}
+
+int InodeCache::writeback_all() {
+    while (!dirty_.empty()) {
+        if (writeback(dirty_.begin()->first) != kSuccess) {
+            return kFail;
+        }
+    }
+    return kSuccess;
+}
+}  // namespace sbfs
@@ -0,0 +1,262 @@
+#include "io_engine.h"
+
+#include "stats.h"
+
+namespace sbfs {
+#ifdef IO_URING
+/* limits of io_uring_register_buffers: number of buffers (IORING_MAX_REG_BUFFERS), and size of each (1GB) */
+constexpr uint32_t kMaxFixedBuffers = 1u << 14;
+constexpr uint64_t kFixedBufferBlocks = GB(1) / kBlockSize;
+#endif
+
+IOEngine::IOEngine(StorageBackend *backend, bool use_io_uring, uint32_t queue_depth)
+    : backend_(backend), fd_(backend->fd()), async_(false), queue_depth_(queue_depth), inflight_(0) {
+#ifdef IO_URING
+    free_request_ = -1;
+    fixed_base_ = nullptr;
+    fixed_count_ = 0;
+    if (use_io_uring && fd_ < 0) {
+        LOG(WARNING) << "backend has no file for io_uring, fallback to synchronous requests";
+    } else if (use_io_uring) {
+        int ret = io_uring_queue_init(queue_depth_, &ring_, 0);
+        if (ret < 0) {
+            LOG(WARNING) << "io_uring_queue_init failed " << strerror(-ret) << ", fallback to pread / pwrite";
+        } else {
+            async_ = true;
+            requests_.resize(queue_depth_);
+            for (int i = 0; i < queue_depth_; ++i) {
+                requests_[i].next_free = i + 1 < queue_depth_ ? i + 1 : -1;
+            }
+            free_request_ = 0;
+        }
+    }
+#else
+    rt_assert(!use_io_uring, "io_uring requested, but sbfs is built without IO_URING");
+#endif
+    DLOG(INFO) << "io engine created, async " << async_ << " queue depth " << queue_depth_;
+}
+
+IOEngine::~IOEngine() {
+#ifdef IO_URING
+    if (async_) {
+        drain();
+        io_uring_queue_exit(&ring_);
+    }
+#endif
+}
+
+int IOEngine::register_buffers(Block *base, uint64_t count) {
+#ifdef IO_URING
+    if (!async_) return kSuccess;
+    /* cut into buffers as large as allowed, fixed buffer i covers blocks [i, i + 1) * kFixedBufferBlocks. */
+    count = std::min<uint64_t>(count, kMaxFixedBuffers * kFixedBufferBlocks);
+    std::vector<iovec> iovs;
+    for (uint64_t i = 0; i < count; i += kFixedBufferBlocks) {
+        iovs.push_back(iovec{ base + i, std::min(kFixedBufferBlocks, count - i) * kBlockSize });
+    }
+    int ret = io_uring_register_buffers(&ring_, iovs.data(), iovs.size());
+    if (ret < 0) {
+        /* mostly RLIMIT_MEMLOCK, unfixed buffers still work. */
+        LOG(WARNING) << "io_uring_register_buffers failed " << strerror(-ret);
+        return kFail;
+    }
+    fixed_base_ = base;
+    fixed_count_ = count;
+    DLOG(INFO) << "registered " << count << " blocks as " << iovs.size() << " fixed buffers";
+#endif
+    return kSuccess;
+}
+
+void IOEngine::unregister_buffers() {
+#ifdef IO_URING
+    if (fixed_count_ == 0) return;
+    io_uring_unregister_buffers(&ring_);
+    fixed_base_ = nullptr;
+    fixed_count_ = 0;
+#endif
+}
+
+int IOEngine::read_async(blk_id_t block_id, Block *buf, io_callback_t cb) {
+#ifdef IO_URING
+    if (async_) {
+        Stats::add(kDiskReadBlocks);
+        int idx = fixed_index(buf);
+        return queue(std::move(cb), kBlockSize, [&](io_uring_sqe *sqe) {
+            if (idx >= 0) {
+                io_uring_prep_read_fixed(sqe, fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize, idx);
+            } else {
+                io_uring_prep_read(sqe, fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize);
+            }
+        });
+    }
+#endif
+    int ret = read(block_id, buf);
+    cb(ret);
+    return ret;
+}
+
+int IOEngine::write_async(blk_id_t block_id, const Block *buf, io_callback_t cb) {
+#ifdef IO_URING
+    if (async_) {
+        Stats::add(kDiskWriteBlocks);
+        int idx = fixed_index(buf);
+        return queue(std::move(cb), kBlockSize, [&](io_uring_sqe *sqe) {
+            if (idx >= 0) {
+                io_uring_prep_write_fixed(sqe, fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize, idx);
+            } else {
+                io_uring_prep_write(sqe, fd_, buf, kBlockSize, (uint64_t)block_id * kBlockSize);
+            }
+        });
+    }
+#endif
+    int ret = write(block_id, buf);
+    cb(ret);
+    return ret;
+}
+
+int IOEngine::poll(uint32_t min_complete) {
+#ifdef IO_URING
+    if (!async_) return kSuccess;
+    int ret = io_uring_submit_and_wait(&ring_, std::min(min_complete, inflight_));
+    if (ret < 0) {
+        DLOG(WARNING) << "io_uring_submit_and_wait failed " << strerror(-ret);
+        return kFail;
+    }
+    io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring_, &cqe) == 0) {
+        int idx = (int)(uintptr_t)io_uring_cqe_get_data(cqe);
+        int res = cqe->res == requests_[idx].expected ? kSuccess : kFail;
+        if (res == kFail) {
+            DLOG(WARNING) << "io_uring request failed, res " << cqe->res << " expected " << requests_[idx].expected;
+        }
+        io_uring_cqe_seen(&ring_, cqe);
+        auto cb = std::move(requests_[idx].cb);
+        requests_[idx].next_free = free_request_;
+        free_request_ = idx;
+        --inflight_;
+        if (cb) cb(res);
+    }
+#endif
+    return kSuccess;
+}
+
+int IOEngine::drain() {
+    while (inflight_ > 0) {
+        if (poll(1) != kSuccess) return kFail;
+    }
+    return kSuccess;
+}
+
+int IOEngine::read(blk_id_t block_id, Block *buf) {
+    LatencyTimer timer(kDiskReadLatency);
+#ifdef IO_URING
+    if (async_) {
+        int res = kFail;
+        bool done = false;
+        if (read_async(block_id, buf, [&](int r) { res = r, done = true; }) != kSuccess) return kFail;
+        return wait_for(done) == kSuccess ? res : kFail;
+    }
+#endif
+    Stats::add(kDiskReadBlocks);
+    return backend_->read(block_id, buf);
+}
+
+int IOEngine::write(blk_id_t block_id, const Block *buf) {
+    LatencyTimer timer(kDiskWriteLatency);
+#ifdef IO_URING
+    if (async_) {
+        int res = kFail;
+        bool done = false;
+        if (write_async(block_id, buf, [&](int r) { res = r, done = true; }) != kSuccess) return kFail;
+        return wait_for(done) == kSuccess ? res : kFail;
+    }
+#endif
+    Stats::add(kDiskWriteBlocks);
+    return backend_->write(block_id, buf);
+}
+
+int IOEngine::readv(blk_id_t block_id, const iovec *iov, int cnt) {
+    LatencyTimer timer(kDiskReadLatency);
+    Stats::add(kDiskReadBlocks, cnt);
+#ifdef IO_URING
+    if (async_) {
+        int res = kFail;
+        bool done = false;
+        auto cb = [&](int r) { res = r, done = true; };
+        if (queue(cb, cnt * kBlockSize, [&](io_uring_sqe *sqe) {
+                io_uring_prep_readv(sqe, fd_, iov, cnt, (uint64_t)block_id * kBlockSize);
+            }) != kSuccess) {
+            return kFail;
+        }
+        return wait_for(done) == kSuccess ? res : kFail;
+    }
+#endif
+    return backend_->readv(block_id, iov, cnt);
+}
+
+int IOEngine::writev(blk_id_t block_id, const iovec *iov, int cnt) {
+    LatencyTimer timer(kDiskWriteLatency);
+    Stats::add(kDiskWriteBlocks, cnt);
+#ifdef IO_URING
+    if (async_) {
+        int res = kFail;
+        bool done = false;
+        auto cb = [&](int r) { res = r, done = true; };
+        if (queue(cb, cnt * kBlockSize, [&](io_uring_sqe *sqe) {
+                io_uring_prep_writev(sqe, fd_, iov, cnt, (uint64_t)block_id * kBlockSize);
+            }) != kSuccess) {
+            return kFail;
+        }
+        return wait_for(done) == kSuccess ? res : kFail;
+    }
+#endif
+    return backend_->writev(block_id, iov, cnt);
+}
+
+int IOEngine::flush() {
+    LatencyTimer timer(kFlushLatency);
+    return backend_->flush();
+}
+
+#ifdef IO_URING
+int IOEngine::wait_for(bool &done) {
+    while (!done) {
+        if (poll(1) != kSuccess) return kFail;
+    }
+    return kSuccess;
+}
+
+int IOEngine::queue(io_callback_t cb, uint32_t expected, const std::function<void(io_uring_sqe *)> &prep) {
+    /* queue is full, reap some completions first. */
+    while (inflight_ >= queue_depth_) {
+        if (poll(1) != kSuccess) return kFail;
+    }
+    auto sqe = io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) {
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+        if (sqe == nullptr) {
+            DLOG(WARNING) << "io_uring_get_sqe failed";
+            return kFail;
+        }
+    }
+    int idx = free_request_;
+    rt_assert(idx != -1, "no free io request");
+    free_request_ = requests_[idx].next_free;
+    requests_[idx].cb = std::move(cb);
+    requests_[idx].expected = expected;
+    /* user data is set after prep, which may clear the sqe. */
+    prep(sqe);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)idx);
+    ++inflight_;
+    return kSuccess;
+}
+
+int IOEngine::fixed_index(const Block *buf) const {
+    if (buf < fixed_base_ || buf >= fixed_base_ + fixed_count_) {
+        return -1;
+    }
+    return (buf - fixed_base_) / kFixedBufferBlocks;
+}
+#endif
+}  // namespace sbfs
@@ -0,0 +1,221 @@
+#include "journal.h"
+
+#include "blk_dev.h"
+
+namespace sbfs {
+Journal::Journal(BlockDevice *dev, blk_id_t start_block, uint32_t num_blocks)
+    : dev_(dev), start_block_(start_block), num_blocks_(num_blocks), sequence_(0), head_(1), checkpointing_(false) {
+    DLOG(INFO) << "journal at " << start_block_ << " with " << num_blocks_ << " blocks";
+}
+
+int Journal::format() {
+    /* a random start sequence, so that transactions left by a previous FS on this disk are never replayed. */
+    sequence_ = std::random_device()();
+    head_ = 1;
+    logged_.clear();
+    return write_header();
+}
+
+int Journal::recover() {
+    JournalHeader header;
+    if (dev_->engine_->read(start_block_, (Block *)&header) != kSuccess) {
+        DLOG(WARNING) << "read journal header failed";
+        return kFail;
+    }
+    if (header.magic != kJournalMagic) {
+        LOG(WARNING) << "journal header not found, format the journal";
+        return format();
+    }
+    sequence_ = header.sequence;
+    head_ = 1;
+    int replayed = 0;
+    Block blk;
+    std::vector<JournalDescriptor> descs;
+    std::vector<Block> data;
+    std::vector<iovec> iov;
+    while (head_ + 2 <= num_blocks_) {
+        /* one or more descriptors, each followed by its blocks, the first other block is the commit record. */
+        uint32_t pos = head_;
+        descs.clear();
+        data.clear();
+        for (;;) {
+            if (dev_->engine_->read(start_block_ + pos, &blk) != kSuccess) {
+                return kFail;
+            }
+            auto desc = (const JournalDescriptor *)&blk;
+            uint32_t count = desc->count;
+            if (desc->magic != kJournalDescMagic || desc->sequence != sequence_ || count == 0 ||
+                count > kJournalDescBlocks || pos + count + 2 > num_blocks_) {
+                break;
+            }
+            descs.push_back(*desc);
+            data.resize(data.size() + count);
+            iov.clear();
+            for (size_t i = data.size() - count; i < data.size(); ++i) {
+                iov.push_back(iovec{ &data[i], kBlockSize });
+            }
+            if (dev_->engine_->readv(start_block_ + pos + 1, iov.data(), iov.size()) != kSuccess) {
+                return kFail;
+            }
+            pos += count + 1;
+        }
+        if (descs.empty()) {
+            break;
+        }
+        std::vector<const Block *> bufs;
+        for (auto &b : data) {
+            bufs.push_back(&b);
+        }
+        auto commit_rec = (const JournalCommit *)&blk;
+        if (commit_rec->magic != kJournalCommitMagic || commit_rec->sequence != sequence_ ||
+            commit_rec->count != data.size() || commit_rec->checksum != checksum(descs, bufs)) {
+            LOG(WARNING) << "journal transaction " << sequence_ << " is not committed, discard it";
+            break;
+        }
+        size_t n = 0;
+        for (auto &desc : descs) {
+            for (uint32_t i = 0; i < desc.count; ++i, ++n) {
+                rt_assert(desc.block_ids[i] < start_block_, "logged block is inside journal");
+                memcpy(&logged_[desc.block_ids[i]], &data[n], sizeof(Block));
+            }
+        }
+        head_ = pos + 1;
+        ++sequence_;
+        ++replayed;
+    }
+    LOG(INFO) << "journal replayed " << replayed << " transactions, " << logged_.size() << " blocks";
+    /* the cache may hold blocks read before recovery. */
+    for (auto &[block_id, blk] : logged_) {
+        dev_->blk_cache_mgr_.update(block_id, &blk);
+    }
+    return checkpoint();
+}
+
+uint32_t Journal::tx_log_blocks(uint32_t count) {
+    return count + (count + kJournalDescBlocks - 1) / kJournalDescBlocks + 1;
+}
+
+uint32_t Journal::max_tx_blocks() const {
+    /* the log minus header and commit record, one descriptor per kJournalDescBlocks blocks. */
+    if (num_blocks_ < 3) {
+        return 0;
+    }
+    uint32_t avail = num_blocks_ - 2;
+    return avail - (avail + kJournalDescBlocks) / (kJournalDescBlocks + 1);
+}
+
+int Journal::commit(const std::vector<blk_id_t> &block_ids, const std::vector<const Block *> &bufs) {
+    rt_assert(block_ids.size() == bufs.size(), "block_ids and bufs size not match");
+    uint32_t count = block_ids.size();
+    if (count == 0) {
+        return kSuccess;
+    }
+    if (count > max_tx_blocks()) {
+        LOG(WARNING) << "transaction of " << count << " blocks is larger than the journal";
+        return kFail;
+    }
+    if (head_ + tx_log_blocks(count) > num_blocks_ && checkpoint() != kSuccess) {
+        return kFail;
+    }
+
+    std::vector<JournalDescriptor> descs((count + kJournalDescBlocks - 1) / kJournalDescBlocks);
+    for (size_t d = 0; d < descs.size(); ++d) {
+        auto &desc = descs[d];
+        size_t first = d * kJournalDescBlocks;
+        memset(&desc, 0, sizeof(desc));
+        desc.magic = kJournalDescMagic;
+        desc.sequence = sequence_;
+        desc.count = std::min<size_t>(kJournalDescBlocks, count - first);
+        std::copy(block_ids.begin() + first, block_ids.begin() + first + desc.count, desc.block_ids);
+    }
+    JournalCommit commit_rec;
+    memset(&commit_rec, 0, sizeof(commit_rec));
+    commit_rec.magic = kJournalCommitMagic;
+    commit_rec.sequence = sequence_;
+    commit_rec.count = count;
+    commit_rec.checksum = checksum(descs, bufs);
+
+    /* descriptors, blocks and commit record are contiguous, so it is a sequential write and one flush. */
+    std::vector<iovec> iov;
+    for (size_t d = 0; d < descs.size(); ++d) {
+        iov.push_back(iovec{ &descs[d], kBlockSize });
+        for (size_t i = d * kJournalDescBlocks; i < d * kJournalDescBlocks + descs[d].count; ++i) {
+            iov.push_back(iovec{ const_cast<Block *>(bufs[i]), kBlockSize });
+        }
+    }
+    iov.push_back(iovec{ &commit_rec, kBlockSize });
+    for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+        int cnt = std::min<size_t>(IOV_MAX, iov.size() - i);
+        if (dev_->engine_->writev(start_block_ + head_ + i, &iov[i], cnt) != kSuccess) {
+            DLOG(WARNING) << "write journal transaction " << sequence_ << " failed";
+            return kFail;
+        }
+    }
+    if (dev_->engine_->flush() != kSuccess) {
+        DLOG(WARNING) << "flush journal transaction " << sequence_ << " failed";
+        return kFail;
+    }
+    DLOG(INFO) << "journal committed transaction " << sequence_ << " of " << count << " blocks at " << head_;
+    head_ += iov.size();
+    ++sequence_;
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(&logged_[block_ids[i]], bufs[i], sizeof(Block));
+    }
+    return kSuccess;
+}
+
+int Journal::checkpoint() {
+    DLOG(INFO) << "journal checkpoint " << logged_.size() << " blocks";
+    checkpointing_ = true;
+    std::vector<std::pair<blk_id_t, const Block *>> blocks;
+    for (auto &[block_id, blk] : logged_) {
+        blocks.emplace_back(block_id, &blk);
+    }
+    int ret = dev_->write_runs(blocks);
+    checkpointing_ = false;
+    if (ret != kSuccess || dev_->engine_->flush() != kSuccess) {
+        DLOG(WARNING) << "journal checkpoint failed";
+        return kFail;
+    }
+    logged_.clear();
+    head_ = 1;
+    return write_header();
+}
+
+int Journal::before_home_write(blk_id_t block_id) {
+    if (checkpointing_ || logged_.find(block_id) == logged_.end()) {
+        return kSuccess;
+    }
+    return checkpoint();
+}
+
+int Journal::write_header() {
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kJournalMagic;
+    header.sequence = sequence_;
+    if (dev_->engine_->write(start_block_, (Block *)&header) != kSuccess || dev_->engine_->flush() != kSuccess) {
+        DLOG(WARNING) << "write journal header failed";
+        return kFail;
+    }
+    return kSuccess;
+}
+
+uint64_t Journal::checksum(const std::vector<JournalDescriptor> &descs, const std::vector<const Block *> &bufs) {
+    /* FNV-1a over 64-bit words */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto update = [&hash](const void *data) {
+        auto p = (const uint64_t *)data;
+        for (size_t i = 0; i < kBlockSize / sizeof(uint64_t); ++i) {
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        }
+    };
+    for (auto &desc : descs) {
+        update(&desc);
+    }
+    for (auto buf : bufs) {
+        update(buf);
+    }
+    return hash;
+}
+}  // namespace sbfs
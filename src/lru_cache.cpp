@@ -4,196 +4,545 @@
 using namespace std;
 using namespace sbfs;
 
-LRUCacheManager::LRUCacheManager(const uint64_t cache_size, BlockDevice *parent)
-    : FREE_first(0), LRU_first(-1), LRU_last(-1), _hashtable(), _cache_size(cache_size), _dev(parent) {
+LRUCacheManager::LRUCacheManager(const uint64_t cache_size, BlockDevice *parent, CachePolicy policy, bool hugetlb,
+                                 uint64_t max_cache_size)
+    : _policy(policy),
+      _shards(kCacheShards),
+      _buffer(),
+      _size(0),
+      _dirty_cnt(0),
+      _dev(parent) {
     DLOG(INFO) << "cache mgr init start";
-    _size = cache_size / kBlockSize;
-    _buffer = vector<pair<Block *, BlockStatus>>(_size);
-    for (int i = 0; i < _size; i++) {
-        auto &t = _buffer[i].second;
-        t.prev = i - 1;
-        t.next = i + 1;
-        if (i == 0) {
-            t.prev = -1;
-        }
-        if (i == _size - 1) {
-            t.next = -1;
-        }
-        _buffer[i].first = new Block;
+    _max_size = std::max(cache_size, max_cache_size) / kBlockSize;
+    rt_assert(_max_size >= _shards.size(), "cache smaller than shards");
+    if (_arena.init(_max_size, hugetlb) != kSuccess) {
+        LOG(FATAL) << "map block cache of " << _max_size << " blocks failed";
+    }
+    _buffer = vector<pair<Block *, BlockStatus>>(_max_size);
+    for (uint64_t i = 0; i < _max_size; i++) {
+        _buffer[i].first = _arena.base() + i;
+        _buffer[i].second.init();
+        _buffer[i].second.queue = kFreeQueue;
     }
+    for (auto &sh : _shards) {
+        sh.FREE_first = -1;
+        sh.slots = 0;
+        sh.hashtable.init(_max_size / _shards.size() + 1);
+    }
+    resize(cache_size);
 
-    DLOG(INFO) << "cache created with size " << _size << " blocks";
+    DLOG(INFO) << "cache created with size " << _size << " blocks (at most " << _max_size << ") in " << _shards.size()
+               << " shards, policy " << _policy;
 };
 
 LRUCacheManager::~LRUCacheManager() {}
 
-int LRUCacheManager::upsert(blk_id_t block_id, const Block *block, bool is_update) {
-    int slot = -1;
+int LRUCacheManager::parse_policy(const char *name, CachePolicy *policy) {
+    if (strcmp(name, "lru") == 0) {
+        *policy = kLRUPolicy;
+    } else if (strcmp(name, "2q") == 0) {
+        *policy = k2QPolicy;
+    } else {
+        return kFail;
+    }
+    return kSuccess;
+}
+
+int LRUCacheManager::resize(uint64_t cache_size) {
+    std::lock_guard<std::mutex> resize_guard(_resize_mtx);
+    uint64_t n = _shards.size();
+    uint64_t size = std::clamp<uint64_t>(cache_size / kBlockSize, n, _max_size);
+    uint64_t old = _size;
+    if (size == old) {
+        return kSuccess;
+    }
+    /* set first, so that slots released below are not put back to the free lists. */
+    _size = size;
+    int ret = kSuccess;
+    for (uint64_t s = 0; s < n; s++) {
+        auto &sh = _shards[s];
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        if (size > old) {
+            /* a slot of a failed shrink may still be in use, it's on a list rather than free. */
+            for (uint64_t i = first_slot(s, old); i < size; i += n) {
+                if (_buffer[i].second.queue == kFreeQueue) {
+                    FREE_add(sh, i);
+                }
+            }
+        } else {
+            /* all the way up, slots left by a failed shrink are retried. */
+            for (uint64_t i = first_slot(s, size); i < _max_size; i += n) {
+                auto &stu = _buffer[i].second;
+                if (stu.queue != kFreeQueue && remove_page(sh, stu.id) != kSuccess) {
+                    DLOG(WARNING) << "release slot " << i << " of block " << stu.id << " failed";
+                    ret = kFail;
+                }
+            }
+            /* drop the released ones from the free list. */
+            int *link = &sh.FREE_first;
+            while (*link != -1) {
+                if ((uint64_t)*link >= size) {
+                    *link = _buffer[*link].second.next;
+                } else {
+                    link = &_buffer[*link].second.next;
+                }
+            }
+        }
+        sh.slots = size / n + (s < size % n);
+        set_limits(sh);
+    }
+    if (size < old && ret == kSuccess) {
+        _arena.release(size, _max_size - size);
+    }
+    DLOG(INFO) << "cache resized from " << old << " to " << size << " blocks";
+    return ret;
+}
+
+void LRUCacheManager::set_limits(Shard &sh) {
+    sh.in_limit = std::max<uint64_t>(1, sh.slots * kCache2QInPercent / 100);
+    if (_policy == k2QPolicy && sh.ghost.size() != sh.slots * kCache2QOutPercent / 100) {
+        /* ids remembered so far are dropped, they are only a hint. */
+        sh.ghost.assign(sh.slots * kCache2QOutPercent / 100, kNoBlock);
+        sh.ghost_index.init(sh.ghost.size());
+        sh.ghost_head = 0;
+    }
+}
+
+int LRUCacheManager::upsert(blk_id_t block_id, const Block *block, bool is_update, uint32_t owner) {
     DLOG(INFO) << "cache receive upsert req id: " << block_id << " isupdate: " << is_update << " " << block;
-    if (get_page(block_id, slot) != kSuccess) {
+    return upsert(block_id, block->data, 0, kBlockSize, owner);
+}
+
+int LRUCacheManager::upsert(blk_id_t block_id, const uint8_t *buf, uint32_t offset, uint32_t len, uint32_t owner) {
+    rt_assert(offset + len <= kBlockSize, "upsert out of block");
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    int slot = -1;
+    /* if the whole block is overwritten, a missed one is installed without reading it. */
+    if (get_page(sh, block_id, slot, len < kBlockSize) != kSuccess) {
         DLOG(ERROR) << "upsert " << block_id << " failed";
         return kFail;
-    } else {
-        DLOG(INFO) << "upsert " << block_id << " slot " << slot;
-        memcpy(_buffer[slot].first, block, sizeof(Block));
-        //_buffer[slot].first = block;
-        if (!_buffer[slot].second.is_dirty()) {
-            _buffer[slot].second.rev_dirty();
-        }
-        return kSuccess;
     }
-    rt_assert(false, "should not reach here");
-    return kFail;
+    DLOG(INFO) << "upsert " << block_id << " slot " << slot << " offset " << offset << " len " << len;
+    memcpy(_buffer[slot].first->data + offset, buf, len);
+    set_dirty(sh, slot, owner);
+    return kSuccess;
 }
 
 int LRUCacheManager::get(blk_id_t block_id, Block *block) {
-    std::ignore = block;
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
     int slot = -1;
     DLOG(INFO) << "cache receive get req: " << block_id << " " << block;
-    auto it = _hashtable.find(block_id);
-    if (it != _hashtable.end()) {
-        slot = it->second;
-        LRU_remove(slot);
-        LRU_add(slot);
+    slot = sh.hashtable.find(block_id);
+    if (slot != -1) {
+        Stats::add(kCacheHits);
+        touch(sh, slot);
         memcpy(block, _buffer[slot].first, sizeof(Block));
         return kSuccess;
     } else {
+        Stats::add(kCacheMisses);
         return kFail;
     }
-    // if (get_page(block_id, slot) != kSuccess) {
-    //     DLOG(ERROR) << "get " << block_id << " failed";
-    //     memset(block, 0, sizeof(Block));
-    //     return kFail;
-    // } else {
-    //     DLOG(INFO) << "cache get " << block_id << " slot " << slot;
-    //     memcpy(block, _buffer[slot].first, sizeof(Block));
-    //     // block = _buffer[slot].first;
-    //     return kSuccess;
-    // }
-    // rt_assert(false, "should not reach here");
-    // return kFail;
+}
+
+int LRUCacheManager::peek(blk_id_t block_id, Block *block) {
+    return peek(block_id, block->data, 0, kBlockSize);
+}
+
+int LRUCacheManager::peek(blk_id_t block_id, uint8_t *buf, uint32_t offset, uint32_t len) {
+    rt_assert(offset + len <= kBlockSize, "peek out of block");
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    int slot = sh.hashtable.find(block_id);
+    if (slot == -1 || _buffer[slot].second.pin > 0) {
+        /* the caller looks it up again with get, that one counts. */
+        return kFail;
+    }
+    Stats::add(kCacheHits);
+    touch(sh, slot);
+    memcpy(buf, _buffer[slot].first->data + offset, len);
+    return kSuccess;
+}
+
+int LRUCacheManager::fill(blk_id_t block_id, const Block *block, bool prefetched) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    DLOG(INFO) << "cache receive fill req: " << block_id;
+    int slot = -1;
+    if (sh.hashtable.find(block_id) != -1) {
+        /* already cached (maybe dirty), the cached one is newer. */
+        return kSuccess;
+    }
+    if (alloc(sh, block_id, slot) != kSuccess) {
+        return kFail;
+    }
+    memcpy(_buffer[slot].first, block, sizeof(Block));
+    sh.hashtable.insert(block_id, slot);
+    if (prefetched) {
+        _buffer[slot].second.set_prefetched(true);
+        Stats::add(kReadaheadBlocks);
+    }
+    return kSuccess;
+}
+
+int LRUCacheManager::update(blk_id_t block_id, const Block *block, uint32_t owner) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    int slot = sh.hashtable.find(block_id);
+    if (slot == -1) {
+        return kFail;
+    }
+    touch(sh, slot);
+    memcpy(_buffer[slot].first, block, sizeof(Block));
+    set_dirty(sh, slot, owner);
+    return kSuccess;
+}
+
+bool LRUCacheManager::contains(blk_id_t block_id) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    return sh.hashtable.find(block_id) != -1;
+}
+
+Block *LRUCacheManager::pin(blk_id_t block_id) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    int slot = -1;
+    if (get_page(sh, block_id, slot) != kSuccess) {
+        DLOG(ERROR) << "pin " << block_id << " failed";
+        return nullptr;
+    }
+    ++_buffer[slot].second.pin;
+    return _buffer[slot].first;
+}
+
+void LRUCacheManager::unpin(blk_id_t block_id, bool dirty, uint32_t owner) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
+    int slot = sh.hashtable.find(block_id);
+    rt_assert(slot != -1, "unpin a block not cached");
+    auto &stu = _buffer[slot].second;
+    rt_assert(stu.pin > 0, "unpin a block not pinned");
+    --stu.pin;
+    if (dirty) {
+        set_dirty(sh, slot, owner);
+    }
 }
 
 int LRUCacheManager::remove(blk_id_t block_id) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
     DLOG(INFO) << "cache receive remove req: " << block_id;
-    return remove_page(block_id);
+    return remove_page(sh, block_id);
 }
 
 int LRUCacheManager::sync(blk_id_t block_id) {
+    auto &sh = shard_of(block_id);
+    lock_guard<recursive_mutex> guard(sh.mtx);
     int slot = -1;
     DLOG(INFO) << "cache receive sync req: " << block_id;
-    auto it = _hashtable.find(block_id);
-    if (it != _hashtable.end()) {
-        slot = it->second;
+    slot = sh.hashtable.find(block_id);
+    if (slot != -1) {
         DLOG(INFO) << "cache sync " << block_id << " slot " << slot;
-        LRU_remove(slot);
-        LRU_add(slot);
+        touch(sh, slot);
         if (_buffer[slot].second.is_dirty()) {
-            _buffer[slot].second.rev_dirty();
+            set_clean(sh, slot);
             return _dev->write_to_disk(block_id, _buffer[slot].first);
         } else {
             return kSuccess;
         }
     } else {
-        DLOG(ERROR) << "sync block not found";
-        return kFail;
+        /* not cached, so nothing to write back. */
+        DLOG(INFO) << "sync block not cached";
+        return kSuccess;
     }
-    // if (get_page(block_id, slot) != kSuccess) {
-    //     DLOG(ERROR) << "sync block not found";
-    //     return kFail;
-    // } else {
-    //     DLOG(INFO) << "cache sync " << block_id << " slot " << slot;
-    //     if (_buffer[slot].second.is_dirty()) {
-    //         _buffer[slot].second.rev_dirty();
-    //         return _dev->write_to_disk(_buffer[slot].second.id, _buffer[slot].first);
-    //     } else {
-    //         return kSuccess;
-    //     }
-    // }
     rt_assert(false, "should not reach here");
     return kFail;
 }
 
-int LRUCacheManager::sync_all() {
-    for (int i = 0; i < _size; i++) {
-        auto &stu = _buffer[i].second;
+int LRUCacheManager::take_dirty(const vector<blk_id_t> &block_ids, vector<pair<blk_id_t, const Block *>> *blocks) {
+    for (auto block_id : block_ids) {
+        auto &sh = shard_of(block_id);
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        int slot = sh.hashtable.find(block_id);
+        if (slot == -1) {
+            continue;
+        }
+        auto &stu = _buffer[slot].second;
         if (stu.is_dirty()) {
-            if (_dev->write_to_disk(stu.id, _buffer[i].first)) {
-                DLOG(ERROR) << "write block dirty failed";
-                return kFail;
+            set_clean(sh, slot);
+            blocks->emplace_back(block_id, _buffer[slot].first);
+        }
+    }
+    return kSuccess;
+}
+
+int LRUCacheManager::take_dirty(uint32_t owner, vector<pair<blk_id_t, const Block *>> *blocks) {
+    size_t first = blocks->size();
+    for (auto &sh : _shards) {
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        auto it = sh.owner_dirty.find(owner);
+        if (it == sh.owner_dirty.end()) {
+            continue;
+        }
+        /* set_clean erases from the set (and the map), so iterate a copy. */
+        set<blk_id_t> ids = std::move(it->second);
+        sh.owner_dirty.erase(it);
+        for (auto block_id : ids) {
+            int slot = sh.hashtable.find(block_id);
+            set_clean(sh, slot);
+            blocks->emplace_back(block_id, _buffer[slot].first);
+        }
+    }
+    std::sort(blocks->begin() + first, blocks->end());
+    return kSuccess;
+}
+
+int LRUCacheManager::take_all_dirty(vector<pair<blk_id_t, const Block *>> *blocks) {
+    size_t first = blocks->size();
+    blocks->reserve(first + _dirty_cnt);
+    for (auto &sh : _shards) {
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        while (!sh.dirty.empty()) {
+            blk_id_t block_id = *sh.dirty.begin();
+            int slot = sh.hashtable.find(block_id);
+            set_clean(sh, slot);
+            blocks->emplace_back(block_id, _buffer[slot].first);
+        }
+    }
+    std::sort(blocks->begin() + first, blocks->end());
+    return kSuccess;
+}
+
+int LRUCacheManager::pick_writeback(uint64_t now_ms, size_t max_blocks, vector<pair<blk_id_t, const Block *>> *blocks) {
+    /*
+     * over the background ratio, write back the next victims no matter how old,
+     * spread over the shards, as each shard evicts its own list tails (see victim).
+     */
+    uint64_t limit = _size * kDirtyBackgroundRatio / 100;
+    uint64_t over = over_dirty_ratio() ? _dirty_cnt - limit : 0;
+    uint64_t share = (over + _shards.size() - 1) / _shards.size();
+    for (auto &sh : _shards) {
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        uint64_t taken = 0;
+        List *order[2] = { &sh.in, &sh.hot };
+        if (sh.in.size <= sh.in_limit) {
+            std::swap(order[0], order[1]);
+        }
+        for (auto l : order) {
+            for (int slot = l->last; slot != -1 && taken < share && blocks->size() < max_blocks;
+                 slot = _buffer[slot].second.prev) {
+                auto &stu = _buffer[slot].second;
+                if (stu.is_dirty()) {
+                    set_clean(sh, slot);
+                    blocks->emplace_back(stu.id, _buffer[slot].first);
+                    ++taken;
+                }
+            }
+        }
+        /* then the expired ones, only dirty blocks are visited. */
+        for (auto it = sh.dirty.begin(); it != sh.dirty.end() && blocks->size() < max_blocks;) {
+            int slot = sh.hashtable.find(*it++);
+            if (now_ms - _buffer[slot].second.dirty_time >= kDirtyExpireMs) {
+                set_clean(sh, slot);
+                blocks->emplace_back(_buffer[slot].second.id, _buffer[slot].first);
             }
         }
     }
+    std::sort(blocks->begin(), blocks->end());
     return kSuccess;
 }
 
-int LRUCacheManager::get_page(blk_id_t id, int &slot) {
-    auto p = _hashtable.find(id);
-    if (p == _hashtable.end()) {
-        alloc(slot);
-        _buffer[slot].second.id = id;
-        if (_dev->read_from_disk(id, _buffer[slot].first) != kSuccess) {
+int LRUCacheManager::redirty(const vector<pair<blk_id_t, const Block *>> &blocks) {
+    for (auto &[block_id, buf] : blocks) {
+        auto &sh = shard_of(block_id);
+        lock_guard<recursive_mutex> guard(sh.mtx);
+        int slot = sh.hashtable.find(block_id);
+        if (slot == -1 || _buffer[slot].first != buf) {
+            continue;
+        }
+        /* set_clean keeps stu.owner, so the block goes back to the dirty set of its owner. */
+        set_dirty(sh, slot, kNoOwner);
+    }
+    return kSuccess;
+}
+
+void LRUCacheManager::set_dirty(Shard &sh, int slot, uint32_t owner) {
+    auto &stu = _buffer[slot].second;
+    if (!stu.is_dirty()) {
+        stu.rev_dirty();
+        stu.dirty_time = now_ms();
+        sh.dirty.insert(stu.id);
+        ++_dirty_cnt;
+    }
+    if (owner != kNoOwner && owner != stu.owner) {
+        /* the block changed hands (freed and reallocated), move it to the new owner. */
+        unlink_owner(sh, stu);
+        stu.owner = owner;
+    }
+    if (stu.owner != kNoOwner) {
+        sh.owner_dirty[stu.owner].insert(stu.id);
+    }
+}
+
+void LRUCacheManager::set_clean(Shard &sh, int slot) {
+    auto &stu = _buffer[slot].second;
+    if (!stu.is_dirty()) {
+        return;
+    }
+    stu.rev_dirty();
+    sh.dirty.erase(stu.id);
+    --_dirty_cnt;
+    unlink_owner(sh, stu);
+}
+
+void LRUCacheManager::unlink_owner(Shard &sh, const BlockStatus &stu) {
+    auto it = sh.owner_dirty.find(stu.owner);
+    if (it == sh.owner_dirty.end()) {
+        return;
+    }
+    it->second.erase(stu.id);
+    if (it->second.empty()) {
+        sh.owner_dirty.erase(it);
+    }
+}
+
+int LRUCacheManager::get_page(Shard &sh, blk_id_t id, int &slot, bool read) {
+    slot = sh.hashtable.find(id);
+    if (slot == -1) {
+        Stats::add(kCacheMisses);
+        if (alloc(sh, id, slot) != kSuccess) {
+            return kFail;
+        }
+        if (read && _dev->read_from_disk(id, _buffer[slot].first) != kSuccess) {
             DLOG(ERROR) << "read block failed at cache get_page";
+            LRU_remove(sh, slot);
+            FREE_add(sh, slot);
             return kFail;
         }
-        _hashtable[id] = slot;
+        sh.hashtable.insert(id, slot);
     } else {
-        slot = p->second;
-        // ++buffer[slot].pin;
-        LRU_remove(slot);
-        LRU_add(slot);
+        Stats::add(kCacheHits);
+        touch(sh, slot);
     }
     return kSuccess;
 }
 
-int LRUCacheManager::remove_page(blk_id_t id) {
-    int slot = -1;
-    auto p = _hashtable.find(id);
-    if (p == _hashtable.end()) {
+int LRUCacheManager::remove_page(Shard &sh, blk_id_t id) {
+    int slot = sh.hashtable.find(id);
+    if (slot == -1) {
         DLOG(ERROR) << "remove_page: block not found in cache";
         return kFail;
-    } else {
-        slot = p->second;
     }
     DLOG(INFO) << "cache remove_page: " << id << " slot " << slot;
     auto &stu = _buffer[slot].second;
+    if (stu.pin > 0) {
+        DLOG(ERROR) << "remove_page: block " << id << " is pinned";
+        return kFail;
+    }
     if (stu.is_dirty()) {
         if (_dev->write_to_disk(id, _buffer[slot].first) != kSuccess) {
             DLOG(ERROR) << "write block dirty failed at cache remove_page";
             return kFail;
         }
+        set_clean(sh, slot);
     }
-    _hashtable.erase(id);
-    LRU_remove(slot);
-    FREE_add(slot);
+    sh.hashtable.erase(id);
+    LRU_remove(sh, slot);
+    FREE_add(sh, slot);
     return kSuccess;
 }
 
-int LRUCacheManager::alloc(int &slot) {
-    if (FREE_first != -1) {
-        slot = FREE_first;
-        FREE_first = _buffer[slot].second.next;
-        _buffer[slot].second.init();
-        LRU_remove(slot);
-        LRU_add(slot);
-        return kSuccess;
+int LRUCacheManager::alloc(Shard &sh, blk_id_t id, int &slot) {
+    if (sh.FREE_first != -1) {
+        slot = sh.FREE_first;
+        sh.FREE_first = _buffer[slot].second.next;
+    } else {
+        slot = victim(sh);
+        if (slot == -1) {
+            DLOG(ERROR) << "no free block in cache";
+            return kFail;
+        }
+        auto &stu = _buffer[slot].second;
+        Stats::add(kCacheEvictions);
+        if (stu.is_prefetched()) {
+            Stats::add(kReadaheadWasted);
+        }
+        if (stu.is_dirty()) {
+            Stats::add(kCacheDirtyEvictions);
+            if (_dev->write_to_disk(stu.id, _buffer[slot].first)) {
+                DLOG(ERROR) << "write block dirty failed at cache alloc";
+                return kFail;
+            }
+            set_clean(sh, slot);
+        }
+        sh.hashtable.erase(stu.id);
+        if (stu.queue == kInQueue) {
+            /* seen once and aged out, remember it in A1out, a reference from there means it's hot. */
+            ghost_add(sh, stu.id);
+        }
+        LRU_remove(sh, slot);
     }
-    for (slot = LRU_last; slot != -1; slot = _buffer[slot].second.prev) {
-        if (/*buffer[slot].pin*/ true) {
-            auto &stu = _buffer[slot].second;
-            if (stu.is_dirty()) {
-                if (_dev->write_to_disk(_buffer[slot].second.id, _buffer[slot].first)) {
-                    DLOG(ERROR) << "write block dirty failed at cache alloc";
-                    return kFail;
-                }
+    _buffer[slot].second.init();
+    _buffer[slot].second.id = id;
+    Queue queue = kHotQueue;
+    if (_policy == k2QPolicy && !ghost_hit(sh, id)) {
+        queue = kInQueue;
+    }
+    LRU_add(sh, slot, queue);
+    return kSuccess;
+}
+
+int LRUCacheManager::victim(Shard &sh) {
+    /* 2Q trims A1in while it's over its share, so blocks seen once go before hot ones. */
+    List *order[2] = { &sh.in, &sh.hot };
+    if (sh.in.size <= sh.in_limit) {
+        std::swap(order[0], order[1]);
+    }
+    for (auto l : order) {
+        for (int slot = l->last; slot != -1; slot = _buffer[slot].second.prev) {
+            if (_buffer[slot].second.pin == 0) {
+                return slot;
             }
-            _hashtable.erase(_buffer[slot].second.id);
-            _buffer[slot].second.init();
-            LRU_remove(slot);
-            LRU_add(slot);
-            return kSuccess;
         }
     }
-    DLOG(ERROR) << "no free block in cache";
-    return kFail;
+    return -1;
+}
+
+void LRUCacheManager::touch(Shard &sh, int slot) {
+    auto &stu = _buffer[slot].second;
+    if (stu.is_prefetched()) {
+        stu.set_prefetched(false);
+        Stats::add(kReadaheadHits);
+    }
+    /* A1in is a FIFO, a block referenced again there (e.g. the rest of a block read in pieces) stays. */
+    if (stu.queue == kHotQueue) {
+        LRU_remove(sh, slot);
+        LRU_add(sh, slot, kHotQueue);
+    }
+}
+
+void LRUCacheManager::ghost_add(Shard &sh, blk_id_t id) {
+    if (sh.ghost.empty()) {
+        return;
+    }
+    blk_id_t &pos = sh.ghost[sh.ghost_head];
+    if (pos != kNoBlock) {
+        sh.ghost_index.erase(pos);
+    }
+    pos = id;
+    sh.ghost_index.insert(id, sh.ghost_head);
+    sh.ghost_head = (sh.ghost_head + 1) % sh.ghost.size();
+}
+
+bool LRUCacheManager::ghost_hit(Shard &sh, blk_id_t id) {
+    int pos = sh.ghost_index.find(id);
+    if (pos == -1) {
+        return false;
+    }
+    /* leave a hole, it's reused when the ring comes around. */
+    sh.ghost[pos] = kNoBlock;
+    sh.ghost_index.erase(id);
+    return true;
 }
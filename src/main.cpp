@@ -7,13 +7,33 @@ using namespace sbfs::vfs;
 
 static struct options {
     const char *disk_path;
+    const char *backend;
+    const char *cache_policy;
     int is_open;
+    int io_uring;
+    int queue_depth;
+    int cache_hugetlb;
+    int cache_size;     /* MB */
+    int cache_max_size; /* MB */
+    int pressure_monitor;
+    int direct_io_threshold; /* KB, 0 for O_DIRECT only */
+    int delalloc;
+    int extents;
 } opt;
 
 #define OPTION(t, p) \
     { t, offsetof(struct options, p), 1 }
 static const struct fuse_opt option_spec[] = { OPTION("--disk_path=%s", disk_path), OPTION("--open=%d", is_open),
-                                               FUSE_OPT_END };
+                                               OPTION("--backend=%s", backend), OPTION("--io_uring=%d", io_uring),
+                                               OPTION("--queue_depth=%d", queue_depth),
+                                               OPTION("--cache_policy=%s", cache_policy),
+                                               OPTION("--cache_hugetlb=%d", cache_hugetlb),
+                                               OPTION("--cache_size=%d", cache_size),
+                                               OPTION("--cache_max_size=%d", cache_max_size),
+                                               OPTION("--pressure_monitor=%d", pressure_monitor),
+                                               OPTION("--direct_io_threshold=%d", direct_io_threshold),
+                                               OPTION("--delalloc=%d", delalloc),
+                                               OPTION("--extents=%d", extents), FUSE_OPT_END };
 
 fuse_operations sb_op;
 
@@ -25,16 +45,60 @@ int main(int argc, char **argv) {
 
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
     opt.disk_path = "/tmp/disk";
+    opt.backend = "file";
+    opt.cache_policy = "2q";
     opt.is_open = false;
+    opt.io_uring = false;
+    opt.queue_depth = kIOQueueDepth;
+    opt.cache_hugetlb = false;
+    opt.cache_size = kBlockCacheSize / MB(1);
+    opt.cache_max_size = 0;
+    opt.pressure_monitor = true;
+    opt.direct_io_threshold = kDirectIOThreshold / KB(1);
+    opt.delalloc = true;
+    opt.extents = true;
 
     DLOG(WARNING) << "start parse args";
     if (fuse_opt_parse(&args, &opt, option_spec, nullptr) == -1) {
         LOG(ERROR) << "Failed to parse options";
     }
 
-    DLOG(WARNING) << "Disk path: " << opt.disk_path << ", is open: " << opt.is_open;
-    init_vfs(opt.disk_path, kDiskSize, opt.is_open);
+    DLOG(WARNING) << "Disk path: " << opt.disk_path << ", backend: " << opt.backend << ", is open: " << opt.is_open
+                  << ", io_uring: " << opt.io_uring << ", queue depth: " << opt.queue_depth
+                  << ", cache policy: " << opt.cache_policy << ", cache hugetlb: " << opt.cache_hugetlb
+                  << ", cache size: " << opt.cache_size << "MB, max " << opt.cache_max_size
+                  << "MB, pressure monitor: " << opt.pressure_monitor
+                  << ", direct io threshold: " << opt.direct_io_threshold << "KB, delalloc: " << opt.delalloc
+                  << ", extents: " << opt.extents;
+    sbfs::DeviceOptions dev_opt;
+    if (sbfs::StorageBackend::parse_type(opt.backend, &dev_opt.backend) != kSuccess) {
+        LOG(ERROR) << "Unknown backend " << opt.backend << ", expect file, mmap or ram";
+        return 1;
+    }
+    if (sbfs::LRUCacheManager::parse_policy(opt.cache_policy, &dev_opt.cache_policy) != kSuccess) {
+        LOG(ERROR) << "Unknown cache policy " << opt.cache_policy << ", expect lru or 2q";
+        return 1;
+    }
+    dev_opt.io_uring = opt.io_uring;
+    dev_opt.queue_depth = opt.queue_depth;
+    dev_opt.cache_hugetlb = opt.cache_hugetlb;
+    if (opt.cache_size <= 0 || opt.cache_max_size < 0) {
+        LOG(ERROR) << "Invalid cache size " << opt.cache_size << "MB, max " << opt.cache_max_size << "MB";
+        return 1;
+    }
+    dev_opt.cache_size = MB(opt.cache_size);
+    dev_opt.cache_max_size = MB(opt.cache_max_size);
+    dev_opt.pressure_monitor = opt.pressure_monitor;
+    if (opt.direct_io_threshold < 0) {
+        LOG(ERROR) << "Invalid direct io threshold " << opt.direct_io_threshold << "KB";
+        return 1;
+    }
+    dev_opt.direct_io_threshold = KB(opt.direct_io_threshold);
+    dev_opt.delalloc = opt.delalloc;
+    dev_opt.extents = opt.extents;
+    init_vfs(opt.disk_path, kDiskSize, opt.is_open, dev_opt);
 
+    sb_op.init = sb_init;
     sb_op.readdir = sb_readdir;
     sb_op.getattr = sb_getattr;
     sb_op.mkdir = sb_mkdir;
@@ -0,0 +1,106 @@
+#include "pressure.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace sbfs {
+int PressureMonitor::open_trigger() {
+    std::vector<std::string> paths;
+    /* "0::/path" is the cgroup v2 entry of /proc/self/cgroup. */
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            paths.push_back("/sys/fs/cgroup" + line.substr(3) + "/memory.pressure");
+        }
+    }
+    paths.push_back("/proc/pressure/memory");
+
+    std::string trigger = "some " + std::to_string(kPressureStallMs * 1000) + " " +
+                          std::to_string(kPressureWindowMs * 1000);
+    for (auto &path : paths) {
+        int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            DLOG(INFO) << "open " << path << " failed " << strerror(errno);
+            continue;
+        }
+        /* the trigger is written with its terminating zero. */
+        if (write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+            DLOG(INFO) << "write PSI trigger to " << path << " failed " << strerror(errno);
+            close(fd);
+            continue;
+        }
+        LOG(INFO) << "memory pressure monitor on " << path;
+        return fd;
+    }
+    return -1;
+}
+
+int PressureMonitor::start(callback_t cb) {
+    if (thread_.joinable()) {
+        return kSuccess;
+    }
+    fd_ = open_trigger();
+    if (fd_ < 0) {
+        LOG(WARNING) << "PSI is not available, no memory pressure monitor";
+        return kFail;
+    }
+    stop_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd_ < 0) {
+        LOG(WARNING) << "eventfd failed " << strerror(errno);
+        close(fd_);
+        fd_ = -1;
+        return kFail;
+    }
+    cb_ = std::move(cb);
+    thread_ = std::thread(&PressureMonitor::loop, this);
+    return kSuccess;
+}
+
+void PressureMonitor::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) < 0) {
+        DLOG(WARNING) << "signal pressure monitor failed " << strerror(errno);
+    }
+    thread_.join();
+    close(fd_);
+    close(stop_fd_);
+    fd_ = stop_fd_ = -1;
+}
+
+void PressureMonitor::loop() {
+    uint64_t calm_since = now_ms();
+    while (true) {
+        pollfd fds[2] = { { fd_, POLLPRI, 0 }, { stop_fd_, POLLIN, 0 } };
+        int ret = poll(fds, 2, kPressureCalmMs);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(WARNING) << "poll memory pressure failed " << strerror(errno);
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+        if (fds[0].revents & POLLERR) {
+            /* the cgroup is gone. */
+            LOG(WARNING) << "memory pressure monitor stopped";
+            return;
+        }
+        if (fds[0].revents & POLLPRI) {
+            DLOG(INFO) << "memory pressure";
+            cb_(true);
+            calm_since = now_ms();
+        } else if (now_ms() - calm_since >= kPressureCalmMs) {
+            cb_(false);
+            calm_since = now_ms();
+        }
+    }
+}
+}  // namespace sbfs
@@ -0,0 +1,41 @@
+#include "readahead.h"
+
+namespace sbfs {
+void Readahead::on_read(uint32_t inode_id, uint32_t lid, uint32_t rid, uint32_t *start, uint32_t *count) {
+    *count = 0;
+    auto it = streams_.find(inode_id);
+    if (it == streams_.end()) {
+        if (streams_.size() >= kReadaheadStreams) {
+            streams_.clear();
+        }
+        /* reading a file from its beginning is the start of a stream. */
+        it = streams_.emplace(inode_id, Stream{ 0, 0, 0 }).first;
+    }
+    auto &s = it->second;
+    bool sequential = lid == s.next || lid + 1 == s.next;
+    s.next = rid + 1;
+    if (!sequential) {
+        s.window = s.window / 2 < kReadaheadMinBlocks ? 0 : s.window / 2;
+        s.ahead = s.next;
+        DLOG(INFO) << "readahead of " << inode_id << " random read at " << lid << ", window " << s.window;
+        return;
+    }
+    if (s.ahead < s.next) {
+        /* the reader overtook the prefetched blocks. */
+        s.ahead = s.next;
+    }
+    if (s.window != 0 && s.next + s.window / 2 < s.ahead) {
+        return;
+    }
+    s.window = s.window == 0 ? kReadaheadMinBlocks : std::min(s.window * 2, kReadaheadMaxBlocks);
+    *start = s.ahead;
+    *count = s.next + s.window - s.ahead;
+    s.ahead += *count;
+    DLOG(INFO) << "readahead of " << inode_id << " prefetch " << *count << " blocks from " << *start << ", window "
+               << s.window;
+}
+
+void Readahead::forget(uint32_t inode_id) {
+    streams_.erase(inode_id);
+}
+}  // namespace sbfs
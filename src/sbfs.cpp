@@ -6,9 +6,11 @@ namespace sbfs {
 constexpr uint32_t kInodesInABlock = kBlockSize / sizeof(DiskInode);
 
 SBFileSystem SBFileSystem::create(const char *path, const uint64_t size, uint32_t total_blocks,
-                                  uint32_t inode_bitmap_blocks) {
+                                  uint32_t inode_bitmap_blocks, const DeviceOptions &options) {
     SBFileSystem fs;
-    fs.device_ = new BlockDevice(path, size);
+    fs.device_ = new BlockDevice(path, size, options);
+    fs.delalloc_ = options.delalloc ? new DelayedAlloc() : nullptr;
+    fs.extents_ = options.extents;
 
     /* init super block */
     fs.super_block_.magic = kFSMagic;
@@ -20,21 +22,27 @@ SBFileSystem SBFileSystem::create(const char *path, const uint64_t size, uint32_
     fs.super_block_.data_bitmap_blocks = remaining_blocks / (1 + 8 * kBlockSize);
     fs.super_block_.data_area_blocks = fs.super_block_.data_bitmap_blocks * 8 * kBlockSize;
     fs.super_block_.root_inode_pos = Position::invalid();
+    fs.super_block_.log_start_block = total_blocks;
+    fs.super_block_.log_blocks = size / kBlockSize - total_blocks;
 
     fs.super_block_.print();
     DLOG(WARNING) << "unusable_blocks: "
                   << remaining_blocks - fs.super_block_.data_bitmap_blocks - fs.super_block_.data_area_blocks;
     /* stage 1: super block initialize, but root inode pos is invalid. */
     fs.device_->write(0, (Block *)&fs.super_block_);
+    fs.device_->init_journal(fs.super_block_.log_start_block, fs.super_block_.log_blocks, true);
 
-    fs.initBitmapAndBlock();
+    fs.initBitmapAndBlock(true);
     fs.createRoot();
+    /* later transactions are only in the journal, the fresh layout itself must be on disk. */
+    fs.inode_cache_->writeback_all();
+    fs.device_->sync_all();
 
     return fs;
 }
 
 /* Open an existing SBFS. */
-SBFileSystem SBFileSystem::open(const char *path) {
+SBFileSystem SBFileSystem::open(const char *path, const DeviceOptions &options) {
     SBFileSystem fs;
 
     struct stat stbuf;
@@ -43,19 +51,24 @@ SBFileSystem SBFileSystem::open(const char *path) {
         return fs;
     }
 
-    fs.device_ = new BlockDevice(path, stbuf.st_size);
+    fs.device_ = new BlockDevice(path, stbuf.st_size, options);
+    fs.delalloc_ = options.delalloc ? new DelayedAlloc() : nullptr;
+    fs.extents_ = options.extents;
     fs.device_->read(0, (Block *)&fs.super_block_);
     if (!fs.super_block_.isValid()) {
         LOG(ERROR) << "Invalid magic number: " << fs.super_block_.magic;
         return fs;
     }
     fs.super_block_.print();
+    if (fs.device_->init_journal(fs.super_block_.log_start_block, fs.super_block_.log_blocks, false) != kSuccess) {
+        LOG(ERROR) << "Journal recovery failed";
+    }
 
-    fs.initBitmapAndBlock();
+    fs.initBitmapAndBlock(false);
     return fs;
 }
 
-void SBFileSystem::initBitmapAndBlock() {
+void SBFileSystem::initBitmapAndBlock(bool format) {
     /* init inode bitmap */
     uint32_t inode_bitmap_offset = 1;
     uint32_t inode_area_offset = inode_bitmap_offset + super_block_.inode_bitmap_blocks;
@@ -63,16 +76,27 @@ void SBFileSystem::initBitmapAndBlock() {
     uint32_t data_area_offset = data_bitmap_offset + super_block_.data_bitmap_blocks;
     inode_bitmap_ = new Bitmap(inode_bitmap_offset, super_block_.inode_bitmap_blocks, inode_area_offset);
     data_bitmap_ = new Bitmap(data_bitmap_offset, super_block_.data_bitmap_blocks, data_area_offset);
+    if (inode_bitmap_->load(device_, format) != kSuccess || data_bitmap_->load(device_, format) != kSuccess) {
+        LOG(ERROR) << "Load bitmaps failed";
+    }
+    readahead_ = new Readahead();
+    block_map_ = new BlockMap();
+    inode_cache_ = new InodeCache(device_);
 
     /* init block num */
     inode_area_start_block_ = inode_area_offset;
     data_area_start_block_ = data_area_offset;
+    /* inode groups are whole words of the inode bitmap. */
+    groups_ = std::max<uint32_t>(super_block_.data_bitmap_blocks, 1);
+    inodes_per_group_ = (inode_bitmap_->total() / groups_ + 63) / 64 * 64;
+    inodes_per_group_ = std::max<uint32_t>(inodes_per_group_, 64);
+    rand_.seed(std::random_device()());
 }
 
 void SBFileSystem::createRoot() {
     /* create root inode */
-    uint32_t root_inode_id = alloc_inode();
-    uint32_t root_data_id = alloc_data();
+    uint32_t root_inode_id = alloc_inode(kNoParent, true);
+    uint32_t root_data_id = alloc_data(data_goal(root_inode_id));
     DiskInode root_inode_data(DiskInodeType::kDirectory);
     DirBlock root_dir_block;
     strcpy(root_dir_block.entries[0].name, ".");
@@ -116,20 +140,98 @@ uint32_t SBFileSystem::getDiskInodeId(const Position &pos) const {
     return (pos.block_id - inode_area_start_block_) * kInodesInABlock + pos.block_offset / sizeof(DiskInode);
 }
 
+uint32_t SBFileSystem::inode_group(uint32_t inode_id) const {
+    return std::min((inode_id - inode_bitmap_->data_segment_offset) / inodes_per_group_, groups_ - 1);
+}
+
+uint64_t SBFileSystem::group_free_inodes(uint32_t group) const {
+    return inode_bitmap_->free_count(inode_bitmap_->data_segment_offset + group * inodes_per_group_,
+                                     inodes_per_group_);
+}
+
+uint64_t SBFileSystem::group_free_blocks(uint32_t group) const {
+    return data_bitmap_->free_count(data_area_start_block_ + group * Bitmap::kGroupBits, Bitmap::kGroupBits);
+}
+
+uint32_t SBFileSystem::pick_group(uint32_t parent, bool dir) {
+    if (parent == kNoParent) {
+        return 0;
+    }
+    uint32_t parent_group = inode_group(parent);
+    uint64_t avg_free_inodes = inode_bitmap_->free_count() / groups_;
+    uint64_t avg_free_blocks = data_bitmap_->free_count() / groups_;
+    if (dir && parent == getDiskInodeId(super_block_.root_inode_pos)) {
+        uint32_t start = rand_() % groups_, best = groups_;
+        uint64_t best_free_blocks = 0;
+        for (uint32_t i = 0; i < groups_; ++i) {
+            uint32_t g = (start + i) % groups_;
+            uint64_t free_inodes = group_free_inodes(g), free_blocks = group_free_blocks(g);
+            if (free_inodes == 0 || free_inodes < avg_free_inodes || free_blocks < avg_free_blocks) {
+                continue;
+            }
+            if (best == groups_ || free_blocks > best_free_blocks) {
+                best = g;
+                best_free_blocks = free_blocks;
+            }
+        }
+        if (best != groups_) {
+            return best;
+        }
+    } else if (dir) {
+        /* a quarter of a group below the average is still fine, like ext4. */
+        uint64_t min_inodes = avg_free_inodes > inodes_per_group_ / 4 ? avg_free_inodes - inodes_per_group_ / 4 : 1;
+        uint64_t min_blocks = avg_free_blocks > Bitmap::kGroupBits / 4 ? avg_free_blocks - Bitmap::kGroupBits / 4 : 0;
+        for (uint32_t i = 0; i < groups_; ++i) {
+            uint32_t g = (parent_group + i) % groups_;
+            if (group_free_inodes(g) >= min_inodes && group_free_blocks(g) >= min_blocks) {
+                return g;
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < groups_; ++i) {
+            uint32_t g = (parent_group + i) % groups_;
+            if (group_free_inodes(g) > 0 && group_free_blocks(g) > 0) {
+                return g;
+            }
+        }
+    }
+    /* any group with a free inode. */
+    for (uint32_t i = 0; i < groups_; ++i) {
+        uint32_t g = (parent_group + i) % groups_;
+        if (group_free_inodes(g) > 0) {
+            return g;
+        }
+    }
+    return parent_group;
+}
+
 /* Allocate an inode, returns inode id. */
-uint32_t SBFileSystem::alloc_inode() {
-    uint32_t inode_id = inode_bitmap_->alloc(device_);
-    DLOG(WARNING) << "alloc_inode: " << inode_id;
+uint32_t SBFileSystem::alloc_inode(uint32_t parent, bool dir) {
+    uint32_t group = pick_group(parent, dir);
+    uint32_t inode_id = inode_bitmap_->alloc(device_, inode_bitmap_->data_segment_offset + group * inodes_per_group_);
+    DLOG(WARNING) << "alloc_inode: " << inode_id << " group " << group;
     return inode_id;
 }
 
 /* Allocate a data block, returns block id (not block_id - data_area_start). */
-uint32_t SBFileSystem::alloc_data() {
-    return data_bitmap_->alloc(device_);
+uint32_t SBFileSystem::alloc_data(blk_id_t goal) {
+    return data_bitmap_->alloc(device_, goal);
+}
+
+blk_id_t SBFileSystem::data_goal(uint32_t inode_id) const {
+    return data_area_start_block_ + inode_group(inode_id) * Bitmap::kGroupBits;
 }
 
 /* Deallocate an inode. */
 int SBFileSystem::free_inode(uint32_t inode_id) {
+    readahead_->forget(inode_id);
+    /* an open file may be removed, its id reused. */
+    block_map_->truncate(inode_id, 0);
+    inode_cache_->drop(inode_id);
+    if (delalloc_ != nullptr) {
+        /* buffered writes of a removed file are never written. */
+        delalloc_->drop(inode_id);
+    }
     return inode_bitmap_->free(inode_id, device_);
 }
 
@@ -137,4 +239,27 @@ int SBFileSystem::free_inode(uint32_t inode_id) {
 int SBFileSystem::free_data(uint32_t block_id) {
     return data_bitmap_->free(block_id, device_);
 }
+
+int SBFileSystem::flush_delayed(uint64_t expire_ms) {
+    if (delalloc_ == nullptr) {
+        return kSuccess;
+    }
+    int ret = kSuccess;
+    for (uint32_t inode_id : delalloc_->files(expire_ms)) {
+        if (Inode{ getDiskInodePos(inode_id), this }.flush() != kSuccess) {
+            DLOG(WARNING) << "flush delayed allocation of inode " << inode_id << " failed";
+            ret = kFail;
+        }
+    }
+    return ret;
+}
+
+void SBFileSystem::usage(uint64_t *blocks, uint64_t *free_blocks, uint64_t *inodes, uint64_t *free_inodes) const {
+    *blocks = data_bitmap_->total();
+    /* blocks reserved by buffered writes are not free, but never report less than none. */
+    uint64_t free = data_bitmap_->free_count(), reserved = delalloc_ != nullptr ? delalloc_->reserved() : 0;
+    *free_blocks = free > reserved ? free - reserved : 0;
+    *inodes = inode_bitmap_->total();
+    *free_inodes = inode_bitmap_->free_count();
+}
 };  // namespace sbfs
\ No newline at end of file
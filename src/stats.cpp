@@ -0,0 +1,149 @@
+#include "stats.h"
+
+namespace sbfs {
+namespace {
+constexpr uint32_t kHistogramBuckets = 32; /* up to 2^31 us */
+
+const char *kCounterNames[kNumCounters] = {
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions",
+    "cache_dirty_evictions",
+    "readahead_blocks",
+    "readahead_hits",
+    "readahead_wasted",
+    "disk_read_blocks",
+    "disk_write_blocks",
+    "writeback_blocks",
+    "fsync_calls",
+    "fsync_groups",
+    "direct_read_blocks",
+    "direct_write_blocks",
+    "delalloc_flushes",
+    "delalloc_blocks",
+    "inode_writebacks",
+};
+const char *kHistogramNames[kNumHistograms] = {
+    "disk_read_us",
+    "disk_write_us",
+    "flush_us",
+    "fsync_us",
+    "writeback_us",
+};
+
+/* stats of one thread, only the thread writes it. */
+struct ThreadStats {
+    std::atomic<uint64_t> counters[kNumCounters] = {};
+    std::atomic<uint64_t> buckets[kNumHistograms][kHistogramBuckets] = {};
+    std::atomic<uint64_t> sums[kNumHistograms] = {};
+};
+
+/* plain copy of stats, for summing. */
+struct Snapshot {
+    uint64_t counters[kNumCounters] = {};
+    uint64_t buckets[kNumHistograms][kHistogramBuckets] = {};
+    uint64_t sums[kNumHistograms] = {};
+
+    void add(const ThreadStats &t) {
+        for (uint32_t i = 0; i < kNumCounters; ++i) {
+            counters[i] += t.counters[i].load(std::memory_order_relaxed);
+        }
+        for (uint32_t h = 0; h < kNumHistograms; ++h) {
+            for (uint32_t b = 0; b < kHistogramBuckets; ++b) {
+                buckets[h][b] += t.buckets[h][b].load(std::memory_order_relaxed);
+            }
+            sums[h] += t.sums[h].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+/* stats of live threads, and the sum of exited ones. */
+struct Registry {
+    std::mutex mtx;
+    std::set<ThreadStats *> live;
+    Snapshot exited;
+};
+
+Registry &registry() {
+    /* never destroyed, threads may exit after static destructors ran. */
+    static Registry *r = new Registry;
+    return *r;
+}
+
+/* registers the stats of this thread, and folds them into "exited" on thread exit. */
+struct ThreadSlot {
+    ThreadStats *stats;
+    ThreadSlot() : stats(new ThreadStats) {
+        std::lock_guard<std::mutex> guard(registry().mtx);
+        registry().live.insert(stats);
+    }
+    ~ThreadSlot() {
+        std::lock_guard<std::mutex> guard(registry().mtx);
+        registry().exited.add(*stats);
+        registry().live.erase(stats);
+        delete stats;
+    }
+};
+
+ThreadStats &local() {
+    thread_local ThreadSlot slot;
+    return *slot.stats;
+}
+
+/* single writer, a relaxed load and store is enough (and cheaper than a locked add). */
+void bump(std::atomic<uint64_t> &v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/* upper bound (us) of the bucket where the "p" fraction of samples is reached. */
+uint64_t percentile(const uint64_t *buckets, uint64_t count, double p) {
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < kHistogramBuckets; ++b) {
+        seen += buckets[b];
+        if (seen > 0 && seen >= count * p) {
+            return 1ull << b;
+        }
+    }
+    return 1ull << (kHistogramBuckets - 1);
+}
+}  // namespace
+
+void Stats::add(Counter counter, uint64_t n) {
+    bump(local().counters[counter], n);
+}
+
+void Stats::record(Histogram histogram, uint64_t us) {
+    uint32_t b = us == 0 ? 0 : std::min<uint32_t>(64 - __builtin_clzll(us), kHistogramBuckets - 1);
+    auto &t = local();
+    bump(t.buckets[histogram][b], 1);
+    bump(t.sums[histogram], us);
+}
+
+std::string Stats::report() {
+    Snapshot s;
+    {
+        std::lock_guard<std::mutex> guard(registry().mtx);
+        s = registry().exited;
+        for (auto t : registry().live) {
+            s.add(*t);
+        }
+    }
+    std::ostringstream out;
+    for (uint32_t i = 0; i < kNumCounters; ++i) {
+        out << kCounterNames[i] << " " << s.counters[i] << "\n";
+    }
+    uint64_t lookups = s.counters[kCacheHits] + s.counters[kCacheMisses];
+    out << "cache_hit_ratio " << (lookups ? 100.0 * s.counters[kCacheHits] / lookups : 0.0) << "\n";
+    for (uint32_t h = 0; h < kNumHistograms; ++h) {
+        uint64_t count = 0;
+        for (uint32_t b = 0; b < kHistogramBuckets; ++b) {
+            count += s.buckets[h][b];
+        }
+        out << kHistogramNames[h] << " count " << count << " mean " << (count ? s.sums[h] / count : 0) << " p50 "
+            << (count ? percentile(s.buckets[h], count, 0.5) : 0) << " p99 "
+            << (count ? percentile(s.buckets[h], count, 0.99) : 0) << " p999 "
+            << (count ? percentile(s.buckets[h], count, 0.999) : 0) << "\n";
+    }
+    return out.str();
+}
+}  // namespace sbfs
@@ -1,5 +1,6 @@
 #include "vfs.h"
 
+#include <fcntl.h>
 #include <glog/logging.h>
 
 #include <mutex>
@@ -15,6 +16,24 @@ mutex mtx;
 
 using std::string;
 
+/*
+ * Read-only virtual files under kStatsDir, they are not on disk:
+ * kStatsFile is BlockDevice::stats(), generated on each read.
+ */
+const char *kStatsDir = "/.sbfs";
+const char *kStatsFile = "/.sbfs/stats";
+
+bool isStatsPath(const char *path) {
+    size_t n = strlen(kStatsDir);
+    return strncmp(path, kStatsDir, n) == 0 && (path[n] == '\0' || path[n] == '/');
+}
+
+/* whether a transfer of "size" bytes of file "fh" bypasses the block cache. */
+bool isDirect(uint64_t fh, size_t size) {
+    uint64_t threshold = sbfs->device()->direct_io_threshold();
+    return fd_manager->isDirect(fh) || (threshold != 0 && size >= threshold);
+}
+
 void splitFromLastSlash(string &path, string &parent, string &child) {
     size_t pos = path.rfind('/');
     if (pos == string::npos) {
@@ -26,7 +45,7 @@ void splitFromLastSlash(string &path, string &parent, string &child) {
     }
 }
 
-void init_vfs(const char *path, const uint64_t size, bool is_open) {
+void init_vfs(const char *path, const uint64_t size, bool is_open, const DeviceOptions &options) {
     DLOG(WARNING) << "Initializing VFS at " << path << " with size " << size;
     void *t = sbfs;
     if (posix_memalign(&t, kBlockSize, sizeof(SBFileSystem)) != 0) {
@@ -36,21 +55,27 @@ void init_vfs(const char *path, const uint64_t size, bool is_open) {
     sbfs = reinterpret_cast<SBFileSystem *>(t);
     // sbfs = (SBFileSystem *)malloc(sizeof(SBFileSystem));
     if (!is_open) {
-        *sbfs = SBFileSystem::create(path, size, kFSDataBlocks, kInodeBitmapBlocks);
+        *sbfs = SBFileSystem::create(path, size, kFSDataBlocks, kInodeBitmapBlocks, options);
     } else {
-        *sbfs = SBFileSystem::open(path);
+        *sbfs = SBFileSystem::open(path, options);
     }
     path_resolver = new PathResolver(sbfs, kPathCacheSize);
     fd_manager = new FDManager();
 }
 
-int sb_rmw_diskinode(const char *path, struct fuse_file_info *fi, const function<int(DiskInode &)>& func) {
-    DLOG(WARNING) << "read-modify-write diskinode " << path;
+/* the inode of an open file "fi", or of "path" if it's not open. */
+Inode resolveInode(const char *path, struct fuse_file_info *fi) {
     Inode inode;
     if (!fi || !fi->fh || !fd_manager->get(fi->fh, &inode)) {
         /* not open, resolve path. */
         inode = path_resolver->resolve(string(path));
     }
+    return inode;
+}
+
+int sb_rmw_diskinode(const char *path, struct fuse_file_info *fi, const function<int(DiskInode &)>& func) {
+    DLOG(WARNING) << "read-modify-write diskinode " << path;
+    Inode inode = resolveInode(path, fi);
     if (!inode.isValid()) {
         return -ENOENT;
     }
@@ -67,15 +92,37 @@ int sb_rmw_diskinode(const char *path, struct fuse_file_info *fi, const function
     return 0;
 }
 
+void *sb_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    auto guard = lock_guard(mtx);
+    sbfs->device()->start_writeback([] {
+        /* never wait for the vfs lock, sb_destroy holds it while stopping the flusher. */
+        auto guard = unique_lock(mtx, std::try_to_lock);
+        if (guard.owns_lock()) {
+            sbfs->flush_delayed(now_ms() - kDirtyExpireMs);
+            /* dirty inodes go to their blocks, then age in the block cache like other dirty blocks. */
+            sbfs->inode_cache_->writeback_all();
+        }
+    });
+    sbfs->device()->start_pressure_monitor();
+    return nullptr;
+}
+
 void sb_destroy(void *private_data) {
     auto guard = lock_guard(mtx);
     delete path_resolver;
+    sbfs->device()->stop_pressure_monitor();
+    sbfs->device()->stop_writeback();
+    sbfs->flush_delayed();
+    sbfs->inode_cache_->writeback_all();
     sbfs->device()->sync_all();
     free(sbfs);
 }
 
 int sb_mkdir(const char *path, mode_t mode) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "mkdir " << path << " with mode " << mode;
     /* resolve path and create inode */
     string dir = string(path), parent, child;
@@ -88,9 +135,10 @@ int sb_mkdir(const char *path, mode_t mode) {
     DiskInode disk_inode(DiskInodeType::kDirectory);
     disk_inode.mode |= mode & 0777;
 
-    auto ret = parent_inode.create(child.c_str(), &disk_inode, &child_inode);
-
-    rt_assert(ret != kFail, "mkdir failed");
+    if (parent_inode.create(child.c_str(), &disk_inode, &child_inode) == kFail) {
+        DLOG(WARNING) << "mkdir failed";
+        return -EIO;
+    }
     DLOG(WARNING) << "mkdir success";
     return 0;
 }
@@ -99,6 +147,14 @@ int sb_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
                fuse_readdir_flags flags) {
     auto guard = lock_guard(mtx);
     DLOG(WARNING) << "readdir " << path << " with offset " << offset;
+    if (strcmp(path, kStatsDir) == 0) {
+        for (auto name : { ".", "..", "stats" }) {
+            filler(buf, name, nullptr, 0, (fuse_fill_dir_flags)0);
+        }
+        return 0;
+    } else if (isStatsPath(path)) {
+        return -ENOTDIR;
+    }
     /* resolve path */
     string dir = string(path);
     Inode inode = path_resolver->resolve(dir);
@@ -114,17 +170,20 @@ int sb_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
         return -ENOTDIR;
     }
 
-    /* Read all blocks and list each of them. */
-    uint32_t tot_blocks = disk_inode.total_blocks(disk_inode.size);
-    DLOG(INFO) << "start listing with total blocks " << tot_blocks;
-    for (uint32_t block_id = 0; block_id < tot_blocks; ++block_id) {
-        DirBlock dir_block;  // Don't move it outside because we should reset this block every time.
-        auto dir_ret = inode.read_data(block_id * sizeof(DirBlock), (uint8_t *)&dir_block, sizeof(DirBlock));
-        rt_assert(dir_ret != kFail, "read dir block failed");
-        for (auto &entry : dir_block.entries) {
-            DLOG(INFO) << "Cur entry " << entry.inode << " " << entry.name;
-            if (entry.isValid()) {
-                filler(buf, entry.name, nullptr, 0, (fuse_fill_dir_flags)0);
+    /* List entries of each block in place. */
+    uint32_t cnt = disk_inode.size / sizeof(DirEntry);
+    DLOG(INFO) << "start listing with total entries " << cnt;
+    BlockRef ref;
+    DirEntry *entries;
+    for (uint32_t i = 0; i < cnt; i += kDirEntries) {
+        if (inode.pin_entries(&disk_inode, i, &ref, &entries) == kFail) {
+            DLOG(WARNING) << "read dir block failed";
+            return -EIO;
+        }
+        for (uint32_t j = 0; j < kDirEntries && i + j < cnt; ++j) {
+            DLOG(INFO) << "Cur entry " << entries[j].inode << " " << entries[j].name;
+            if (entries[j].isValid()) {
+                filler(buf, entries[j].name, nullptr, 0, (fuse_fill_dir_flags)0);
             }
         }
     }
@@ -133,17 +192,34 @@ int sb_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
 
 int sb_getattr(const char *path, struct stat *stbuf, fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        if (strcmp(path, kStatsDir) == 0) {
+            stbuf->st_mode = S_IFDIR | 0555;
+            stbuf->st_nlink = 2;
+        } else if (strcmp(path, kStatsFile) == 0) {
+            stbuf->st_mode = S_IFREG | 0444;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = sbfs->device()->stats().size();
+        } else {
+            return -ENOENT;
+        }
+        stbuf->st_blksize = kBlockSize;
+        return 0;
+    }
+    Inode inode = resolveInode(path, fi);
     return sb_rmw_diskinode(path, fi, [&](DiskInode &disk_inode) {
+        /* with the buffered writes of delayed allocation, their blocks are reserved. */
+        uint32_t size = inode.isValid() ? inode.file_size(disk_inode) : disk_inode.size;
         stbuf->st_mode = disk_inode.mode;
         stbuf->st_atime = disk_inode.access_time;
         stbuf->st_mtime = disk_inode.modify_time;
         stbuf->st_ctime = disk_inode.change_time;
-        stbuf->st_size = disk_inode.size;
+        stbuf->st_size = size;
         stbuf->st_mode = disk_inode.mode;
         stbuf->st_nlink = disk_inode.link_cnt;
         stbuf->st_uid = disk_inode.uid;
         stbuf->st_gid = disk_inode.gid;
-        stbuf->st_blocks = disk_inode.total_blocks(disk_inode.size);
+        stbuf->st_blocks = disk_inode.total_blocks(size);
         stbuf->st_blksize = kBlockSize;
 
         return kSuccess;
@@ -152,6 +228,9 @@ int sb_getattr(const char *path, struct stat *stbuf, fuse_file_info *fi) {
 
 int sb_rmdir(const char *path) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "rmdir " << path;
     /* resolve path */
     string dir = string(path), parent, child;
@@ -178,17 +257,26 @@ int sb_rmdir(const char *path) {
         return -ENOTEMPTY;
     }
 
-    DirBlock dir_block;
-    auto dir_ret = child_inode.read_data(0, (uint8_t *)&dir_block, sizeof(DirBlock));
-    rt_assert(dir_ret != kFail, "read dir block failed");
-    for (auto &entry : dir_block.entries) {
-        if (entry.isValid() && strcmp(entry.name, ".") != 0 && strcmp(entry.name, "..") != 0) {
-            return -ENOTEMPTY;
+    {
+        uint32_t cnt = disk_inode.size / sizeof(DirEntry);
+        BlockRef ref;
+        DirEntry *entries;
+        if (child_inode.pin_entries(&disk_inode, 0, &ref, &entries) == kFail) {
+            DLOG(WARNING) << "read dir block failed";
+            return -EIO;
+        }
+        for (uint32_t j = 0; j < cnt; ++j) {
+            if (entries[j].isValid() && strcmp(entries[j].name, ".") != 0 && strcmp(entries[j].name, "..") != 0) {
+                return -ENOTEMPTY;
+            }
         }
     }
 
     /* It's an empty dir, delete it. */
-    parent_inode.remove(child.c_str());
+    if (parent_inode.remove(child.c_str()) == kFail) {
+        DLOG(WARNING) << "rmdir failed";
+        return -EIO;
+    }
     path_resolver->removePrefix(dir);
 
     return 0;
@@ -196,6 +284,9 @@ int sb_rmdir(const char *path) {
 
 int sb_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "create " << path << " with mode " << mode << " and fi " << fi;
     /* resolve path and create inode */
     string dir = string(path), parent, child;
@@ -208,14 +299,24 @@ int sb_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     DiskInode disk_inode(DiskInodeType::kFile);
     disk_inode.mode |= mode & 0777;
     /* TODO: parent not a directory, file exists... */
-    parent_inode.create(child.c_str(), &disk_inode, &child_inode);
+    if (parent_inode.create(child.c_str(), &disk_inode, &child_inode) == kFail) {
+        DLOG(WARNING) << "create failed";
+        return -EIO;
+    }
     int flags = fi->flags;
-    fi->fh = fd_manager->open(child_inode);
+    if (flags & O_DIRECT) {
+        /* bypass the page cache too. */
+        fi->direct_io = 1;
+    }
+    fi->fh = fd_manager->open(child_inode, flags & O_DIRECT);
     return 0;
 }
 
 int sb_unlink(const char *path) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "unlink " << path;
     /* resolve path */
     string dir = string(path), parent, child;
@@ -231,7 +332,10 @@ int sb_unlink(const char *path) {
     }
 
     /* Remove the file. */
-    parent_inode.remove(child.c_str());
+    if (parent_inode.remove(child.c_str()) == kFail) {
+        DLOG(WARNING) << "unlink failed";
+        return -EIO;
+    }
     path_resolver->removePrefix(dir);
 
     return 0;
@@ -239,6 +343,10 @@ int sb_unlink(const char *path) {
 
 int sb_rename(const char *oldpath, const char *newpath, unsigned int flags) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(oldpath) || isStatsPath(newpath)) {
+        return -EPERM;
+    }
+    Transaction tx(sbfs->device());
     DLOG(WARNING) << "rename " << oldpath << " to " << newpath;
     /* resolve path */
     string old_dir = string(oldpath), old_parent, old_child;
@@ -253,6 +361,12 @@ int sb_rename(const char *oldpath, const char *newpath, unsigned int flags) {
     DLOG(WARNING) << "new_parent: " << new_parent << " new_child: " << new_child;
     DLOG(WARNING) << "old_parent: " << old_parent << " old_child: " << old_child;
     Inode new_parent_inode = path_resolver->resolve(new_parent), new_child_inode;
+    if (!new_parent_inode.isValid()) {
+        return -ENOENT;
+    }
+    if ((flags & RENAME_NOREPLACE) && new_parent_inode.find(new_child.c_str(), &new_child_inode) == kSuccess) {
+        return -EEXIST;
+    }
 
     int unlink_ret = old_parent_inode.unlink(old_child.c_str(), &old_child_inode);
     if (unlink_ret == kFail) {
@@ -264,12 +378,19 @@ int sb_rename(const char *oldpath, const char *newpath, unsigned int flags) {
 
     /* link the new inode to old inode. */
     if (exchange) {
-        new_parent_inode.unlink(new_child.c_str(), &new_child_inode);
-        old_parent_inode.link(old_child.c_str(), &new_child_inode);
+        if (new_parent_inode.unlink(new_child.c_str(), &new_child_inode) == kFail) {
+            return -ENOENT;
+        }
+        if (old_parent_inode.link(old_child.c_str(), &new_child_inode) == kFail) {
+            return -EIO;
+        }
     }
 
-    /* link the old inode to new. */
-    new_parent_inode.link(new_child.c_str(), &old_child_inode, replace);
+    /* link the old inode to new, all of it is committed at once (or nothing if any step failed). */
+    if (new_parent_inode.link(new_child.c_str(), &old_child_inode, replace) == kFail || tx.commit() == kFail) {
+        DLOG(WARNING) << "rename failed";
+        return -EIO;
+    }
 
     path_resolver->removePrefix(old_dir);
     path_resolver->removePrefix(new_dir);
@@ -279,6 +400,17 @@ int sb_rename(const char *oldpath, const char *newpath, unsigned int flags) {
 int sb_open(const char *path, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
     DLOG(WARNING) << "open " << path;
+    if (strcmp(path, kStatsFile) == 0) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        /* no page cache, the content changes and its size is not known ahead. */
+        fi->direct_io = 1;
+        fi->fh = 0;
+        return 0;
+    } else if (isStatsPath(path)) {
+        return -ENOENT;
+    }
     /* resolve path */
     Inode inode = path_resolver->resolve(string(path));
     if (!inode.isValid()) {
@@ -286,13 +418,20 @@ int sb_open(const char *path, struct fuse_file_info *fi) {
     }
     /* TODO: handle O_RDONLY, O_WRONLY, O_RDWR, O_EXEC, O_SEARCH */
     int flags = fi->flags;
-    fi->fh = fd_manager->open(inode);
+    if (flags & O_DIRECT) {
+        /* bypass the page cache too. */
+        fi->direct_io = 1;
+    }
+    fi->fh = fd_manager->open(inode, flags & O_DIRECT);
     return 0;
 }
 
 int sb_release(const char *path, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
     DLOG(WARNING) << "release " << path << " " << fi << " " << fi->fh;
+    if (isStatsPath(path)) {
+        return 0;
+    }
     fd_manager->close(fi->fh);
     fi->fh = 0;
     return 0;
@@ -306,13 +445,22 @@ int sb_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
         DLOG(WARNING) << "read size > 4GB";
         return -EINVAL;
     }
+    if (strcmp(path, kStatsFile) == 0) {
+        string report = sbfs->device()->stats();
+        if ((size_t)offset >= report.size()) {
+            return 0;
+        }
+        size = std::min(size, report.size() - offset);
+        memcpy(buf, report.data() + offset, size);
+        return size;
+    }
     Inode inode;
     if (!fd_manager->get(fi->fh, &inode)) {
         DLOG(WARNING) << "invalid fd";
         return -EBADF;
     }
     int ret = 0;
-    if ((ret = inode.read_data(offset, (uint8_t *)buf, size)) == kFail) {
+    if ((ret = inode.read_data(offset, (uint8_t *)buf, size, isDirect(fi->fh, size))) == kFail) {
         DLOG(WARNING) << "read data failed";
         return -EIO;
     }
@@ -323,6 +471,9 @@ int sb_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
 
 int sb_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "write " << path << " with size " << size << " and offset " << offset << " and fh " << fi->fh;
     if (size > UINT32_MAX) {
         /* Temporarily not support write > 4GB */
@@ -335,7 +486,7 @@ int sb_write(const char *path, const char *buf, size_t size, off_t offset, struc
         return -EBADF;
     }
     int ret = 0;
-    if ((ret = inode.write_data(offset, (uint8_t *)buf, size)) == kFail) {
+    if ((ret = inode.write_data(offset, (uint8_t *)buf, size, isDirect(fi->fh, size))) == kFail) {
         DLOG(WARNING) << "write data failed";
         return -EIO;
     }
@@ -345,6 +496,9 @@ int sb_write(const char *path, const char *buf, size_t size, off_t offset, struc
 
 int sb_truncate(const char *path, off_t off, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "truncate " << path << " with offset " << off;
     if (off > UINT32_MAX) {
         /* Temporarily not support truncate > 4GB */
@@ -371,25 +525,41 @@ int sb_statfs(const char *path, struct statvfs *stbuf) {
     DLOG(WARNING) << "statfs " << path;
     stbuf->f_bsize = kBlockSize;
     stbuf->f_frsize = kBlockSize;
-    stbuf->f_blocks = kDiskSize / kBlockSize;
-    stbuf->f_bfree = kDiskSize / kBlockSize;
-    stbuf->f_bavail = kDiskSize / kBlockSize;
-    stbuf->f_files = kInodeBitmapBlocks * kBlockSize * 8;
-    stbuf->f_ffree = kInodeBitmapBlocks * kBlockSize * 8;
-    stbuf->f_favail = kInodeBitmapBlocks * kBlockSize * 8;
+    uint64_t blocks, free_blocks, inodes, free_inodes;
+    sbfs->usage(&blocks, &free_blocks, &inodes, &free_inodes);
+    stbuf->f_blocks = blocks;
+    stbuf->f_bfree = free_blocks;
+    stbuf->f_bavail = free_blocks;
+    stbuf->f_files = inodes;
+    stbuf->f_ffree = free_inodes;
+    stbuf->f_favail = free_inodes;
     stbuf->f_namemax = 255;
-    /* TODO: unimplemented, need block info */
     return 0;
 }
 
 int sb_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
-    auto guard = lock_guard(mtx);
+    auto guard = unique_lock(mtx);
     DLOG(WARNING) << "fsync " << path;
+    if (isStatsPath(path)) {
+        /* nothing to sync. */
+        return 0;
+    }
     Inode inode;
     if (!fd_manager->get(fi->fh, &inode)) {
         DLOG(WARNING) << "invalid fd";
         return -EBADF;
     }
+    /* blocks of buffered writes are allocated, and the inode is written to its block, under the global lock. */
+    if (inode.flush() == kFail) {
+        DLOG(WARNING) << "flush delayed allocation failed";
+        return -EIO;
+    }
+    if (sbfs->inode_cache_->writeback(inode.pos.block_id) == kFail) {
+        DLOG(WARNING) << "write back inode failed";
+        return -EIO;
+    }
+    /* release the global lock while waiting for the disk, so that concurrent fsyncs are grouped. */
+    guard.unlock();
     if (inode.sync(datasync == 0) == kFail) {
         DLOG(WARNING) << "sync failed";
         return -EIO;
@@ -399,6 +569,9 @@ int sb_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
 
 int sb_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "utimens " << path;
     return sb_rmw_diskinode(path, fi, [=](DiskInode &disk_inode) {
         disk_inode.access_time = tv[0].tv_sec + tv[0].tv_nsec / 1000000000.0;
@@ -409,6 +582,9 @@ int sb_utimens(const char *path, const struct timespec tv[2], struct fuse_file_i
 
 int sb_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "chmod " << path;
     return sb_rmw_diskinode(path, fi, [=](DiskInode &disk_inode) {
         disk_inode.mode = mode;
@@ -418,6 +594,9 @@ int sb_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
 
 int sb_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
     auto guard = lock_guard(mtx);
+    if (isStatsPath(path)) {
+        return -EPERM;
+    }
     DLOG(WARNING) << "chown " << path;
     return sb_rmw_diskinode(path, fi, [=](DiskInode &disk_inode) {
         disk_inode.uid = uid;
@@ -0,0 +1,109 @@
+// Free-bit search of the bitmaps at various fill ratios, for each scan kernel the CPU supports:
+// the word scan alone over one bitmap block (512 words), and Bitmap::alloc_range from random goals
+// on a 16GB data bitmap (128 blocks), which scans forward from the goal for a free run.
+// Fill ratio f: each word is full with probability f, otherwise it has a few free bits
+// (the last word of the bitmap is always free, so that there is room to allocate at 1.0).
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "bitscan.h"
+#include "fs_layout.h"
+
+using namespace sbfs;
+
+constexpr uint64_t kWordsPerBlock = kBlockSize / sizeof(uint64_t);
+constexpr uint32_t kBitmapBlocks = 128;  // 16GB of data blocks
+constexpr int kScans = 200000;
+constexpr int kAllocs = 20000;
+constexpr uint32_t kAllocBlocks = 16;
+constexpr double kFills[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+size_t sink;  // keeps the scans from being optimized out
+
+static uint64_t partial_word(std::mt19937_64 &rng) {
+    uint64_t w = rng() | rng();
+    return w == UINT64_MAX ? w & ~(1ull << (rng() % 64)) : w;
+}
+
+static double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* ns per scan of a bitmap block for the first word with a free bit. */
+static double bench_scan(double fill) {
+    std::mt19937_64 rng(1);
+    std::vector<std::vector<uint64_t>> blocks(64, std::vector<uint64_t>(kWordsPerBlock));
+    for (auto &b : blocks) {
+        for (auto &w : b) {
+            w = std::bernoulli_distribution(fill)(rng) ? UINT64_MAX : partial_word(rng);
+        }
+    }
+    size_t sum = 0;
+    double start = now_s();
+    for (int i = 0; i < kScans; ++i) {
+        sum += find_word_not(blocks[i % blocks.size()].data(), kWordsPerBlock, UINT64_MAX);
+    }
+    double t = now_s() - start;
+    sink += sum;
+    return t / kScans * 1e9;
+}
+
+/* ns per alloc_range + free_range of kAllocBlocks from a random goal. */
+static double bench_alloc(double fill) {
+    DeviceOptions options;
+    options.backend = kRamBackend;
+    options.cache_size = MB(16);
+    BlockDevice dev("", (1 + kBitmapBlocks) * kBlockSize, options);
+    Bitmap bitmap(1, kBitmapBlocks, 1 + kBitmapBlocks);
+    bitmap.load(&dev, true);
+    std::mt19937_64 rng(2);
+    /* fill word by word, like an aged file system, each run of set bits with one alloc_range from its start. */
+    const blk_id_t base = 1 + kBitmapBlocks;
+    uint64_t run = 0, word = 0;
+    for (uint64_t bit = 0; bit <= bitmap.total(); ++bit) {
+        if (bit % 64 == 0 && bit + 64 < bitmap.total()) {
+            word = std::bernoulli_distribution(fill)(rng) ? UINT64_MAX : partial_word(rng);
+        } else if (bit % 64 == 0) {
+            word = 0;
+        }
+        if (bit < bitmap.total() && (word >> (bit % 64) & 1)) {
+            ++run;
+            continue;
+        }
+        std::vector<Extent> got;
+        if (run > 0) {
+            bitmap.alloc_range(run, base + bit - run, &got, &dev);
+        }
+        run = 0;
+    }
+    double start = now_s();
+    for (int i = 0; i < kAllocs; ++i) {
+        blk_id_t goal = base + rng() % bitmap.total();
+        std::vector<Extent> got;
+        if (bitmap.alloc_range(kAllocBlocks, goal, &got, &dev) != kSuccess) {
+            printf("alloc failed\n");
+            break;
+        }
+        for (auto &e : got) {
+            bitmap.free_range(e.start, e.len, &dev);
+        }
+    }
+    return (now_s() - start) / kAllocs * 1e9;
+}
+
+int main() {
+    printf("%-8s %8s %14s %18s\n", "kernel", "fill", "scan ns/block", "alloc_range ns/op");
+    for (auto kernel : { kScalarScan, kAVX2Scan, kAVX512Scan }) {
+        if (set_bitscan_kernel(kernel) != kSuccess) {
+            printf("%-8s not supported by this CPU\n", bitscan_kernel_name(kernel));
+            continue;
+        }
+        for (double fill : kFills) {
+            printf("%-8s %8.3f %14.1f %18.1f\n", bitscan_kernel_name(kernel), fill, bench_scan(fill),
+                   bench_alloc(fill));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Block cache replacement policies under a mixed workload:
+// point lookups on a hot set (like inode table, bitmap and index blocks)
+// interleaved with large sequential scans (like compaction inputs or `cat` of a big file).
+// Each round does a burst of lookups alone, then a scan with a lookup every few scanned blocks.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "blk_dev.h"
+#include "lru_cache.h"
+
+using namespace sbfs;
+
+constexpr uint64_t kCacheBlocks = 16384;     // 64MB cache
+constexpr uint64_t kDiskBlocks = 262144;     // 1GB RAM disk
+constexpr uint64_t kHotBlocks = 4096;        // hot set, 1/4 of the cache
+constexpr uint64_t kScanBlocks = 32768;      // each scan reads 2x the cache
+constexpr uint64_t kLookupsPerRound = 20000;
+constexpr uint64_t kScanPerLookup = 4;       // scanned blocks per lookup during a scan
+constexpr int kRounds = 20;
+
+struct Result {
+    uint64_t hot_hits, hot_lookups, scan_hits, scan_reads;
+    double seconds;
+};
+
+static bool access(LRUCacheManager &cache, BlockDevice &dev, blk_id_t id, Block *buf) {
+    if (cache.get(id, buf) == kSuccess) {
+        return true;
+    }
+    dev.read_from_disk(id, buf);
+    cache.fill(id, buf);
+    return false;
+}
+
+static Result run(BlockDevice &dev, CachePolicy policy) {
+    LRUCacheManager cache(kCacheBlocks * kBlockSize, &dev, policy);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<blk_id_t> hot(0, kHotBlocks - 1);
+    Block buf;
+    Result r{};
+    auto start = std::chrono::steady_clock::now();
+    blk_id_t scan_pos = kHotBlocks;
+    for (int round = 0; round < kRounds; ++round) {
+        for (uint64_t i = 0; i < kLookupsPerRound; ++i) {
+            r.hot_hits += access(cache, dev, hot(rng), &buf);
+            ++r.hot_lookups;
+        }
+        for (uint64_t i = 0; i < kScanBlocks; ++i) {
+            r.scan_hits += access(cache, dev, scan_pos, &buf);
+            ++r.scan_reads;
+            scan_pos = scan_pos + 1 < kDiskBlocks ? scan_pos + 1 : kHotBlocks;
+            if (i % kScanPerLookup == 0) {
+                r.hot_hits += access(cache, dev, hot(rng), &buf);
+                ++r.hot_lookups;
+            }
+        }
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+int main() {
+    DeviceOptions options;
+    options.backend = kRamBackend;
+    BlockDevice dev("", kDiskBlocks * kBlockSize, options);
+
+    printf("%-6s %12s %12s %10s %12s\n", "policy", "hot hit %", "scan hit %", "seconds", "Mops/s");
+    for (auto [name, policy] : { std::make_pair("lru", kLRUPolicy), std::make_pair("2q", k2QPolicy) }) {
+        Result r = run(dev, policy);
+        printf("%-6s %12.2f %12.2f %10.3f %12.3f\n", name, 100.0 * r.hot_hits / r.hot_lookups,
+               100.0 * r.scan_hits / r.scan_reads, r.seconds, (r.hot_lookups + r.scan_reads) / r.seconds / 1e6);
+    }
+    return 0;
+}